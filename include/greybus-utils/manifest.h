@@ -84,6 +84,22 @@ int manifest_create(uint8_t buf[], size_t len);
  */
 size_t manifest_size(void);
 
+/**
+ * Write the greybus manifest of a subset of the bundles to the buffer. The control bundle is
+ * always included. CPorts are numbered in order, skipping the CPorts of the other bundles.
+ *
+ * @param bundle_mask Bit n set for bundle n
+ *
+ * @return size written if successful.
+ * @return -errno in case of error.
+ */
+int manifest_create_bundles(uint8_t buf[], size_t len, uint32_t bundle_mask);
+
+/**
+ * Get the size of the greybus manifest of a subset of the bundles.
+ */
+size_t manifest_size_bundles(uint32_t bundle_mask);
+
 /**
  * Print greybus manifest to stdout. Intended for debugging.
  */
@@ -41,20 +41,40 @@ struct gb_msg_with_cport {
 	struct gb_message *msg;
 };
 
+/**
+ * A piece of a message given to the send_iov callback of a transport backend.
+ */
+struct gb_iovec {
+	const void *base;
+	size_t len;
+};
+
 /**
  * Greybus transport backend structure.
  */
 struct gb_transport_backend {
-	/* Initialize transport backend */
+	/* Initialize transport backend. Called again when greybus is restarted. */
 	int (*init)(void);
-	/* De-initialize transport backend */
+	/*
+	 * De-initialize transport backend. Must stop calling greybus_rx_handler, and free all
+	 * messages the backend still holds.
+	 */
 	void (*exit)(void);
 	/* Enable cport */
 	int (*listen)(uint16_t cport);
 	/* Disable cport */
 	int (*stop_listening)(uint16_t cport);
-	/* Send greybus message */
+	/* Send greybus message. The backend may stage it until flush is called. */
 	int (*send)(uint16_t cport, const struct gb_message *msg);
+	/*
+	 * Send greybus message made of a header and payload pieces, header size covering all of
+	 * them. The pieces are only valid during the call. Optional, the core assembles the
+	 * message and calls send without it.
+	 */
+	int (*send_iov)(uint16_t cport, const struct gb_operation_msg_hdr *hdr,
+			const struct gb_iovec *iov, size_t iov_num);
+	/* Send staged messages. Optional, called at the end of every dispatch batch. */
+	void (*flush)(void);
 };
 
 /**
@@ -63,17 +83,122 @@ struct gb_transport_backend {
  * @param transport: greybus transport backend pointer.
  *
  * @return 0 in case of success.
+ * @return -EALREADY if greybus is already initialized.
  * @return < 0 in case of error.
  */
 int gb_init(const struct gb_transport_backend *transport);
 
+/**
+ * Initialize greybus on several transports at once, each with its own AP.
+ *
+ * Every AP can use the control CPort. Other CPorts belong to the AP that connected them until they
+ * are disconnected. Responses are sent on the transport their request arrived on, and unsolicited
+ * messages on the transport of the AP that connected the CPort.
+ *
+ * @param transports: greybus transport backend pointers.
+ * @param num: number of transports, at most CONFIG_GREYBUS_TRANSPORTS_MAX.
+ *
+ * @return 0 in case of success.
+ * @return -EALREADY if greybus is already initialized.
+ * @return < 0 in case of error.
+ */
+int gb_init_transports(const struct gb_transport_backend *const *transports, size_t num);
+
 /**
  * De-initialize greybus.
+ *
+ * Running operations are given time to finish, outstanding requests are cancelled, all CPorts are
+ * disconnected and messages that were never dispatched are freed. greybus can be initialized again
+ * afterwards.
  */
 void gb_deinit(void);
 
 /**
- * Submit greybus message for processing.
+ * Stop greybus and start it again on the same transports, without rebooting. AP has to connect the
+ * CPorts again.
+ *
+ * Must not be called from greybus threads, including operation handlers.
+ *
+ * @return 0 in case of success.
+ * @return -EINVAL if greybus is not initialized.
+ * @return < 0 in case of other error.
+ */
+int gb_restart(void);
+
+/**
+ * A downstream node of a bridge (see CONFIG_GREYBUS_BRIDGE).
+ *
+ * The upstream AP sees CPort n of the node as CPort cport_base + n of the bridge.
+ */
+struct gb_bridge_link {
+	/* Transport the node is reached on */
+	const struct gb_transport_backend *transport;
+	/* First upstream CPort of the node, above the CPorts of the bridge itself */
+	uint16_t cport_base;
+	/* Number of CPorts of the node */
+	uint16_t cport_count;
+};
+
+/**
+ * Forward the traffic of downstream nodes to and from the upstream AP. All transports must be
+ * passed to gb_init_transports as well. The links must stay valid until the bridge is set again.
+ *
+ * Must be called while greybus is stopped.
+ *
+ * @param upstream: transport of the upstream AP.
+ * @param links: downstream nodes, with non-overlapping CPort windows.
+ * @param num: number of links, 0 to stop bridging.
+ *
+ * @return 0 in case of success.
+ * @return -EBUSY if greybus is running.
+ * @return -EINVAL if the links are not valid.
+ */
+int gb_bridge_set(const struct gb_transport_backend *upstream, const struct gb_bridge_link *links,
+		  size_t num);
+
+/**
+ * A virtual interface of the node (see CONFIG_GREYBUS_INTERFACES).
+ *
+ * The AP of the interface sees a manifest with only the bundles of the interface, and CPort n of
+ * the interface is the n-th CPort of the node that belongs to these bundles. CPort 0 is the control
+ * CPort, which all interfaces share.
+ */
+struct gb_interface {
+	/* Transport of the AP that owns the interface */
+	const struct gb_transport_backend *transport;
+	/* Bundles of the interface, bit n for bundle n. The control bundle is always included. */
+	uint32_t bundles;
+	/*
+	 * Bytes the queued requests of the interface may hold in the greybus heap, 0 for no
+	 * limit
+	 */
+	size_t heap_budget;
+};
+
+/**
+ * Split the node into virtual interfaces, each owned by the AP of its own transport. Transports
+ * without an interface still see the whole node. All transports must be passed to
+ * gb_init_transports as well. The interfaces must stay valid until they are set again.
+ *
+ * Must be called while greybus is stopped.
+ *
+ * @param interfaces: interfaces, with disjoint bundles and different transports.
+ * @param num: number of interfaces, 0 to expose the whole node on every transport.
+ *
+ * @return 0 in case of success.
+ * @return -EBUSY if greybus is running.
+ * @return -EINVAL if the interfaces are not valid.
+ */
+int gb_interfaces_set(const struct gb_interface *interfaces, size_t num);
+
+/**
+ * Submit greybus message received on a transport for processing.
+ */
+int greybus_rx_handler_from(const struct gb_transport_backend *transport, uint16_t cport,
+			    struct gb_message *msg);
+
+/**
+ * Submit greybus message received on the first transport for processing.
  */
 int greybus_rx_handler(uint16_t cport, struct gb_message *msg);
 
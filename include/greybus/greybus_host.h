@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2025 Ayush Singh, BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * AP side of greybus (see CONFIG_GREYBUS_HOST). A node can drive the CPorts of a remote module
+ * reached on one of its transports, while still being a module for its own AP.
+ */
+
+#ifndef _GREYBUS_HOST_H_
+#define _GREYBUS_HOST_H_
+
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include <greybus/greybus.h>
+#include <greybus/greybus_messages.h>
+
+struct gb_host;
+
+/*
+ * Called once for every request sent by a host.
+ *
+ * Responses are delivered on the receive thread of the transport and timeouts on the system
+ * workqueue, so the callback must not block.
+ *
+ * @param host Host the request was sent by
+ * @param cport CPort of the remote module
+ * @param resp Response to the request, owned by the callback. NULL if err is not 0.
+ * @param err 0 if a response arrived, -ETIMEDOUT if none arrived in time, -ECANCELED if greybus
+ *            was stopped.
+ * @param user_data user_data given with the request
+ */
+typedef void (*gb_host_callback_t)(struct gb_host *host, uint16_t cport, struct gb_message *resp,
+				   int err, void *user_data);
+
+/**
+ * A remote module, driven by this node as its AP.
+ */
+struct gb_host {
+	/* Transport the module is reached on. Must be passed to gb_init_transports as well. */
+	const struct gb_transport_backend *transport;
+	/*
+	 * Requests of the module, e.g. GPIO IRQ events. Owns the request. Called on the receive
+	 * thread of the transport. Optional, requests are dropped without it.
+	 */
+	void (*request)(struct gb_host *host, uint16_t cport, struct gb_message *req);
+};
+
+/**
+ * A message of an I2C transfer.
+ */
+struct gb_host_i2c_msg {
+	uint16_t addr;
+	/* GB_I2C_M_* flags. Data of GB_I2C_M_RD messages is returned in the response. */
+	uint16_t flags;
+	uint16_t len;
+	/* Data of write messages */
+	const uint8_t *buf;
+};
+
+/**
+ * A transfer of an SPI message.
+ */
+struct gb_host_spi_xfer {
+	uint32_t speed_hz;
+	uint32_t len;
+	/* Data to write, NULL for a read only transfer */
+	const uint8_t *tx_buf;
+	/* Data is read back and returned in the response */
+	bool rx;
+	uint8_t bits_per_word;
+};
+
+/**
+ * Route the traffic of a transport to a host instead of the local CPorts.
+ *
+ * Must be called while greybus is stopped. The host must stay valid until it is unregistered.
+ *
+ * @return 0 in case of success.
+ * @return -EBUSY if greybus is running.
+ * @return -EALREADY if the transport already has a host.
+ * @return -ENOMEM if CONFIG_GREYBUS_TRANSPORTS_MAX hosts are registered.
+ */
+int gb_host_register(struct gb_host *host);
+
+/**
+ * Give the transport of a host back to the local CPorts.
+ *
+ * Must be called while greybus is stopped.
+ *
+ * @return 0 in case of success.
+ * @return -EBUSY if greybus is running.
+ * @return -ENOENT if the host is not registered.
+ */
+int gb_host_unregister(struct gb_host *host);
+
+/**
+ * Send a request to the module and track it until a response arrives or the timeout expires.
+ *
+ * This function does not take ownership over the request.
+ *
+ * @param host
+ * @param cport CPort of the module
+ * @param req Request message. Must not be unidirectional.
+ * @param cb Callback. Can be NULL if the response is not interesting.
+ * @param user_data Passed to the callback
+ * @param timeout Time to wait for the response
+ *
+ * @return 0 on success, -EBUSY if too many requests are outstanding, or a transport error.
+ */
+int gb_host_request_send(struct gb_host *host, uint16_t cport, const struct gb_message *req,
+			 gb_host_callback_t cb, void *user_data, k_timeout_t timeout);
+
+/**
+ * Build a request with a copy of @p payload and send it with gb_host_request_send.
+ *
+ * @return 0 on success, -ENOMEM if the request cannot be allocated, or the error of
+ *         gb_host_request_send.
+ */
+int gb_host_request(struct gb_host *host, uint16_t cport, uint8_t type, const void *payload,
+		    size_t payload_len, gb_host_callback_t cb, void *user_data,
+		    k_timeout_t timeout);
+
+/**
+ * Fetch the manifest of the module. The response payload is the manifest.
+ */
+int gb_host_manifest_get(struct gb_host *host, gb_host_callback_t cb, void *user_data,
+			 k_timeout_t timeout);
+
+/**
+ * Walk the CPort descriptors of a manifest.
+ *
+ * @param manifest Payload of a GB_CONTROL_TYPE_GET_MANIFEST response
+ * @param len Length of the payload
+ * @param cb Called for every CPort with its bundle and protocol
+ * @param user_data Passed to the callback
+ *
+ * @return number of CPorts, -EINVAL if the manifest is malformed.
+ */
+int gb_host_manifest_foreach_cport(const void *manifest, size_t len,
+				   void (*cb)(uint16_t cport, uint8_t bundle, uint8_t protocol,
+					      void *user_data),
+				   void *user_data);
+
+/**
+ * Open a connection to a CPort of the module.
+ */
+int gb_host_connect(struct gb_host *host, uint16_t cport, gb_host_callback_t cb, void *user_data,
+		    k_timeout_t timeout);
+
+/**
+ * Close a connection to a CPort of the module.
+ */
+int gb_host_disconnect(struct gb_host *host, uint16_t cport, gb_host_callback_t cb,
+		       void *user_data, k_timeout_t timeout);
+
+/**
+ * Configure a GPIO line as input.
+ */
+int gb_host_gpio_direction_in(struct gb_host *host, uint16_t cport, uint8_t which,
+			      gb_host_callback_t cb, void *user_data, k_timeout_t timeout);
+
+/**
+ * Configure a GPIO line as output with an initial value.
+ */
+int gb_host_gpio_direction_out(struct gb_host *host, uint16_t cport, uint8_t which,
+			       uint8_t value, gb_host_callback_t cb, void *user_data,
+			       k_timeout_t timeout);
+
+/**
+ * Read a GPIO line. The response payload is a struct gb_gpio_get_value_response.
+ */
+int gb_host_gpio_get_value(struct gb_host *host, uint16_t cport, uint8_t which,
+			   gb_host_callback_t cb, void *user_data, k_timeout_t timeout);
+
+/**
+ * Set the value of a GPIO output.
+ */
+int gb_host_gpio_set_value(struct gb_host *host, uint16_t cport, uint8_t which, uint8_t value,
+			   gb_host_callback_t cb, void *user_data, k_timeout_t timeout);
+
+/**
+ * Execute an I2C transfer. The response payload is the data of the read messages, in order.
+ */
+int gb_host_i2c_transfer(struct gb_host *host, uint16_t cport, const struct gb_host_i2c_msg *msgs,
+			 size_t num, gb_host_callback_t cb, void *user_data, k_timeout_t timeout);
+
+/**
+ * Execute an SPI message. The response payload is the data of the read transfers, in order.
+ */
+int gb_host_spi_transfer(struct gb_host *host, uint16_t cport, uint8_t chip_select, uint8_t mode,
+			 const struct gb_host_spi_xfer *xfers, size_t num, gb_host_callback_t cb,
+			 void *user_data, k_timeout_t timeout);
+
+/**
+ * Send data on a UART.
+ */
+int gb_host_uart_send(struct gb_host *host, uint16_t cport, const uint8_t *data, uint16_t len,
+		      gb_host_callback_t cb, void *user_data, k_timeout_t timeout);
+
+#endif // _GREYBUS_HOST_H_
@@ -128,12 +128,68 @@ struct gb_message *gb_message_alloc(size_t payload_len, uint8_t message_type, ui
 				    uint8_t status);
 
 /*
- * Deallocate a greybus message.
+ * Allocate a greybus message on behalf of a CPort. With CONFIG_GREYBUS_CPORT_QUOTA the message
+ * counts against the quota of the CPort until it is freed, and the allocation fails instead of
+ * waiting if the CPort is over its quota or the heap is full. Same as gb_message_alloc otherwise.
+ *
+ * @param CPort
+ * @param Payload len
+ * @param Message Type
+ * @param Operation ID
+ * @param Status
+ *
+ * @return greybus message allocated on heap. Null in case of error
+ */
+struct gb_message *gb_message_alloc_cport(uint16_t cport, size_t payload_len,
+					  uint8_t message_type, uint16_t operation_id,
+					  uint8_t status);
+
+/*
+ * Deallocate a greybus message. Same as gb_message_unref: the message is only freed once the last
+ * reference is dropped.
  *
  * @param pointer to the message to deallcate
  */
 void gb_message_dealloc(struct gb_message *msg);
 
+/*
+ * Take a reference to a message allocated with gb_message_alloc, so that it can be handed to a
+ * queue, a transport or an observer without copying it. A message with more than one reference
+ * must not be modified. Messages on the stack or in flash have no reference count, this does
+ * nothing for them.
+ *
+ * @param msg: greybus message
+ *
+ * @return msg
+ */
+struct gb_message *gb_message_ref(struct gb_message *msg);
+
+/*
+ * Drop a reference to a message, and free it if it was the last one. Does nothing for messages on
+ * the stack or in flash.
+ *
+ * @param msg: greybus message. Can be NULL.
+ */
+void gb_message_unref(struct gb_message *msg);
+
+/*
+ * Check if more than one reference to a message exists. Messages on the stack or in flash are never
+ * shared.
+ *
+ * @param msg: greybus message
+ */
+bool gb_message_is_shared(const struct gb_message *msg);
+
+/*
+ * Keep a message that is only borrowed, e.g. by a transport send callback. Messages allocated with
+ * gb_message_alloc get a new reference, messages on the stack or in flash are copied.
+ *
+ * @param msg: greybus message
+ *
+ * @return greybus message to drop with gb_message_unref. Null in case of error.
+ */
+struct gb_message *gb_message_share(const struct gb_message *msg);
+
 /*
  * Allocate a greybus request message
  *
@@ -163,7 +219,9 @@ static inline struct gb_message *gb_message_response_alloc(const void *payload,
 {
 	struct gb_message *msg =
 		gb_message_alloc(payload_len, GB_RESPONSE(request_type), operation_id, status);
-	memcpy(msg->payload, payload, payload_len);
+	if (msg && payload_len) {
+		memcpy(msg->payload, payload, payload_len);
+	}
 	return msg;
 }
 
@@ -189,6 +247,22 @@ static inline struct gb_message *gb_message_response_alloc_from_req(const void *
 					 req->header.operation_id, status);
 }
 
+/*
+ * Turn a request into its response in place. The buffer of the request is reused when nobody else
+ * holds the request and the response payload fits in the request payload. Otherwise the request
+ * is moved to a larger buffer. Either way the request payload stays readable in the response, so
+ * a handler can write read-back data over the parts of the request it is done with.
+ *
+ * @param req: greybus request. Becomes the response on success.
+ * @param payload_len: payload length of the response
+ * @param status: result of the response
+ *
+ * @return the response. Null if the request had to be moved and allocation failed, the request is
+ *         left untouched then.
+ */
+struct gb_message *gb_message_response_in_place(struct gb_message *req, size_t payload_len,
+						uint8_t status);
+
 /**
  * Helper to create copy of greybus message.
  *
@@ -200,7 +274,9 @@ static inline struct gb_message *gb_message_copy(const struct gb_message *msg)
 	struct gb_message *resp = gb_message_alloc(payload_len, gb_message_type(msg),
 						   msg->header.operation_id, msg->header.result);
 
-	memcpy(resp->payload, msg->payload, payload_len);
+	if (resp) {
+		memcpy(resp->payload, msg->payload, payload_len);
+	}
 
 	return resp;
 }
@@ -83,6 +83,8 @@ struct gb_cport_shutdown_request {
 #define GB_CONTROL_TYPE_INTF_SUSPEND_PREPARE    0x13
 #define GB_CONTROL_TYPE_INTF_DEACTIVATE_PREPARE 0x14
 #define GB_CONTROL_TYPE_INTF_HIBERNATE_ABORT    0x15
+/* Zephyr extensions */
+#define GB_CONTROL_TYPE_CPORT_CREDITS           0x7e
 
 struct gb_control_version_request {
 	__u8 major;
@@ -128,6 +130,16 @@ struct gb_control_disconnected_request {
 } __packed;
 /* Control protocol [dis]connected response has no payload */
 
+/* Control protocol cport credits request */
+struct gb_control_cport_credits_request {
+	__le16 cport_id;
+} __packed;
+
+struct gb_control_cport_credits_response {
+	__le16 credits;
+	__le16 max_credits;
+} __packed;
+
 /*
  * All Bundle power management operations use the same request and response
  * layout and status codes.
@@ -32,62 +32,106 @@
 
 #include <greybus-utils/manifest.h>
 #include "greybus_transport.h"
+#include "greybus_cport.h"
 #include <zephyr/logging/log.h>
 #include <greybus/greybus_protocols.h>
 #include "greybus_internal.h"
+#ifdef CONFIG_GREYBUS_INTERFACES
+#include "greybus_interface.h"
+#endif // CONFIG_GREYBUS_INTERFACES
 
 LOG_MODULE_REGISTER(greybus_control, CONFIG_GREYBUS_LOG_LEVEL);
 
 #define GB_CONTROL_VERSION_MAJOR 0
 #define GB_CONTROL_VERSION_MINOR 1
 
-static void gb_control_protocol_version(uint16_t cport, struct gb_message *req)
-{
-	const struct gb_control_version_request resp_data = {
-		.major = GB_CONTROL_VERSION_MAJOR,
-		.minor = GB_CONTROL_VERSION_MINOR,
-	};
+static const struct gb_control_version_request gb_control_version = {
+	.major = GB_CONTROL_VERSION_MAJOR,
+	.minor = GB_CONTROL_VERSION_MINOR,
+};
 
-	gb_transport_message_response_success_send(req, &resp_data, sizeof(resp_data), cport);
+static const struct gb_control_bundle_pm_response gb_control_pm_ok = {
+	.status = GB_CONTROL_BUNDLE_PM_OK,
+};
+
+#ifdef CONFIG_GREYBUS_INTERFACES
+/*
+ * Bundles of the interface the request being executed arrived on. Every interface has its own
+ * manifest.
+ */
+static uint32_t gb_control_bundles(uint16_t cport)
+{
+	return gb_interface_bundles(gb_transport_get(gb_cport_get(cport)->rx_transport));
 }
 
-static void gb_control_get_manifest_size(uint16_t cport, struct gb_message *req)
+static void gb_control_get_manifest_size(const void *priv, struct gb_message *req, uint16_t cport)
 {
 	const struct gb_control_get_manifest_size_response resp_data = {
-		.size = sys_cpu_to_le16(manifest_size()),
+		.size = sys_cpu_to_le16(manifest_size_bundles(gb_control_bundles(cport))),
 	};
 
+	ARG_UNUSED(priv);
+
 	gb_transport_message_response_success_send(req, &resp_data, sizeof(resp_data), cport);
 }
+#else
+/* The manifest does not change at runtime. Filled at init. */
+static struct gb_control_get_manifest_size_response gb_control_manifest_size;
+
+static uint32_t gb_control_bundles(uint16_t cport)
+{
+	ARG_UNUSED(cport);
+
+	return UINT32_MAX;
+}
+#endif // CONFIG_GREYBUS_INTERFACES
 
-static void gb_control_get_manifest(uint16_t cport, struct gb_message *req)
+static void gb_control_get_manifest(const void *priv, struct gb_message *req, uint16_t cport)
 {
-	struct gb_message *msg = gb_message_alloc(manifest_size(), GB_RESPONSE(req->header.type),
+	const uint32_t bundles = gb_control_bundles(cport);
+	const size_t size = manifest_size_bundles(bundles);
+	struct gb_message *msg = gb_message_alloc(size, GB_RESPONSE(req->header.type),
 						  req->header.operation_id, GB_OP_SUCCESS);
 
-	manifest_create(msg->payload, manifest_size());
+	ARG_UNUSED(priv);
+
+	manifest_create_bundles(msg->payload, size, bundles);
 
 	gb_transport_message_send(msg, cport);
 
 	gb_message_dealloc(msg);
 }
 
-static void gb_control_connected(uint16_t cport, struct gb_message *req)
+static void gb_control_connected(const void *priv, struct gb_message *req, uint16_t cport)
 {
 	int retval;
 	const struct gb_control_connected_request *req_data =
 		(const struct gb_control_connected_request *)req->payload;
 	uint16_t target_cport = sys_le16_to_cpu(req_data->cport_id);
 
-	if (gb_message_payload_len(req) < sizeof(*req_data)) {
-		LOG_ERR("dropping short message");
+	ARG_UNUSED(priv);
+
+	retval = gb_cport_connect(target_cport);
+	if (retval == -EALREADY) {
+		/* AP may repeat Connected, e.g. after it lost the response */
+		LOG_DBG("CPort %u already connected", target_cport);
+		return gb_transport_message_empty_response_send(req, GB_OP_SUCCESS, cport);
+	} else if (retval == -EBUSY) {
+		LOG_WRN("CPort %u is changing state", target_cport);
+		return gb_transport_message_empty_response_send(req, GB_OP_RETRY, cport);
+	} else if (retval == -EINVAL || retval == -EPERM) {
+		LOG_ERR("Can not connect cport %u: error %d", target_cport, retval);
 		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
+	} else if (retval) {
+		LOG_ERR("Can not initialize cport %u: error %d", target_cport, retval);
+		return gb_transport_message_empty_response_send(req, gb_errno_to_op_result(retval),
+								cport);
 	}
 
 	retval = gb_listen(target_cport);
 	if (retval) {
-		LOG_ERR("Can not connect cport %d: error %d", sys_le16_to_cpu(req_data->cport_id),
-			retval);
+		LOG_ERR("Can not connect cport %u: error %d", target_cport, retval);
+		gb_cport_disconnect(target_cport);
 		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
 	}
 
@@ -96,25 +140,70 @@ static void gb_control_connected(uint16_t cport, struct gb_message *req)
 		goto error_notify;
 	}
 
-	return gb_transport_message_empty_response_send(req, GB_OP_SUCCESS, cport);
+	gb_transport_message_empty_response_send(req, GB_OP_SUCCESS, cport);
+
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+	/* AP listens on the CPort once it has the response */
+	gb_transport_flush();
+	gb_journal_replay(&gb_cport_get(target_cport)->journal, target_cport);
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+
+	return;
 
 error_notify:
-	gb_stop_listening(cport);
+	gb_cport_disconnect(target_cport);
+	gb_stop_listening(target_cport);
 	gb_transport_message_empty_response_send(req, gb_errno_to_op_result(retval), cport);
 }
 
-static void gb_control_disconnected(uint16_t cport, struct gb_message *req)
+static void gb_control_disconnecting(const void *priv, struct gb_message *req, uint16_t cport)
+{
+	int retval;
+	const struct gb_control_disconnecting_request *req_data =
+		(const struct gb_control_disconnecting_request *)req->payload;
+	uint16_t target_cport = sys_le16_to_cpu(req_data->cport_id);
+
+	ARG_UNUSED(priv);
+
+	/* Stop accepting new operations, pending ones can still complete */
+	retval = gb_cport_disconnecting(target_cport);
+	if (retval) {
+		LOG_ERR("Can not disconnect cport %u: error %d", target_cport, retval);
+		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
+	}
+
+	gb_transport_message_empty_response_send(req, GB_OP_SUCCESS, cport);
+}
+
+static void gb_control_disconnected(const void *priv, struct gb_message *req, uint16_t cport)
 {
 	int retval;
+	atomic_val_t state;
 	const struct gb_control_disconnected_request *req_data =
 		(const struct gb_control_disconnected_request *)req->payload;
+	uint16_t target_cport = sys_le16_to_cpu(req_data->cport_id);
+	struct gb_cport *cport_ptr = gb_cport_get(target_cport);
+
+	ARG_UNUSED(priv);
 
-	if (gb_message_payload_len(req) < sizeof(*req_data)) {
-		LOG_ERR("dropping short message");
+	if (!cport_ptr || target_cport == GB_CONTROL_CPORT_ID) {
+		LOG_ERR("Can not disconnect cport %u: error %d", target_cport, -EINVAL);
 		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
 	}
 
-	retval = gb_notify(sys_le16_to_cpu(req_data->cport_id), GB_EVT_DISCONNECTED);
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+	/* AP closed the CPort on purpose, it does not want its events anymore */
+	gb_journal_reset(&cport_ptr->journal);
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+
+	/* With lazy init, the driver of a CPort that was never connected is not initialized */
+	state = atomic_get(&cport_ptr->state);
+	if (state != GB_CPORT_STATE_CONNECTED && state != GB_CPORT_STATE_DISCONNECTING) {
+		LOG_ERR("Can not disconnect cport %u: not connected", target_cport);
+		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
+	}
+
+	retval = gb_notify(target_cport, GB_EVT_DISCONNECTED);
 	if (retval) {
 		LOG_ERR("Cannot notify GB driver of disconnect event.");
 		/*
@@ -123,67 +212,133 @@ static void gb_control_disconnected(uint16_t cport, struct gb_message *req)
 		 */
 	}
 
-	retval = gb_stop_listening(cport);
+	retval = gb_cport_disconnect(target_cport);
+	if (retval) {
+		LOG_ERR("Can not disconnect cport %u: error %d", target_cport, retval);
+		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
+	}
+
+	retval = gb_stop_listening(target_cport);
 	if (retval) {
-		LOG_ERR("Can not disconnect cport %d: error %d", cport, retval);
+		LOG_ERR("Can not disconnect cport %u: error %d", target_cport, retval);
 	}
 
 	gb_transport_message_empty_response_send(req, gb_errno_to_op_result(retval), cport);
 }
 
-static void gb_control_disconnecting(uint16_t cport, struct gb_message *req)
+#ifdef CONFIG_GREYBUS_CPORT_CREDITS
+static void gb_control_cport_credits(const void *priv, struct gb_message *req, uint16_t cport)
 {
-	gb_transport_message_empty_response_send(req, GB_OP_SUCCESS, cport);
-}
+	int credits;
+	struct gb_control_cport_credits_response resp_data;
+	const struct gb_control_cport_credits_request *req_data =
+		(const struct gb_control_cport_credits_request *)req->payload;
 
-static void gb_control_pm_stub(uint16_t cport, struct gb_message *req)
-{
-	const struct gb_control_bundle_pm_response resp_data = {
-		.status = GB_CONTROL_BUNDLE_PM_OK,
-	};
+	ARG_UNUSED(priv);
+
+	credits = gb_cport_credits(sys_le16_to_cpu(req_data->cport_id));
+	if (credits < 0) {
+		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
+	}
+
+	resp_data.credits = sys_cpu_to_le16(credits);
+	resp_data.max_credits = sys_cpu_to_le16(CONFIG_GREYBUS_CPORT_RX_QUEUE_DEPTH);
 
 	gb_transport_message_response_success_send(req, &resp_data, sizeof(resp_data), cport);
 }
+#endif // CONFIG_GREYBUS_CPORT_CREDITS
 
-static void gb_control_handler(const void *priv, struct gb_message *msg, uint16_t cport)
+static int gb_control_init(const void *priv, uint16_t cport)
 {
 	ARG_UNUSED(priv);
+	ARG_UNUSED(cport);
+
+#ifndef CONFIG_GREYBUS_INTERFACES
+	gb_control_manifest_size.size = sys_cpu_to_le16(manifest_size());
+#endif // CONFIG_GREYBUS_INTERFACES
+
+	return 0;
+}
+
+struct gb_message *gb_control_cport_remap(struct gb_message *msg, gb_control_cport_map_t map,
+					  const void *user_data)
+{
+	struct gb_control_connected_request *req_data;
+	uint16_t cport_id;
+
+	if (gb_message_is_response(msg)) {
+		return msg;
+	}
 
 	switch (gb_message_type(msg)) {
-	case GB_CONTROL_TYPE_VERSION:
-		return gb_control_protocol_version(cport, msg);
-	case GB_CONTROL_TYPE_GET_MANIFEST_SIZE:
-		return gb_control_get_manifest_size(cport, msg);
-	case GB_CONTROL_TYPE_GET_MANIFEST:
-		return gb_control_get_manifest(cport, msg);
 	case GB_CONTROL_TYPE_CONNECTED:
-		return gb_control_connected(cport, msg);
-	case GB_CONTROL_TYPE_DISCONNECTED:
-		return gb_control_disconnected(cport, msg);
 	case GB_CONTROL_TYPE_DISCONNECTING:
-		return gb_control_disconnecting(cport, msg);
-	case GB_CONTROL_TYPE_BUNDLE_ACTIVATE:
-	case GB_CONTROL_TYPE_BUNDLE_SUSPEND:
-	case GB_CONTROL_TYPE_BUNDLE_RESUME:
-	case GB_CONTROL_TYPE_BUNDLE_DEACTIVATE:
-	case GB_CONTROL_TYPE_INTF_SUSPEND_PREPARE:
-	case GB_CONTROL_TYPE_INTF_DEACTIVATE_PREPARE:
-		return gb_control_pm_stub(cport, msg);
+	case GB_CONTROL_TYPE_DISCONNECTED:
+	case GB_CONTROL_TYPE_CPORT_CREDITS:
+		break;
+	default:
+		return msg;
+	}
+
+	/* All of these start with the CPort id */
+	if (gb_message_payload_len(msg) < sizeof(*req_data)) {
+		return msg;
+	}
+
+	req_data = (struct gb_control_connected_request *)msg->payload;
+	cport_id = map(sys_le16_to_cpu(req_data->cport_id), user_data);
+
+	/* A transport can still be sending the request, e.g. a loopback */
+	msg = gb_message_unshare(msg);
+	if (!msg) {
+		return NULL;
+	}
+
+	req_data = (struct gb_control_connected_request *)msg->payload;
+	req_data->cport_id = sys_cpu_to_le16(cport_id);
+
+	return msg;
+}
+
+static const struct gb_operation_handler gb_control_handlers[] = {
+	/* Operations that only report static information are answered by the core */
+	GB_HANDLER_STATIC(GB_CONTROL_TYPE_VERSION, gb_control_version),
+#ifdef CONFIG_GREYBUS_INTERFACES
+	GB_HANDLER(GB_CONTROL_TYPE_GET_MANIFEST_SIZE, gb_control_get_manifest_size, 0,
+		   GB_HANDLER_F_INLINE),
+#else
+	GB_HANDLER_STATIC(GB_CONTROL_TYPE_GET_MANIFEST_SIZE, gb_control_manifest_size),
+#endif // CONFIG_GREYBUS_INTERFACES
+	GB_HANDLER(GB_CONTROL_TYPE_GET_MANIFEST, gb_control_get_manifest, 0, 0),
+	GB_HANDLER(GB_CONTROL_TYPE_CONNECTED, gb_control_connected,
+		   sizeof(struct gb_control_connected_request), 0),
+	GB_HANDLER(GB_CONTROL_TYPE_DISCONNECTED, gb_control_disconnected,
+		   sizeof(struct gb_control_disconnected_request), 0),
+	GB_HANDLER(GB_CONTROL_TYPE_DISCONNECTING, gb_control_disconnecting,
+		   sizeof(struct gb_control_disconnecting_request), 0),
+#ifdef CONFIG_GREYBUS_CPORT_CREDITS
+	GB_HANDLER(GB_CONTROL_TYPE_CPORT_CREDITS, gb_control_cport_credits,
+		   sizeof(struct gb_control_cport_credits_request), GB_HANDLER_F_INLINE),
+#endif // CONFIG_GREYBUS_CPORT_CREDITS
+	GB_HANDLER_STATIC(GB_CONTROL_TYPE_BUNDLE_ACTIVATE, gb_control_pm_ok),
+	GB_HANDLER_STATIC(GB_CONTROL_TYPE_BUNDLE_SUSPEND, gb_control_pm_ok),
+	GB_HANDLER_STATIC(GB_CONTROL_TYPE_BUNDLE_RESUME, gb_control_pm_ok),
+	GB_HANDLER_STATIC(GB_CONTROL_TYPE_BUNDLE_DEACTIVATE, gb_control_pm_ok),
+	GB_HANDLER_STATIC(GB_CONTROL_TYPE_INTF_SUSPEND_PREPARE, gb_control_pm_ok),
+	GB_HANDLER_STATIC(GB_CONTROL_TYPE_INTF_DEACTIVATE_PREPARE, gb_control_pm_ok),
 	/* XXX SW-4136: see control-gb.h */
 	/*GB_HANDLER(GB_CONTROL_TYPE_INTF_POWER_STATE_SET, gb_control_intf_pwr_set),
 	GB_HANDLER(GB_CONTROL_TYPE_BUNDLE_POWER_STATE_SET, gb_control_bundle_pwr_set),*/
 	/* TODO: Properly implement timesync */
-	case GB_CONTROL_TYPE_TIMESYNC_ENABLE:
-	case GB_CONTROL_TYPE_TIMESYNC_DISABLE:
-	case GB_CONTROL_TYPE_TIMESYNC_AUTHORITATIVE:
-	case GB_CONTROL_TYPE_TIMESYNC_GET_LAST_EVENT:
-		return gb_transport_message_empty_response_send(msg, GB_OP_SUCCESS, cport);
-	default:
-		LOG_ERR("Invalid type");
-		gb_transport_message_empty_response_send(msg, GB_OP_INVALID, cport);
-	}
-}
+	GB_HANDLER(GB_CONTROL_TYPE_TIMESYNC_ENABLE, gb_handler_success, 0, 0),
+	GB_HANDLER(GB_CONTROL_TYPE_TIMESYNC_DISABLE, gb_handler_success, 0, 0),
+	GB_HANDLER(GB_CONTROL_TYPE_TIMESYNC_AUTHORITATIVE, gb_handler_success, 0, 0),
+	GB_HANDLER(GB_CONTROL_TYPE_TIMESYNC_GET_LAST_EVENT, gb_handler_success, 0, 0),
+};
 
 struct gb_driver gb_control_driver = {
-	.op_handler = gb_control_handler,
+	.init = gb_control_init,
+	GB_DRIVER_HANDLERS(gb_control_handlers),
+	/* Connected and Disconnected can initialize and exit the driver of the CPort */
+	.op_budget_ms = 500,
 };
@@ -5,6 +5,7 @@
  */
 
 #include "greybus_transport.h"
+#include "greybus_operation.h"
 #include <greybus/greybus_protocols.h>
 #include <zephyr/dfu/flash_img.h>
 #include <zephyr/dfu/mcuboot.h>
@@ -27,14 +28,21 @@ struct fw_download_priv_data {
 
 static struct fw_download_priv_data priv_data = {.req_id = -1};
 
+static void gb_fw_download_fail(int req_id);
+static void gb_fw_donwnload_early_fail(uint16_t cport, u8 firmware_id, int req_id);
+
 struct fw_fetch_req {
 	struct gb_operation_msg_hdr hdr;
 	struct gb_fw_download_fetch_firmware_request req;
 };
 
-static void gb_fw_download_fetch_firmware(uint16_t cport, uint8_t id, uint16_t offset,
-					  uint16_t size)
+static void gb_fw_download_fetch_firmware_callback(uint16_t cport, struct gb_message *resp, int err,
+						   void *user_data);
+
+static void gb_fw_download_fetch_firmware(uint16_t cport, uint8_t id, uint32_t offset,
+					  uint32_t size)
 {
+	int ret;
 	const struct fw_fetch_req req = {
 		.hdr =
 			{
@@ -52,27 +60,40 @@ static void gb_fw_download_fetch_firmware(uint16_t cport, uint8_t id, uint16_t o
 			},
 	};
 
-	gb_transport_message_send((const struct gb_message *)&req, cport);
+	/* The offset tells the response which chunk it carries */
+	ret = gb_operation_request_send_default((const struct gb_message *)&req, cport,
+						gb_fw_download_fetch_firmware_callback,
+						UINT_TO_POINTER(offset));
+	if (ret < 0) {
+		LOG_ERR("Failed to send fetch firmware request: %d", ret);
+		gb_fw_donwnload_early_fail(cport, id, priv_data.req_id);
+	}
 }
 
-static void gb_fw_download_find_firmware_response_handler(uint16_t cport, struct gb_message *resp)
+static void gb_fw_download_find_firmware_callback(uint16_t cport, struct gb_message *resp, int err,
+						  void *user_data)
 {
-	const struct gb_fw_download_find_firmware_response *resp_data =
-		(const struct gb_fw_download_find_firmware_response *)resp->payload;
+	const struct gb_fw_download_find_firmware_response *resp_data;
+
+	ARG_UNUSED(user_data);
 
-	if (!gb_message_is_success(resp)) {
+	if (err < 0 || !gb_message_is_success(resp)) {
 		LOG_ERR("Find firmware request failed");
-		return gb_message_dealloc(resp);
+		gb_message_dealloc(resp);
+		return gb_fw_download_fail(priv_data.req_id);
 	}
 
+	resp_data = (const struct gb_fw_download_find_firmware_response *)resp->payload;
+
 	flash_img_init(&priv_data.ctx);
 	priv_data.fw_id = resp_data->firmware_id;
-	priv_data.fw_size = resp_data->size;
+	priv_data.fw_size = sys_le32_to_cpu(resp_data->size);
 	priv_data.offset = 0;
 
 	gb_message_dealloc(resp);
 
-	gb_fw_download_fetch_firmware(cport, resp_data->firmware_id, 0, DATA_SIZE_MAX);
+	gb_fw_download_fetch_firmware(cport, priv_data.fw_id, 0,
+				      MIN(priv_data.fw_size, DATA_SIZE_MAX));
 }
 
 static void gb_fw_release_firmware(uint16_t cport, u8 firmware_id)
@@ -85,16 +106,23 @@ static void gb_fw_release_firmware(uint16_t cport, u8 firmware_id)
 
 	req_data->firmware_id = firmware_id;
 
-	gb_transport_message_send(req, cport);
+	/* Nothing left to do if releasing fails */
+	gb_operation_request_send_default(req, cport, NULL, NULL);
 	gb_message_dealloc(req);
 }
 
-static void gb_fw_donwnload_early_fail(uint16_t cport, u8 firmware_id, uint8_t req_id)
+static void gb_fw_download_fail(int req_id)
 {
-	gb_fw_release_firmware(cport, firmware_id);
+	priv_data.req_id = -1;
 	gb_fw_mgmt_interface_fw_loaded(req_id, GB_FW_LOAD_STATUS_FAILED, 0, 0);
 }
 
+static void gb_fw_donwnload_early_fail(uint16_t cport, u8 firmware_id, int req_id)
+{
+	gb_fw_release_firmware(cport, firmware_id);
+	gb_fw_download_fail(req_id);
+}
+
 static void gb_fw_download_fetch_final(uint16_t cport, u8 firmware_id, uint8_t req_id)
 {
 	int ret;
@@ -116,18 +144,26 @@ static void gb_fw_download_fetch_final(uint16_t cport, u8 firmware_id, uint8_t r
 				       hdr.h.v1.sem_ver.minor);
 }
 
-static void gb_fw_download_fetch_firmware_response_handler(uint16_t cport, struct gb_message *resp)
+static void gb_fw_download_fetch_firmware_callback(uint16_t cport, struct gb_message *resp, int err,
+						   void *user_data)
 {
 	int ret;
 	uint32_t new_data_size;
 	uint32_t cur_data_size = MIN(priv_data.fw_size - priv_data.offset, DATA_SIZE_MAX);
 	bool is_final_write = priv_data.offset + cur_data_size >= priv_data.fw_size;
 
-	if (!gb_message_is_success(resp)) {
-		LOG_ERR("Fetch firmware request failed");
+	/* The download was aborted after this chunk was requested */
+	if (priv_data.req_id < 0 || POINTER_TO_UINT(user_data) != priv_data.offset) {
+		LOG_WRN("Dropping stale firmware chunk");
 		return gb_message_dealloc(resp);
 	}
 
+	if (err < 0 || !gb_message_is_success(resp)) {
+		LOG_ERR("Fetch firmware request failed");
+		gb_message_dealloc(resp);
+		return gb_fw_donwnload_early_fail(cport, priv_data.fw_id, priv_data.req_id);
+	}
+
 	priv_data.offset += cur_data_size;
 	if (is_final_write) {
 		gb_fw_release_firmware(cport, priv_data.fw_id);
@@ -141,7 +177,7 @@ static void gb_fw_download_fetch_firmware_response_handler(uint16_t cport, struc
 				       is_final_write);
 	if (ret < 0) {
 		LOG_ERR("Failed to write firmware to flash: %d", ret);
-		gb_fw_donwnload_early_fail(cport, priv_data.fw_id, priv_data.fw_size);
+		gb_fw_donwnload_early_fail(cport, priv_data.fw_id, priv_data.req_id);
 		return gb_message_dealloc(resp);
 	}
 
@@ -155,28 +191,13 @@ static void gb_fw_download_fetch_firmware_response_handler(uint16_t cport, struc
 	LOG_INF("Offset: %u", priv_data.offset);
 }
 
-static void op_handler(const void *priv, struct gb_message *msg, uint16_t cport)
-{
-	ARG_UNUSED(priv);
-
-	switch (gb_message_type(msg)) {
-	case GB_RESPONSE(GB_FW_DOWNLOAD_TYPE_FIND_FIRMWARE):
-		return gb_fw_download_find_firmware_response_handler(cport, msg);
-	case GB_RESPONSE(GB_FW_DOWNLOAD_TYPE_FETCH_FIRMWARE):
-		return gb_fw_download_fetch_firmware_response_handler(cport, msg);
-	case GB_RESPONSE(GB_FW_DOWNLOAD_TYPE_RELEASE_FIRMWARE):
-		return gb_message_dealloc(msg);
-	default:
-		return gb_transport_message_empty_response_send(msg, GB_OP_PROTOCOL_BAD, cport);
-	}
-}
-
 struct gb_driver gb_fw_download_driver = {
-	.op_handler = op_handler,
+	/* AP never sends requests on the firmware download CPort */
 };
 
 void gb_fw_download_find_firmware(uint8_t req_id, const char *firmware_tag)
 {
+	int ret;
 	struct gb_message *req =
 		gb_message_request_alloc(sizeof(struct gb_fw_download_find_firmware_request),
 					 GB_FW_DOWNLOAD_TYPE_FIND_FIRMWARE, false);
@@ -186,6 +207,12 @@ void gb_fw_download_find_firmware(uint8_t req_id, const char *firmware_tag)
 	priv_data.req_id = req_id;
 	strncpy(req_data->firmware_tag, firmware_tag, sizeof(req_data->firmware_tag));
 
-	gb_transport_message_send(req, GREYBUS_FW_DOWNLOAD_CPORT);
+	ret = gb_operation_request_send_default(req, GREYBUS_FW_DOWNLOAD_CPORT,
+						gb_fw_download_find_firmware_callback, NULL);
 	gb_message_dealloc(req);
+
+	if (ret < 0) {
+		LOG_ERR("Failed to send find firmware request: %d", ret);
+		gb_fw_download_fail(req_id);
+	}
 }
@@ -5,6 +5,7 @@
  */
 
 #include "greybus_transport.h"
+#include "greybus_operation.h"
 #include <greybus/greybus_protocols.h>
 #include <zephyr/dfu/mcuboot.h>
 #include <greybus-utils/manifest.h>
@@ -14,13 +15,15 @@
 
 LOG_MODULE_REGISTER(greybus_fw_mgmt, CONFIG_GREYBUS_LOG_LEVEL);
 
-static void fw_mgmt_interface_fw_version(uint16_t cport, struct gb_message *req)
+static void fw_mgmt_interface_fw_version(const void *priv, struct gb_message *req, uint16_t cport)
 {
 	int ret;
 	struct mcuboot_img_header hdr;
 	uint8_t active_slot = boot_fetch_active_slot();
 	struct gb_fw_mgmt_interface_fw_version_response resp_data;
 
+	ARG_UNUSED(priv);
+
 	ret = boot_read_bank_header(active_slot, &hdr, sizeof(hdr));
 	if (ret < 0) {
 		return gb_transport_message_empty_response_send(req, GB_OP_INTERNAL, cport);
@@ -33,13 +36,16 @@ static void fw_mgmt_interface_fw_version(uint16_t cport, struct gb_message *req)
 	gb_transport_message_response_success_send(req, &resp_data, sizeof(resp_data), cport);
 }
 
-static void fw_mgmt_interface_fw_load_and_validate(uint16_t cport, struct gb_message *req)
+static void fw_mgmt_interface_fw_load_and_validate(const void *priv, struct gb_message *req,
+						   uint16_t cport)
 {
 	uint8_t req_id;
 	char firmware_tag[10];
 	const struct gb_fw_mgmt_load_and_validate_fw_request *req_data =
 		(const struct gb_fw_mgmt_load_and_validate_fw_request *)req->payload;
 
+	ARG_UNUSED(priv);
+
 	if (req_data->load_method != GB_FW_LOAD_METHOD_UNIPRO) {
 		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
 	}
@@ -51,25 +57,28 @@ static void fw_mgmt_interface_fw_load_and_validate(uint16_t cport, struct gb_mes
 	gb_fw_download_find_firmware(req_id, firmware_tag);
 }
 
-static void op_handler(const void *priv, struct gb_message *msg, uint16_t cport)
+static const struct gb_operation_handler gb_fw_mgmt_handlers[] = {
+	GB_HANDLER(GB_FW_MGMT_TYPE_INTERFACE_FW_VERSION, fw_mgmt_interface_fw_version, 0, 0),
+	GB_HANDLER(GB_FW_MGMT_TYPE_LOAD_AND_VALIDATE_FW, fw_mgmt_interface_fw_load_and_validate,
+		   sizeof(struct gb_fw_mgmt_load_and_validate_fw_request), 0),
+};
+
+struct gb_driver gb_fw_mgmt_driver = {
+	GB_DRIVER_HANDLERS(gb_fw_mgmt_handlers),
+};
+
+static void gb_fw_mgmt_loaded_fw_callback(uint16_t cport, struct gb_message *resp, int err,
+					  void *user_data)
 {
-	ARG_UNUSED(priv);
+	ARG_UNUSED(cport);
+	ARG_UNUSED(user_data);
 
-	switch (gb_message_type(msg)) {
-	case GB_FW_MGMT_TYPE_INTERFACE_FW_VERSION:
-		return fw_mgmt_interface_fw_version(cport, msg);
-	case GB_FW_MGMT_TYPE_LOAD_AND_VALIDATE_FW:
-		return fw_mgmt_interface_fw_load_and_validate(cport, msg);
-	case GB_RESPONSE(GB_FW_MGMT_TYPE_LOADED_FW):
-		return gb_message_dealloc(msg);
-	default:
-		return gb_transport_message_empty_response_send(msg, GB_OP_PROTOCOL_BAD, cport);
+	if (err < 0 || !gb_message_is_success(resp)) {
+		LOG_ERR("Loaded firmware request failed");
 	}
-}
 
-struct gb_driver gb_fw_mgmt_driver = {
-	.op_handler = op_handler,
-};
+	gb_message_dealloc(resp);
+}
 
 void gb_fw_mgmt_interface_fw_loaded(uint8_t id, uint8_t status, uint16_t major, uint16_t minor)
 {
@@ -83,6 +92,7 @@ void gb_fw_mgmt_interface_fw_loaded(uint8_t id, uint8_t status, uint16_t major,
 	req_data->major = sys_cpu_to_le16(major);
 	req_data->minor = sys_cpu_to_le16(minor);
 
-	gb_transport_message_send(msg, GREYBUS_FW_MANAGEMENT_CPORT);
+	gb_operation_request_send_default(msg, GREYBUS_FW_MANAGEMENT_CPORT,
+					  gb_fw_mgmt_loaded_fw_callback, NULL);
 	gb_message_dealloc(msg);
 }
@@ -34,15 +34,16 @@
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/sys/byteorder.h>
 #include "greybus_transport.h"
+#include "greybus_cport.h"
 #include "greybus_gpio.h"
 #include <greybus/greybus_protocols.h>
 #include "greybus_internal.h"
 
 LOG_MODULE_REGISTER(greybus_gpio, CONFIG_GREYBUS_LOG_LEVEL);
 
-static void gb_gpio_line_count(uint16_t cport, struct gb_message *req,
-			       const struct gb_gpio_driver_data *data)
+static void gb_gpio_line_count(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	const struct gb_gpio_line_count_response resp_data = {
 		/* Need to return 1 less than number of GPIOs */
 		.count = data->ngpios - 1,
@@ -51,120 +52,72 @@ static void gb_gpio_line_count(uint16_t cport, struct gb_message *req,
 	gb_transport_message_response_success_send(req, &resp_data, sizeof(resp_data), cport);
 }
 
-static void gb_gpio_activate(uint16_t cport, struct gb_message *req, const struct device *dev)
-{
-	const struct gb_gpio_activate_request *request =
-		(const struct gb_gpio_activate_request *)req->payload;
-
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
-	/* No "activation" in Zephyr. Maybe power mgmt in the future */
-	gb_transport_message_empty_response_send(req, GB_OP_SUCCESS, cport);
-}
-
-static void gb_gpio_deactivate(uint16_t cport, struct gb_message *req, const struct device *dev)
-{
-	const struct gb_gpio_deactivate_request *request =
-		(const struct gb_gpio_deactivate_request *)req->payload;
-
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
-	/* No "deactivation" in Zephyr. Maybe power mgmt in the future */
-
-	gb_transport_message_empty_response_send(req, GB_OP_SUCCESS, cport);
-}
-
-static void gb_gpio_get_direction(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_gpio_get_direction(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	struct gb_gpio_get_direction_response resp_data;
 	const struct gb_gpio_get_direction_request *request =
 		(const struct gb_gpio_get_direction_request *)req->payload;
 
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
 	/* In Greybus 0 := output, 1 := input. */
-	resp_data.direction = gpio_pin_is_input(dev, request->which);
+	resp_data.direction = gpio_pin_is_input(data->dev, request->which);
 	gb_transport_message_response_success_send(req, &resp_data, sizeof(resp_data), cport);
 }
 
-static void gb_gpio_direction_in(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_gpio_direction_in(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	uint8_t ret;
 	const struct gb_gpio_direction_in_request *request =
 		(const struct gb_gpio_direction_in_request *)req->payload;
 
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
 	ret = gb_errno_to_op_result(
-		gpio_pin_configure(dev, (gpio_pin_t)request->which, GPIO_INPUT));
+		gpio_pin_configure(data->dev, (gpio_pin_t)request->which, GPIO_INPUT));
 	return gb_transport_message_empty_response_send(req, ret, cport);
 }
 
-static void gb_gpio_direction_out(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_gpio_direction_out(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	int ret;
 	const struct gb_gpio_direction_out_request *request =
 		(const struct gb_gpio_direction_out_request *)req->payload;
 
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
-	ret = gpio_pin_configure(dev, request->which, GPIO_OUTPUT);
+	ret = gpio_pin_configure(data->dev, request->which, GPIO_OUTPUT);
 	if (ret != 0) {
 		return gb_transport_message_empty_response_send(req, gb_errno_to_op_result(ret),
 								cport);
 	}
 
-	ret = gb_errno_to_op_result(gpio_pin_set(dev, request->which, request->value));
+	ret = gb_errno_to_op_result(gpio_pin_set(data->dev, request->which, request->value));
 	gb_transport_message_empty_response_send(req, ret, cport);
 }
 
-static void gb_gpio_get_value(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_gpio_get_value(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	struct gb_gpio_get_value_response resp_data;
 	const struct gb_gpio_get_value_request *request =
 		(const struct gb_gpio_get_value_request *)req->payload;
 
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
-	resp_data.value = gpio_pin_get(dev, (gpio_pin_t)request->which);
+	resp_data.value = gpio_pin_get(data->dev, (gpio_pin_t)request->which);
 	gb_transport_message_response_success_send(req, &resp_data, sizeof(resp_data), cport);
 }
 
-static void gb_gpio_set_value(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_gpio_set_value(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	uint8_t ret;
 	const struct gb_gpio_set_value_request *request =
 		(const struct gb_gpio_set_value_request *)req->payload;
 
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
-	ret = gb_errno_to_op_result(gpio_pin_set(dev, request->which, request->value));
+	ret = gb_errno_to_op_result(gpio_pin_set(data->dev, request->which, request->value));
 	gb_transport_message_empty_response_send(req, ret, cport);
 }
 
-static void gb_gpio_set_debounce(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_gpio_set_debounce(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	uint8_t ret = GB_OP_SUCCESS;
 	gpio_flags_t flags = 0;
 	const struct gb_gpio_set_debounce_request *request =
@@ -174,63 +127,46 @@ static void gb_gpio_set_debounce(uint16_t cport, struct gb_message *req, const s
 	flags = CC13XX_CC26XX_GPIO_DEBOUNCE;
 #endif
 
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
 	if (sys_le16_to_cpu(request->usec) > 0) {
 		ret = gb_errno_to_op_result(
-			gpio_pin_configure(dev, (gpio_pin_t)request->which, flags));
+			gpio_pin_configure(data->dev, (gpio_pin_t)request->which, flags));
 	}
 
 	gb_transport_message_empty_response_send(req, ret, cport);
 }
 
-static void gb_gpio_irq_mask(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_gpio_irq_mask(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	uint8_t ret;
 	const struct gb_gpio_irq_mask_request *request =
 		(const struct gb_gpio_irq_mask_request *)req->payload;
 
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
 	ret = gb_errno_to_op_result(
-		gpio_pin_interrupt_configure(dev, request->which, GPIO_INT_DISABLE));
+		gpio_pin_interrupt_configure(data->dev, request->which, GPIO_INT_DISABLE));
 	gb_transport_message_empty_response_send(req, ret, cport);
 }
 
-static void gb_gpio_irq_unmask(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_gpio_irq_unmask(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	uint8_t ret;
 	const struct gb_gpio_irq_unmask_request *request =
 		(const struct gb_gpio_irq_unmask_request *)req->payload;
 
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
 	ret = gb_errno_to_op_result(gpio_pin_interrupt_configure(
-		dev, request->which, GPIO_INT_ENABLE | GPIO_INT_EDGE_RISING));
+		data->dev, request->which, GPIO_INT_ENABLE | GPIO_INT_EDGE_RISING));
 	gb_transport_message_empty_response_send(req, ret, cport);
 }
 
-static void gb_gpio_irq_type(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_gpio_irq_type(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_gpio_driver_data *data = priv;
 	uint8_t ret;
 	gpio_flags_t flags;
 	const struct gb_gpio_irq_type_request *request =
 		(const struct gb_gpio_irq_type_request *)req->payload;
 
-	if (gb_message_payload_len(req) < sizeof(*request)) {
-		LOG_ERR("dropping short message");
-		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
-	}
-
 	switch (request->type) {
 	case GB_GPIO_IRQ_TYPE_NONE:
 		flags = GPIO_INT_DISABLE;
@@ -254,46 +190,11 @@ static void gb_gpio_irq_type(uint16_t cport, struct gb_message *req, const struc
 		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
 	}
 
-	ret = gb_errno_to_op_result(gpio_pin_interrupt_configure(dev, request->which, flags));
+	ret = gb_errno_to_op_result(gpio_pin_interrupt_configure(data->dev, request->which, flags));
 
 	gb_transport_message_empty_response_send(req, ret, cport);
 }
 
-static void gb_gpio_handler(const void *priv, struct gb_message *msg, uint16_t cport)
-{
-	const struct gb_gpio_driver_data *data = priv;
-
-	switch (gb_message_type(msg)) {
-	case GB_GPIO_TYPE_LINE_COUNT:
-		return gb_gpio_line_count(cport, msg, data);
-	case GB_GPIO_TYPE_ACTIVATE:
-		return gb_gpio_activate(cport, msg, data->dev);
-	case GB_GPIO_TYPE_DEACTIVATE:
-		return gb_gpio_deactivate(cport, msg, data->dev);
-	case GB_GPIO_TYPE_GET_DIRECTION:
-		return gb_gpio_get_direction(cport, msg, data->dev);
-	case GB_GPIO_TYPE_DIRECTION_IN:
-		return gb_gpio_direction_in(cport, msg, data->dev);
-	case GB_GPIO_TYPE_DIRECTION_OUT:
-		return gb_gpio_direction_out(cport, msg, data->dev);
-	case GB_GPIO_TYPE_GET_VALUE:
-		return gb_gpio_get_value(cport, msg, data->dev);
-	case GB_GPIO_TYPE_SET_VALUE:
-		return gb_gpio_set_value(cport, msg, data->dev);
-	case GB_GPIO_TYPE_SET_DEBOUNCE:
-		return gb_gpio_set_debounce(cport, msg, data->dev);
-	case GB_GPIO_TYPE_IRQ_TYPE:
-		return gb_gpio_irq_type(cport, msg, data->dev);
-	case GB_GPIO_TYPE_IRQ_MASK:
-		return gb_gpio_irq_mask(cport, msg, data->dev);
-	case GB_GPIO_TYPE_IRQ_UNMASK:
-		return gb_gpio_irq_unmask(cport, msg, data->dev);
-	default:
-		LOG_ERR("Invalid type");
-		gb_transport_message_empty_response_send(msg, GB_OP_INVALID, cport);
-	}
-}
-
 struct gpio_irq_event_request_msg {
 	struct gb_operation_msg_hdr hdr;
 	struct gb_gpio_irq_event_request body;
@@ -308,6 +209,11 @@ static void gpio_callback_handler(const struct device *port, struct gpio_callbac
 	uint8_t buf[sizeof(struct gpio_irq_event_request_msg)] = {0};
 	struct gpio_irq_event_request_msg *msg = (struct gpio_irq_event_request_msg *)buf;
 
+	/* Nobody is listening for events yet */
+	if (!gb_cport_events_wanted(data->cport)) {
+		return;
+	}
+
 	msg->hdr.size = sys_cpu_to_le16(sizeof(buf));
 	msg->hdr.type = GB_GPIO_TYPE_IRQ_EVENT;
 
@@ -348,8 +254,41 @@ static void gb_gpio_exit(const void *priv)
 	gpio_remove_callback(data->dev, &data->cb);
 }
 
+/*
+ * Operations that only touch the pin registers are inline. They sleep on controllers behind a slow
+ * bus, CONFIG_GREYBUS_INLINE_DISPATCH is only enabled without those.
+ */
+static const struct gb_operation_handler gb_gpio_handlers[] = {
+	GB_HANDLER(GB_GPIO_TYPE_LINE_COUNT, gb_gpio_line_count, 0, GB_HANDLER_F_INLINE),
+	/* No "activation" in Zephyr. Maybe power mgmt in the future */
+	GB_HANDLER(GB_GPIO_TYPE_ACTIVATE, gb_handler_success,
+		   sizeof(struct gb_gpio_activate_request), GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_GPIO_TYPE_DEACTIVATE, gb_handler_success,
+		   sizeof(struct gb_gpio_deactivate_request), GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_GPIO_TYPE_GET_DIRECTION, gb_gpio_get_direction,
+		   sizeof(struct gb_gpio_get_direction_request), GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_GPIO_TYPE_DIRECTION_IN, gb_gpio_direction_in,
+		   sizeof(struct gb_gpio_direction_in_request), 0),
+	GB_HANDLER(GB_GPIO_TYPE_DIRECTION_OUT, gb_gpio_direction_out,
+		   sizeof(struct gb_gpio_direction_out_request), 0),
+	GB_HANDLER(GB_GPIO_TYPE_GET_VALUE, gb_gpio_get_value,
+		   sizeof(struct gb_gpio_get_value_request), GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_GPIO_TYPE_SET_VALUE, gb_gpio_set_value,
+		   sizeof(struct gb_gpio_set_value_request), GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_GPIO_TYPE_SET_DEBOUNCE, gb_gpio_set_debounce,
+		   sizeof(struct gb_gpio_set_debounce_request), 0),
+	GB_HANDLER(GB_GPIO_TYPE_IRQ_TYPE, gb_gpio_irq_type, sizeof(struct gb_gpio_irq_type_request),
+		   0),
+	GB_HANDLER(GB_GPIO_TYPE_IRQ_MASK, gb_gpio_irq_mask, sizeof(struct gb_gpio_irq_mask_request),
+		   0),
+	GB_HANDLER(GB_GPIO_TYPE_IRQ_UNMASK, gb_gpio_irq_unmask,
+		   sizeof(struct gb_gpio_irq_unmask_request), 0),
+};
+
 struct gb_driver gb_gpio_driver = {
 	.init = gb_gpio_init,
 	.exit = gb_gpio_exit,
-	.op_handler = gb_gpio_handler,
+	GB_DRIVER_HANDLERS(gb_gpio_handlers),
+	/* Register accesses only, anything longer is a stuck controller */
+	.op_budget_ms = 5,
 };
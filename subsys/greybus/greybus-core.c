@@ -33,18 +33,81 @@
 #include <zephyr/logging/log.h>
 #include "greybus_cport.h"
 #include "greybus_transport.h"
+#include "greybus_operation.h"
 #include <greybus-utils/manifest.h>
 #include "greybus_internal.h"
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG
+#include "greybus_watchdog.h"
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG
+#ifdef CONFIG_GREYBUS_BRIDGE
+#include "greybus_bridge.h"
+#endif // CONFIG_GREYBUS_BRIDGE
+#ifdef CONFIG_GREYBUS_HOST
+#include "greybus_host_internal.h"
+#endif // CONFIG_GREYBUS_HOST
+#ifdef CONFIG_GREYBUS_INTERFACES
+#include "greybus_interface.h"
+#endif // CONFIG_GREYBUS_INTERFACES
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+#include "greybus_quota.h"
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
 
 LOG_MODULE_REGISTER(greybus, CONFIG_GREYBUS_LOG_LEVEL);
 
 #define GB_PING_TYPE 0x00
 
-/* 2 msg per cport seems to be a good number */
-K_MSGQ_DEFINE(gb_rx_msgq, sizeof(struct gb_msg_with_cport), GREYBUS_CPORT_COUNT * 2, 1);
+/* States of a deferred operation */
+enum {
+	/* No deferred operation */
+	GB_OP_STATE_IDLE = 0,
+	/* Deferred by its handler, which has not returned to the core yet */
+	GB_OP_STATE_DEFERRED,
+	/* Deferred, and the CPort is waiting for completion without a worker */
+	GB_OP_STATE_PARKED,
+	/* Completed before the core saw that it was deferred */
+	GB_OP_STATE_DONE,
+};
 
-K_THREAD_STACK_DEFINE(gb_rx_thread_stack, 1280);
-static struct k_thread gb_rx_thread;
+#ifdef CONFIG_GREYBUS_CPU_AFFINITY
+#define GB_RX_PARTITIONS CONFIG_GREYBUS_RX_CPUS
+#else
+#define GB_RX_PARTITIONS 1
+#endif // CONFIG_GREYBUS_CPU_AFFINITY
+
+/* Every CPU needs a worker */
+BUILD_ASSERT(GB_RX_PARTITIONS <= CONFIG_GREYBUS_RX_WORKERS);
+#ifdef CONFIG_GREYBUS_CPU_AFFINITY
+BUILD_ASSERT(CONFIG_GREYBUS_CPU_FIRST + CONFIG_GREYBUS_RX_CPUS <= CONFIG_MP_MAX_NUM_CPUS);
+#endif // CONFIG_GREYBUS_CPU_AFFINITY
+
+/* CPorts dispatched by the workers of a partition */
+#define GB_RX_PARTITION_CPORTS DIV_ROUND_UP(GREYBUS_CPORT_COUNT, GB_RX_PARTITIONS)
+
+/*
+ * CPorts with pending messages, one queue per scheduling class. A CPort is present at most once, so
+ * the queues can never overflow. Messages themselves are queued on the CPort to keep per-CPort
+ * ordering.
+ *
+ * With CONFIG_GREYBUS_CPU_AFFINITY, CPorts are partitioned across CPUs and every CPU has its own
+ * ready queues, only used by the workers pinned to it.
+ */
+struct gb_rx_partition {
+	struct k_msgq ready_msgqs[CONFIG_GREYBUS_RX_PRIORITY_CLASSES];
+	uint16_t ready_bufs[CONFIG_GREYBUS_RX_PRIORITY_CLASSES][GB_RX_PARTITION_CPORTS];
+	/* Counts the CPorts in all ready queues */
+	struct k_sem ready_sem;
+};
+
+static struct gb_rx_partition gb_rx_partitions[GB_RX_PARTITIONS];
+
+K_THREAD_STACK_ARRAY_DEFINE(gb_rx_thread_stacks, CONFIG_GREYBUS_RX_WORKERS,
+			    CONFIG_GREYBUS_RX_WORKER_STACK_SIZE);
+static struct k_thread gb_rx_threads[CONFIG_GREYBUS_RX_WORKERS];
+/* Asks the dispatch workers to exit */
+static atomic_t gb_rx_stopping;
+
+/* Time a worker gets to finish its current operation before it is aborted */
+#define GB_RX_WORKER_STOP_TIMEOUT K_MSEC(CONFIG_GREYBUS_OPERATION_TIMEOUT_MS)
 
 uint8_t gb_errno_to_op_result(int err)
 {
@@ -97,64 +160,577 @@ uint8_t gb_errno_to_op_result(int err)
 	}
 }
 
+void gb_handler_success(const void *priv, struct gb_message *msg, uint16_t cport)
+{
+	ARG_UNUSED(priv);
+
+	gb_transport_message_empty_response_send(msg, GB_OP_SUCCESS, cport);
+}
+
+/* Ping is understood by every protocol */
+static const struct gb_operation_handler gb_ping_handler =
+	GB_HANDLER(GB_PING_TYPE, gb_handler_success, 0, GB_HANDLER_F_INLINE);
+
+static const struct gb_operation_handler *gb_handler_find(const struct gb_driver *drv,
+							  uint8_t type)
+{
+	size_t i;
+
+	if (type == GB_PING_TYPE) {
+		return &gb_ping_handler;
+	}
+
+	for (i = 0; i < drv->op_handlers_num; ++i) {
+		if (drv->op_handlers[i].type == type) {
+			return &drv->op_handlers[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Answer a request without executing it, on the transport it arrived on. Nothing is sent for
+ * unidirectional requests.
+ */
+static void gb_request_reject(struct gb_message *msg, const struct gb_operation_handler *handler,
+			      uint8_t status, uint16_t cport)
+{
+	const struct gb_message resp = {
+		.header =
+			{
+				.size = sys_cpu_to_le16(sizeof(struct gb_message)),
+				.operation_id = msg->header.operation_id,
+				.type = GB_RESPONSE(msg->header.type),
+				.result = status,
+			},
+	};
+
+	if (msg->header.operation_id != 0 &&
+	    !(handler && (handler->flags & GB_HANDLER_F_UNIDIRECTIONAL))) {
+		gb_transport_message_send_on(gb_message_rx_transport(msg), &resp, cport);
+	}
+
+	gb_message_dealloc(msg);
+}
+
+/*
+ * Check a request against the operation table of its driver.
+ *
+ * @return handler of the request, or NULL if the request was rejected.
+ */
+static const struct gb_operation_handler *gb_request_validate(const struct gb_driver *drv,
+							      struct gb_message *msg,
+							      uint16_t cport)
+{
+	const struct gb_operation_handler *handler = gb_handler_find(drv, gb_message_type(msg));
+
+	if (!handler) {
+		LOG_ERR("CPort %u: invalid type %u", cport, gb_message_type(msg));
+		gb_request_reject(msg, NULL, GB_OP_PROTOCOL_BAD, cport);
+		return NULL;
+	}
+
+	if (gb_message_payload_len(msg) < handler->min_payload_len) {
+		LOG_ERR("CPort %u: dropping short message of type %u", cport, gb_message_type(msg));
+		gb_request_reject(msg, handler, GB_OP_INVALID, cport);
+		return NULL;
+	}
+
+	return handler;
+}
+
 static void gb_process_msg(struct gb_message *msg, uint16_t cport)
 {
 	struct gb_cport *cport_ptr = gb_cport_get(cport);
+	const struct gb_operation_handler *handler;
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG
+	struct gb_op_watch watch;
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG
+
+	if (gb_message_is_response(msg)) {
+		return gb_operation_response_handle(msg, cport);
+	}
+
+	/* Validated before the message was queued */
+	handler = gb_handler_find(cport_ptr->driver, gb_message_type(msg));
+	cport_ptr->rx_transport = gb_message_rx_transport(msg);
+
+	/* Nothing to execute, the response is ready */
+	if (handler->flags & GB_HANDLER_F_STATIC) {
+		return gb_transport_message_response_success_send(msg, handler->resp,
+								  handler->resp_len, cport);
+	}
+
+	/*
+	 * Counted before the state is checked: either gb_cport_handlers_wait sees the handler, or
+	 * the handler sees the CPort disconnected.
+	 */
+	atomic_inc(&cport_ptr->handlers);
+	if (atomic_get(&cport_ptr->state) == GB_CPORT_STATE_DISCONNECTED) {
+		atomic_dec(&cport_ptr->handlers);
+		LOG_WRN("CPort %u disconnected, dropping operation %u", cport,
+			msg->header.operation_id);
+		gb_message_dealloc(msg);
+		return;
+	}
+
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG
+	gb_op_watch_start(&watch, cport_ptr->driver, handler, msg, cport);
+	handler->handler(cport_ptr->priv, msg, cport);
+	gb_op_watch_stop(&watch);
+#else
+	handler->handler(cport_ptr->priv, msg, cport);
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG
+
+	atomic_dec(&cport_ptr->handlers);
+}
+
+/*
+ * Queue a received message on its CPort. The receive threads of all transports can queue on the
+ * control CPort at the same time, and on other CPorts while they change owner. This never blocks,
+ * so a CPort that is not keeping up cannot stall the others.
+ *
+ * @return true on success, false if the CPort queue is full, or its interface over its heap
+ *         budget.
+ */
+static bool gb_cport_rx_put(struct gb_cport *cport_ptr, uint16_t cport, struct gb_message *msg)
+{
+	bool ret;
+#ifdef CONFIG_GREYBUS_RX_LOCKLESS
+	k_spinlock_key_t key;
+#endif // CONFIG_GREYBUS_RX_LOCKLESS
+#ifdef CONFIG_GREYBUS_INTERFACES
+	/* The message belongs to the worker once queued */
+	const bool request = !gb_message_is_response(msg);
+
+	/* An interface over its heap budget must not starve the others */
+	if (request && !gb_interface_charge(cport, msg)) {
+		return false;
+	}
+#endif // CONFIG_GREYBUS_INTERFACES
+
+#ifdef CONFIG_GREYBUS_RX_LOCKLESS
+	/* Only producers take the lock, the worker consumes without it */
+	key = k_spin_lock(&cport_ptr->rx_put_lock);
+	ret = gb_rx_ring_put(&cport_ptr->rx_ring, msg);
+	k_spin_unlock(&cport_ptr->rx_put_lock, key);
+#else
+	ret = k_msgq_put(&cport_ptr->rx_msgq, &msg, K_NO_WAIT) == 0;
+#endif // CONFIG_GREYBUS_RX_LOCKLESS
 
-	if (gb_message_type(msg) == GB_PING_TYPE) {
-		return gb_transport_message_empty_response_send(msg, GB_OP_SUCCESS, cport);
+#ifdef CONFIG_GREYBUS_INTERFACES
+	if (!ret && request) {
+		gb_interface_uncharge(cport, msg);
 	}
+#endif // CONFIG_GREYBUS_INTERFACES
 
-	cport_ptr->driver->op_handler(cport_ptr->priv, msg, cport);
+	return ret;
+}
+
+/*
+ * Take the oldest queued message of a CPort. Must only be called by the owner of the CPort.
+ */
+static struct gb_message *gb_cport_rx_get(struct gb_cport *cport_ptr)
+{
+#ifdef CONFIG_GREYBUS_RX_LOCKLESS
+	return gb_rx_ring_get(&cport_ptr->rx_ring);
+#else
+	struct gb_message *msg;
+
+	return (k_msgq_get(&cport_ptr->rx_msgq, &msg, K_NO_WAIT) == 0) ? msg : NULL;
+#endif // CONFIG_GREYBUS_RX_LOCKLESS
+}
+
+/*
+ * Free all queued messages of a CPort. Nobody must own the CPort.
+ */
+static void gb_cport_rx_flush(struct gb_cport *cport_ptr)
+{
+	struct gb_message *msg;
+
+	while ((msg = gb_cport_rx_get(cport_ptr)) != NULL) {
+		gb_message_dealloc(msg);
+	}
+}
+
+static size_t gb_cport_rx_pending(struct gb_cport *cport_ptr)
+{
+#ifdef CONFIG_GREYBUS_RX_LOCKLESS
+	return gb_rx_ring_used(&cport_ptr->rx_ring);
+#else
+	return k_msgq_num_used_get(&cport_ptr->rx_msgq);
+#endif // CONFIG_GREYBUS_RX_LOCKLESS
+}
+
+int gb_cport_credits(uint16_t cport)
+{
+	struct gb_cport *cport_ptr = gb_cport_get(cport);
+
+	if (!cport_ptr || !cport_ptr->driver) {
+		return -EINVAL;
+	}
+
+	return CONFIG_GREYBUS_CPORT_RX_QUEUE_DEPTH - gb_cport_rx_pending(cport_ptr);
+}
+
+static struct gb_rx_partition *gb_cport_partition(uint16_t cport)
+{
+	return &gb_rx_partitions[cport % GB_RX_PARTITIONS];
+}
+
+/*
+ * Queue a CPort for a worker. The caller must have set rx_scheduled.
+ */
+static void gb_cport_schedule(struct gb_cport *cport_ptr, uint16_t cport)
+{
+	struct gb_rx_partition *part = gb_cport_partition(cport);
+
+	k_msgq_put(&part->ready_msgqs[cport_ptr->rx_class], &cport, K_NO_WAIT);
+	k_sem_give(&part->ready_sem);
+}
+
+/*
+ * Wait for a CPort of a partition with pending messages, highest scheduling class first.
+ */
+static int gb_cport_next_scheduled(struct gb_rx_partition *part, uint16_t *cport)
+{
+	size_t i;
+
+	k_sem_take(&part->ready_sem, K_FOREVER);
+
+	for (i = 0; i < ARRAY_SIZE(part->ready_msgqs); ++i) {
+		if (k_msgq_get(&part->ready_msgqs[i], cport, K_NO_WAIT) == 0) {
+			return 0;
+		}
+	}
+
+	return -EAGAIN;
+}
+
+/*
+ * Give up ownership of a CPort. If messages were queued in the meantime, hand it to a worker.
+ */
+static void gb_cport_release(struct gb_cport *cport_ptr, uint16_t cport)
+{
+	atomic_clear(&cport_ptr->rx_scheduled);
+
+	if (gb_cport_rx_pending(cport_ptr) && atomic_cas(&cport_ptr->rx_scheduled, 0, 1)) {
+		gb_cport_schedule(cport_ptr, cport);
+	}
+}
+
+/*
+ * Check if the last processed operation was deferred by its handler. If it was, the CPort stays
+ * owned and the caller must stop executing its messages. gb_operation_complete continues later.
+ *
+ * @return true if the CPort is waiting for a deferred operation.
+ */
+static bool gb_cport_park(struct gb_cport *cport_ptr)
+{
+	if (atomic_cas(&cport_ptr->op.state, GB_OP_STATE_DEFERRED, GB_OP_STATE_PARKED)) {
+		return true;
+	}
+
+	/* Nothing deferred, or already completed */
+	atomic_set(&cport_ptr->op.state, GB_OP_STATE_IDLE);
+
+	return false;
+}
+
+struct gb_operation *gb_operation_defer(struct gb_message *req, uint16_t cport)
+{
+	struct gb_cport *cport_ptr = gb_cport_get(cport);
+
+	cport_ptr->op.req = req;
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG
+	/* The budget starts over, the handler returns right after deferring */
+	gb_op_watch_start(&cport_ptr->op.watch, cport_ptr->driver,
+			  gb_handler_find(cport_ptr->driver, gb_message_type(req)), req, cport);
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG
+	atomic_set(&cport_ptr->op.state, GB_OP_STATE_DEFERRED);
+
+	return &cport_ptr->op;
+}
+
+void gb_operation_complete(struct gb_operation *op, uint8_t status, const void *payload,
+			   size_t payload_len)
+{
+	struct gb_message *resp;
+	struct gb_message *req = op->req;
+	uint16_t cport = op->cport;
+
+	op->req = NULL;
+
+	if (req->header.operation_id == 0) {
+		gb_message_dealloc(req);
+	} else if (payload_len == 0) {
+		gb_transport_message_empty_response_send(req, status, cport);
+	} else {
+		resp = gb_message_response_alloc_from_req(payload, payload_len, req, status);
+		if (resp) {
+			gb_transport_message_send(resp, cport);
+			gb_message_dealloc(resp);
+			gb_message_dealloc(req);
+		} else {
+			gb_transport_message_empty_response_send(req, GB_OP_NO_MEMORY, cport);
+		}
+	}
+
+	/* Not part of a dispatch batch */
+	gb_transport_flush();
+
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG
+	/* After the response, which is dropped if the watchdog already answered the request */
+	gb_op_watch_stop(&op->watch);
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG
+
+	/* The worker did not give up the CPort yet, it will continue by itself */
+	if (atomic_cas(&op->state, GB_OP_STATE_DEFERRED, GB_OP_STATE_DONE)) {
+		return;
+	}
+
+	atomic_set(&op->state, GB_OP_STATE_IDLE);
+	gb_cport_release(gb_cport_get(cport), cport);
+}
+
+/*
+ * Execute a non-blocking message on the calling thread. This is only possible if no worker owns the
+ * CPort and nothing is queued ahead of the message.
+ *
+ * @return true if the message was processed.
+ */
+static bool gb_process_msg_inline(struct gb_cport *cport_ptr, uint16_t cport,
+				  struct gb_message *msg)
+{
+	bool processed = false;
+
+	if (!atomic_cas(&cport_ptr->rx_scheduled, 0, 1)) {
+		return false;
+	}
+
+	if (gb_cport_rx_pending(cport_ptr) == 0) {
+		gb_process_msg(msg, cport);
+		if (gb_cport_park(cport_ptr)) {
+			return true;
+		}
+		processed = true;
+	}
+
+	gb_cport_release(cport_ptr, cport);
+
+	return processed;
+}
+
+/*
+ * Execute up to CONFIG_GREYBUS_RX_BATCH_SIZE pending messages of a CPort. Only the worker that
+ * scheduled the CPort can be here, so messages of a CPort are never processed concurrently.
+ *
+ * Responses of the batch are staged by the transport and sent together when the batch ends.
+ */
+static void gb_cport_drain(struct gb_cport *cport_ptr, uint16_t cport)
+{
+	struct gb_message *msg;
+	size_t batch = 0;
+
+	do {
+		/* Drain what is pending in one go, without going back to the ready queue */
+		while ((msg = gb_cport_rx_get(cport_ptr)) != NULL) {
+			LOG_DBG("CPort: %d, Type: %d, Result: %d, Id: %u", cport,
+				gb_message_type(msg), msg->header.result,
+				msg->header.operation_id);
+#ifdef CONFIG_GREYBUS_INTERFACES
+			if (!gb_message_is_response(msg)) {
+				gb_interface_uncharge(cport, msg);
+			}
+#endif // CONFIG_GREYBUS_INTERFACES
+
+			gb_process_msg(msg, cport);
+			if (gb_cport_park(cport_ptr)) {
+				gb_transport_flush();
+				return;
+			}
+
+			/* Give the other CPorts a turn, the CPort stays owned by the ready queue */
+			if (++batch >= CONFIG_GREYBUS_RX_BATCH_SIZE &&
+			    gb_cport_rx_pending(cport_ptr)) {
+				gb_transport_flush();
+				gb_cport_schedule(cport_ptr, cport);
+				return;
+			}
+		}
+
+		atomic_clear(&cport_ptr->rx_scheduled);
+		/* A message might have been queued between the last get and the clear */
+	} while (gb_cport_rx_pending(cport_ptr) && atomic_cas(&cport_ptr->rx_scheduled, 0, 1));
+
+	gb_transport_flush();
 }
 
 static void gb_pending_message_worker(void *p1, void *p2, void *p3)
 {
-	ARG_UNUSED(p1);
 	ARG_UNUSED(p2);
 	ARG_UNUSED(p3);
 
-	int ret;
-	struct gb_msg_with_cport msg;
+	int ret, prio;
+	uint16_t cport;
+	struct gb_cport *cport_ptr;
+	struct gb_rx_partition *part = p1;
 
-	while (1) {
-		ret = k_msgq_get(&gb_rx_msgq, &msg, K_FOREVER);
+	while (!atomic_get(&gb_rx_stopping)) {
+		ret = gb_cport_next_scheduled(part, &cport);
 		if (ret < 0) {
 			continue;
 		}
 
-		LOG_DBG("CPort: %d, Type: %d, Result: %d, Id: %u", msg.cport,
-			gb_message_type(msg.msg), msg.msg->header.result,
-			msg.msg->header.operation_id);
+		cport_ptr = gb_cport_get(cport);
 
-		gb_process_msg(msg.msg, msg.cport);
+		/* Run at the priority of the class, higher classes preempt bulk transfers */
+		prio = CONFIG_GREYBUS_RX_WORKER_PRIORITY + cport_ptr->rx_class;
+		if (CONFIG_GREYBUS_RX_PRIORITY_CLASSES > 1 &&
+		    k_thread_priority_get(k_current_get()) != prio) {
+			k_thread_priority_set(k_current_get(), prio);
+		}
+
+		gb_cport_drain(cport_ptr, cport);
 	}
 }
 
-int greybus_rx_handler(uint16_t cport, struct gb_message *msg)
+int greybus_rx_handler_from(const struct gb_transport_backend *transport, uint16_t cport,
+			    struct gb_message *msg)
 {
-	struct gb_driver *drv;
-	const struct gb_msg_with_cport item = {
-		.cport = cport,
-		.msg = msg,
-	};
+	struct gb_cport *cport_ptr = gb_cport_get(cport);
+	const struct gb_operation_handler *handler = NULL;
+	int transport_id = gb_transport_id(transport);
+#ifdef CONFIG_GREYBUS_INTERFACES
+	int ret;
+#endif // CONFIG_GREYBUS_INTERFACES
 
-	drv = gb_cport_get(cport)->driver;
-	if (!drv || !drv->op_handler) {
+	if (transport_id < 0) {
+		LOG_ERR("Message from a transport greybus does not run on");
+		gb_message_dealloc(msg);
+		return 0;
+	}
+
+#ifdef CONFIG_GREYBUS_HOST
+	/* Traffic of a remote module this node is the AP of */
+	if (gb_host_rx(transport, cport, msg)) {
+		return 0;
+	}
+#endif // CONFIG_GREYBUS_HOST
+
+#ifdef CONFIG_GREYBUS_BRIDGE
+	/* Traffic of downstream nodes only passes through */
+	if (gb_bridge_forward(transport, cport, msg)) {
+		return 0;
+	}
+#endif // CONFIG_GREYBUS_BRIDGE
+
+#ifdef CONFIG_GREYBUS_INTERFACES
+	/* The AP of an interface numbers CPorts its own way */
+	ret = gb_interface_rx(transport, &cport, &msg);
+	if (ret < 0) {
+		LOG_WRN("CPort %u of transport %d: dropping message, error %d", cport, transport_id,
+			ret);
+		gb_message_dealloc(msg);
+		return 0;
+	}
+	cport_ptr = gb_cport_get(cport);
+#endif // CONFIG_GREYBUS_INTERFACES
+
+	if (!cport_ptr || !cport_ptr->driver) {
 		LOG_ERR("Cport %u does not have a valid driver registered", cport);
 		gb_message_dealloc(msg);
 		return 0;
 	}
 	// LOG_HEXDUMP_DBG(data, size, "RX: ");
 
-	k_msgq_put(&gb_rx_msgq, &item, K_FOREVER);
+	/* Nobody can answer or process traffic of a CPort that is not connected */
+	if (!gb_cport_msg_allowed(cport_ptr, msg)) {
+		LOG_WRN("CPort %u not connected, dropping message of type %u", cport,
+			gb_message_type(msg));
+		gb_message_dealloc(msg);
+		return 0;
+	}
+
+	/* Every AP can use the control CPort, other CPorts belong to the AP that connected them */
+	if (cport != GB_CONTROL_CPORT_ID && cport_ptr->transport != transport_id) {
+		LOG_WRN("CPort %u not connected on transport %d, dropping message of type %u",
+			cport, transport_id, gb_message_type(msg));
+		gb_message_dealloc(msg);
+		return 0;
+	}
+
+	gb_message_rx_transport_set(msg, transport_id);
+
+	/* Reject malformed requests before they take a queue slot */
+	if (!gb_message_is_response(msg)) {
+		handler = gb_request_validate(cport_ptr->driver, msg, cport);
+		if (!handler) {
+			return 0;
+		}
+	}
+
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+	/* Fail fast, waiting for the heap could block the control CPort behind this one */
+	if (handler && gb_message_charge(msg, cport) < 0) {
+		LOG_WRN("CPort %u over quota, rejecting operation %u", cport,
+			msg->header.operation_id);
+		gb_request_reject(msg, handler, GB_OP_NO_MEMORY, cport);
+		return 0;
+	}
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
+
+	if (IS_ENABLED(CONFIG_GREYBUS_INLINE_DISPATCH) && handler &&
+	    (handler->flags & GB_HANDLER_F_INLINE) &&
+	    gb_process_msg_inline(cport_ptr, cport, msg)) {
+		return 0;
+	}
+
+	if (!gb_cport_rx_put(cport_ptr, cport, msg)) {
+		if (!handler) {
+			LOG_WRN("CPort %u queue full, dropping response", cport);
+			gb_message_dealloc(msg);
+			return 0;
+		}
+
+		LOG_WRN("CPort %u queue full, rejecting operation %u", cport,
+			msg->header.operation_id);
+		gb_request_reject(msg, handler, GB_OP_RETRY, cport);
+		return 0;
+	}
+
+	/* Hand the CPort to a worker unless one already owns it */
+	if (atomic_cas(&cport_ptr->rx_scheduled, 0, 1)) {
+		gb_cport_schedule(cport_ptr, cport);
+	}
 
 	return 0;
 }
 
+int greybus_rx_handler(uint16_t cport, struct gb_message *msg)
+{
+	return greybus_rx_handler_from(gb_transport_get(0), cport, msg);
+}
+
+/*
+ * CPort the AP behind a transport knows a CPort of the node as.
+ */
+static int gb_transport_cport(const struct gb_transport_backend *transport, uint16_t cport)
+{
+#ifdef CONFIG_GREYBUS_INTERFACES
+	return gb_interface_cport(transport, cport);
+#else
+	ARG_UNUSED(transport);
+
+	return cport;
+#endif // CONFIG_GREYBUS_INTERFACES
+}
+
 int gb_listen(uint16_t cport)
 {
-	const struct gb_transport_backend *transport = gb_transport_get_backend();
+	int ret;
+	const struct gb_transport_backend *transport;
 	struct gb_cport *cport_ptr = gb_cport_get(cport);
 
 	if (!cport_ptr) {
@@ -167,12 +743,23 @@ int gb_listen(uint16_t cport)
 		return -EINVAL;
 	}
 
-	return transport->listen(cport);
+	transport = gb_transport_get(cport_ptr->transport);
+	if (!transport) {
+		return -ENODEV;
+	}
+
+	ret = gb_transport_cport(transport, cport);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return transport->listen(ret);
 }
 
 int gb_stop_listening(uint16_t cport)
 {
-	const struct gb_transport_backend *transport = gb_transport_get_backend();
+	int ret;
+	const struct gb_transport_backend *transport;
 	struct gb_cport *cport_ptr = gb_cport_get(cport);
 
 	if (!cport_ptr) {
@@ -185,46 +772,221 @@ int gb_stop_listening(uint16_t cport)
 		return -EINVAL;
 	}
 
-	return transport->stop_listening(cport);
+	transport = gb_transport_get(cport_ptr->transport);
+	if (!transport || !transport->stop_listening) {
+		return 0;
+	}
+
+	ret = gb_transport_cport(transport, cport);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return transport->stop_listening(ret);
 }
 
-int gb_init(const struct gb_transport_backend *transport)
+/*
+ * Stop the dispatch workers. Workers finish the messages of the CPort they own, unless that takes
+ * longer than GB_RX_WORKER_STOP_TIMEOUT.
+ */
+static void gb_rx_workers_stop(void)
+{
+	size_t i;
+
+	atomic_set(&gb_rx_stopping, 1);
+
+	/* Wake up idle workers */
+	for (i = 0; i < ARRAY_SIZE(gb_rx_threads); ++i) {
+		k_sem_give(&gb_rx_partitions[i % GB_RX_PARTITIONS].ready_sem);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(gb_rx_threads); ++i) {
+		if (k_thread_join(&gb_rx_threads[i], GB_RX_WORKER_STOP_TIMEOUT) < 0) {
+			LOG_WRN("Dispatch worker %zu is stuck, aborting it", i);
+			k_thread_abort(&gb_rx_threads[i]);
+		}
+	}
+}
+
+int gb_cport_handlers_wait(uint16_t cport)
 {
+	struct gb_cport *cport_ptr = gb_cport_get(cport);
+	k_timepoint_t end = sys_timepoint_calc(GB_RX_WORKER_STOP_TIMEOUT);
+
+	/* A deferred request still belongs to the driver */
+	while (atomic_get(&cport_ptr->handlers) ||
+	       atomic_get(&cport_ptr->op.state) != GB_OP_STATE_IDLE) {
+		if (sys_timepoint_expired(end)) {
+			return -ETIMEDOUT;
+		}
+		k_sleep(K_MSEC(1));
+	}
+
+	return 0;
+}
+
+/*
+ * Wait for deferred operations to be completed by their drivers, which still own the request.
+ */
+static void gb_deferred_wait(k_timeout_t timeout)
+{
+	uint16_t i;
+	struct gb_cport *cport_ptr;
+	k_timepoint_t end = sys_timepoint_calc(timeout);
+
+	for (i = 0; i < GREYBUS_CPORT_COUNT; ++i) {
+		cport_ptr = gb_cport_get(i);
+
+		while (atomic_get(&cport_ptr->op.state) == GB_OP_STATE_PARKED) {
+			if (sys_timepoint_expired(end)) {
+				LOG_WRN("CPort %u: deferred operation did not complete", i);
+				break;
+			}
+			k_sleep(K_MSEC(1));
+		}
+	}
+}
+
+void gb_thread_start(k_tid_t thread, unsigned int partition)
+{
+#ifdef CONFIG_GREYBUS_CPU_AFFINITY
+	int ret = k_thread_cpu_pin(thread, CONFIG_GREYBUS_CPU_FIRST + partition);
+
+	if (ret < 0) {
+		LOG_WRN("Failed to pin thread to CPU %u: %d", CONFIG_GREYBUS_CPU_FIRST + partition,
+			ret);
+	}
+#else
+	ARG_UNUSED(partition);
+#endif // CONFIG_GREYBUS_CPU_AFFINITY
+
+	k_thread_start(thread);
+}
+
+int gb_init_transports(const struct gb_transport_backend *const *transports, size_t num)
+{
+	size_t i, j;
 	int ret;
+	struct gb_rx_partition *part;
 
-	if (!transport) {
+	if (num == 0 || num > CONFIG_GREYBUS_TRANSPORTS_MAX) {
 		return -EINVAL;
 	}
 
+	for (i = 0; i < num; ++i) {
+		if (!transports[i]) {
+			return -EINVAL;
+		}
+	}
+
+	if (gb_transport_get(0)) {
+		return -EALREADY;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(gb_rx_partitions); ++i) {
+		part = &gb_rx_partitions[i];
+
+		for (j = 0; j < ARRAY_SIZE(part->ready_msgqs); ++j) {
+			k_msgq_init(&part->ready_msgqs[j], (char *)part->ready_bufs[j],
+				    sizeof(uint16_t), ARRAY_SIZE(part->ready_bufs[j]));
+		}
+		k_sem_init(&part->ready_sem, 0, GB_RX_PARTITION_CPORTS);
+	}
+	atomic_clear(&gb_rx_stopping);
+	gb_operations_init();
+#ifdef CONFIG_GREYBUS_HOST
+	gb_host_operations_init();
+#endif // CONFIG_GREYBUS_HOST
+#ifdef CONFIG_GREYBUS_INTERFACES
+	gb_interfaces_init();
+#endif // CONFIG_GREYBUS_INTERFACES
+
 	ret = gb_cports_init();
 	if (ret < 0) {
 		return ret;
 	}
 
-	k_thread_create(&gb_rx_thread, gb_rx_thread_stack,
-			K_THREAD_STACK_SIZEOF(gb_rx_thread_stack), gb_pending_message_worker, NULL,
-			NULL, NULL, 5, 0, K_NO_WAIT);
+	/* Workers are spread over the partitions, every partition has at least one */
+	for (i = 0; i < ARRAY_SIZE(gb_rx_threads); ++i) {
+		k_thread_create(&gb_rx_threads[i], gb_rx_thread_stacks[i],
+				K_THREAD_STACK_SIZEOF(gb_rx_thread_stacks[i]),
+				gb_pending_message_worker, &gb_rx_partitions[i % GB_RX_PARTITIONS],
+				NULL, NULL, CONFIG_GREYBUS_RX_WORKER_PRIORITY, 0, K_FOREVER);
+		k_thread_name_set(&gb_rx_threads[i], "greybus_rx");
+		gb_thread_start(&gb_rx_threads[i], i % GB_RX_PARTITIONS);
+	}
 
-	transport->init();
+	ret = gb_transports_start(transports, num);
+	if (ret < 0) {
+		gb_rx_workers_stop();
+		gb_cports_deinit();
+		return ret;
+	}
 
 	return 0;
 }
 
+int gb_init(const struct gb_transport_backend *transport)
+{
+	return gb_init_transports(&transport, 1);
+}
+
 void gb_deinit(void)
 {
-	const struct gb_transport_backend *transport = gb_transport_get_backend();
+	uint16_t i;
 
-	if (!transport) {
+	if (!gb_transport_get(0)) {
 		return; /* gb not initialized */
 	}
 
-	k_thread_abort(&gb_rx_thread);
+	/* Let running operations finish and send their response before the transports go away */
+	gb_rx_workers_stop();
+	gb_deferred_wait(GB_RX_WORKER_STOP_TIMEOUT);
 
+	gb_transports_stop();
+
+	gb_operation_cancel_all();
+#ifdef CONFIG_GREYBUS_HOST
+	gb_host_cancel_all();
+#endif // CONFIG_GREYBUS_HOST
+	gb_disconnect_all(NULL);
 	gb_cports_deinit();
 
-	if (transport->exit) {
-		transport->exit();
+	/* Messages received but never dispatched */
+	for (i = 0; i < GREYBUS_CPORT_COUNT; ++i) {
+		gb_cport_rx_flush(gb_cport_get(i));
+	}
+}
+
+int gb_restart(void)
+{
+	int ret;
+	size_t num;
+	uint32_t start = k_cycle_get_32();
+	const struct gb_transport_backend *transports[CONFIG_GREYBUS_TRANSPORTS_MAX];
+
+	for (num = 0; num < ARRAY_SIZE(transports); ++num) {
+		transports[num] = gb_transport_get(num);
+		if (!transports[num]) {
+			break;
+		}
+	}
+
+	if (num == 0) {
+		return -EINVAL;
+	}
+
+	gb_deinit();
+
+	ret = gb_init_transports(transports, num);
+	if (ret < 0) {
+		LOG_ERR("Failed to restart greybus: %d", ret);
+		return ret;
 	}
+
+	LOG_INF("Greybus restarted in %u us", k_cyc_to_us_floor32(k_cycle_get_32() - start));
+
+	return 0;
 }
 
 int gb_notify(uint16_t cport, enum gb_event event)
@@ -258,3 +1020,32 @@ int gb_notify(uint16_t cport, enum gb_event event)
 
 	return 0;
 }
+
+void gb_disconnect_all(const struct gb_transport_backend *transport)
+{
+	uint16_t i;
+	struct gb_cport *cport_ptr;
+	int transport_id = gb_transport_id(transport);
+
+	for (i = 0; i < GREYBUS_CPORT_COUNT; ++i) {
+		cport_ptr = gb_cport_get(i);
+		if (i == GB_CONTROL_CPORT_ID ||
+		    atomic_get(&cport_ptr->state) == GB_CPORT_STATE_DISCONNECTED) {
+			continue;
+		}
+
+		if (transport && cport_ptr->transport != transport_id) {
+			continue;
+		}
+
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+		/* Keep events for AP until it connects the CPort again */
+		if (atomic_get(&cport_ptr->state) == GB_CPORT_STATE_CONNECTED) {
+			gb_journal_arm(&cport_ptr->journal);
+		}
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+
+		gb_notify(i, GB_EVT_DISCONNECTED);
+		gb_cport_disconnect(i);
+	}
+}
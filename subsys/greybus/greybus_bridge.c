@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Aggregating bridge, in the spirit of APBridge. The upstream AP sees the CPorts of every
+ * downstream node in a window of CPort numbers above the CPorts of the bridge itself. Messages are
+ * forwarded as they were received, only the CPort they are sent on changes. The CPort ids in
+ * control requests for a node are rewritten, on a copy if the request is shared.
+ */
+
+#include <zephyr/logging/log.h>
+#include <greybus/greybus_protocols.h>
+#include <greybus-utils/manifest.h>
+#include "greybus_bridge.h"
+#include "greybus_transport.h"
+#include "greybus_internal.h"
+
+LOG_MODULE_REGISTER(greybus_bridge, CONFIG_GREYBUS_LOG_LEVEL);
+
+/* Only changed while greybus is stopped, so the receive threads can read it without locking */
+static const struct gb_transport_backend *gb_bridge_upstream;
+static const struct gb_bridge_link *gb_bridge_links;
+static size_t gb_bridge_links_num;
+
+static bool gb_bridge_links_overlap(const struct gb_bridge_link *a, const struct gb_bridge_link *b)
+{
+	return a->cport_base < b->cport_base + b->cport_count &&
+	       b->cport_base < a->cport_base + a->cport_count;
+}
+
+int gb_bridge_set(const struct gb_transport_backend *upstream, const struct gb_bridge_link *links,
+		  size_t num)
+{
+	size_t i, j;
+
+	if (gb_transport_get(0)) {
+		return -EBUSY;
+	}
+
+	if (!upstream && num) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num; ++i) {
+		if (!links[i].transport || links[i].transport == upstream ||
+		    links[i].cport_count == 0 || links[i].cport_base < GREYBUS_CPORT_COUNT ||
+		    links[i].cport_base + links[i].cport_count > UINT16_MAX) {
+			return -EINVAL;
+		}
+
+		for (j = 0; j < i; ++j) {
+			if (gb_bridge_links_overlap(&links[i], &links[j]) ||
+			    links[i].transport == links[j].transport) {
+				return -EINVAL;
+			}
+		}
+	}
+
+	gb_bridge_upstream = num ? upstream : NULL;
+	gb_bridge_links = links;
+	gb_bridge_links_num = num;
+
+	return 0;
+}
+
+static const struct gb_bridge_link *gb_bridge_link_by_cport(uint16_t cport)
+{
+	size_t i;
+
+	for (i = 0; i < gb_bridge_links_num; ++i) {
+		if (cport >= gb_bridge_links[i].cport_base &&
+		    cport < gb_bridge_links[i].cport_base + gb_bridge_links[i].cport_count) {
+			return &gb_bridge_links[i];
+		}
+	}
+
+	return NULL;
+}
+
+static const struct gb_bridge_link *
+gb_bridge_link_by_transport(const struct gb_transport_backend *transport)
+{
+	size_t i;
+
+	for (i = 0; i < gb_bridge_links_num; ++i) {
+		if (gb_bridge_links[i].transport == transport) {
+			return &gb_bridge_links[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Control requests for a node name CPorts the way the upstream AP sees them. The node knows them by
+ * their own number.
+ */
+static uint16_t gb_bridge_control_map(uint16_t cport_id, const void *user_data)
+{
+	const struct gb_bridge_link *link = user_data;
+
+	/* The node must not act on one of its own CPorts that happens to have this number */
+	if (cport_id < link->cport_base || cport_id >= link->cport_base + link->cport_count) {
+		LOG_WRN("Control request for CPort %u outside of the node window", cport_id);
+		return UINT16_MAX;
+	}
+
+	return cport_id - link->cport_base;
+}
+
+static void gb_bridge_send(const struct gb_transport_backend *transport, uint16_t cport,
+			   struct gb_message *msg)
+{
+	int ret = transport->send(cport, msg);
+
+	if (ret < 0) {
+		LOG_ERR("Failed to forward message to CPort %u: error %d", cport, ret);
+	}
+
+	gb_message_dealloc(msg);
+}
+
+bool gb_bridge_forward(const struct gb_transport_backend *transport, uint16_t cport,
+		       struct gb_message *msg)
+{
+	const struct gb_bridge_link *link;
+
+	if (!gb_bridge_upstream) {
+		return false;
+	}
+
+	/* Downstream */
+	if (transport == gb_bridge_upstream) {
+		link = gb_bridge_link_by_cport(cport);
+		if (!link) {
+			return false;
+		}
+
+		cport -= link->cport_base;
+		if (cport == GB_CONTROL_CPORT_ID) {
+			msg = gb_control_cport_remap(msg, gb_bridge_control_map, link);
+			if (!msg) {
+				LOG_ERR("Failed to copy control request for CPort %u", cport);
+				return true;
+			}
+		}
+
+		gb_bridge_send(link->transport, cport, msg);
+		return true;
+	}
+
+	/* Upstream */
+	link = gb_bridge_link_by_transport(transport);
+	if (!link) {
+		return false;
+	}
+
+	if (cport >= link->cport_count) {
+		LOG_WRN("Node CPort %u outside of its window, dropping message", cport);
+		gb_message_dealloc(msg);
+		return true;
+	}
+
+	gb_bridge_send(gb_bridge_upstream, link->cport_base + cport, msg);
+	return true;
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Forwarding of Greybus traffic between an upstream AP and downstream nodes.
+ */
+
+#ifndef _GREYBUS_BRIDGE_H_
+#define _GREYBUS_BRIDGE_H_
+
+#include <stdbool.h>
+#include <greybus/greybus.h>
+
+/*
+ * Forward a received message if it belongs to a downstream node: it arrived on the upstream
+ * transport for a CPort in the window of a link, or it arrived on the transport of a link.
+ *
+ * @return true if the bridge took ownership of the message, false if it is for the local node.
+ */
+bool gb_bridge_forward(const struct gb_transport_backend *transport, uint16_t cport,
+		       struct gb_message *msg);
+
+#endif // _GREYBUS_BRIDGE_H_
@@ -17,6 +17,7 @@
 #include "greybus_fw_mgmt.h"
 #include "greybus_log.h"
 #include "greybus_internal.h"
+#include "greybus_heap.h"
 
 LOG_MODULE_REGISTER(greybus_cport, CONFIG_GREYBUS_LOG_LEVEL);
 
@@ -96,16 +97,21 @@ DT_FOREACH_CHILD_STATUS_OKAY(_GREYBUS_BASE_NODE, GB_PRIV_DATA_HANDLER)
 
 #define GB_CPORT_SPI_PRIV_DATA(_node_id, _prop, _idx) &gb_spi_priv_data_##_idx
 
-#define GB_CPORT(_priv, _bundle, _protocol, _driver)                                               \
+#define GB_BUNDLE_RX_CLASS(_node_id)                                                               \
+	MIN(DT_PROP_OR(_node_id, priority, GB_RX_CLASS_LOWEST), GB_RX_CLASS_LOWEST)
+
+#define GB_CPORT(_priv, _bundle, _protocol, _driver, _class)                                       \
 	{                                                                                          \
 		.bundle = _bundle,                                                                 \
 		.protocol = _protocol,                                                             \
 		.priv = _priv,                                                                     \
 		.driver = _driver,                                                                 \
+		.rx_class = _class,                                                                \
 	}
 
 #define _GB_CPORT(_node_id, _prop, _idx, _bundle, _protocol, _driver, PRIV_FN)                     \
-	GB_CPORT(PRIV_FN(_node_id, _prop, _idx), _bundle, _protocol, _driver)
+	GB_CPORT(PRIV_FN(_node_id, _prop, _idx), _bundle, _protocol, _driver,                      \
+		 GB_BUNDLE_RX_CLASS(_node_id))
 
 #define GREYBUS_CPORTS_IN_BRIDGED_PHY_BUNDLE(_node_id, _bundle)                                    \
 	FOR_EACH_NONEMPTY_TERM(                                                                    \
@@ -134,8 +140,9 @@ DT_FOREACH_CHILD_STATUS_OKAY(_GREYBUS_BASE_NODE, GB_PRIV_DATA_HANDLER)
 						       &gb_i2c_driver, GB_CPORT_DEV_PRIV_DATA))))
 
 #define GREYBUS_CPORT_IN_LIGHTS(_node_id, _bundle)                                                 \
-	IF_ENABLED(CONFIG_GREYBUS_LIGHTS, (GB_CPORT(&gb_lights_priv_data, _bundle,                 \
-						    GREYBUS_PROTOCOL_LIGHTS, &gb_lights_driver)))
+	IF_ENABLED(CONFIG_GREYBUS_LIGHTS,                                                          \
+		   (GB_CPORT(&gb_lights_priv_data, _bundle, GREYBUS_PROTOCOL_LIGHTS,               \
+			     &gb_lights_driver, GB_BUNDLE_RX_CLASS(_node_id))))
 
 #define GB_CPORTS_IN_BUNDLE(node_id, bundle)                                                       \
 	COND_CODE_1(DT_NODE_HAS_COMPAT_STATUS(node_id, zephyr_greybus_bundle_bridged_phy, okay),   \
@@ -148,21 +155,23 @@ DT_FOREACH_CHILD_STATUS_OKAY(_GREYBUS_BASE_NODE, GB_PRIV_DATA_HANDLER)
 #define GB_CPORTS_BUNDLE_WRAPPER(node_id) GB_CPORTS_IN_BUNDLE(node_id, LOCAL_COUNTER)
 
 #define GB_CPORTS_FW(_bundle)                                                                      \
-	GB_CPORT(NULL, _bundle, GREYBUS_PROTOCOL_FIRMWARE_MANAGEMENT, &gb_fw_mgmt_driver),         \
+	GB_CPORT(NULL, _bundle, GREYBUS_PROTOCOL_FIRMWARE_MANAGEMENT, &gb_fw_mgmt_driver,          \
+		 GB_RX_CLASS_LOWEST),                                                              \
 		GB_CPORT(NULL, _bundle, GREYBUS_PROTOCOL_FIRMWARE_DOWNLOAD,                        \
-			 &gb_fw_download_driver)
+			 &gb_fw_download_driver, GB_RX_CLASS_LOWEST)
 
 static struct gb_cport cports[] = {
 	/* cport0 is always control cport */
-	GB_CPORT(NULL, LOCAL_COUNTER, GREYBUS_PROTOCOL_CONTROL, &gb_control_driver),
+	GB_CPORT(NULL, LOCAL_COUNTER, GREYBUS_PROTOCOL_CONTROL, &gb_control_driver, 0),
 #ifdef CONFIG_GREYBUS_FW
 	GB_CPORTS_FW(LOCAL_COUNTER),
 #endif // CONFIG_GREYBUS_FW
 #ifdef CONFIG_GREYBUS_LOG_BACKEND
-	GB_CPORT(NULL, LOCAL_COUNTER, GREYBUS_PROTOCOL_LOG, &gb_log_driver),
+	GB_CPORT(NULL, LOCAL_COUNTER, GREYBUS_PROTOCOL_LOG, &gb_log_driver, GB_RX_CLASS_LOWEST),
 #endif // CONFIG_GREYBUS_LOG
 #ifdef CONFIG_GREYBUS_LOOPBACK
-	GB_CPORT(NULL, LOCAL_COUNTER, GREYBUS_PROTOCOL_LOOPBACK, &gb_loopback_driver),
+	GB_CPORT(NULL, LOCAL_COUNTER, GREYBUS_PROTOCOL_LOOPBACK, &gb_loopback_driver,
+		 GB_RX_CLASS_LOWEST),
 #endif // CONFIG_GREYBUS_LOOPBACK
 	DT_FOREACH_CHILD_STATUS_OKAY(_GREYBUS_BASE_NODE, GB_CPORTS_BUNDLE_WRAPPER)};
 
@@ -173,24 +182,227 @@ struct gb_cport *gb_cport_get(uint16_t cport)
 	return (cport >= GREYBUS_CPORT_COUNT) ? NULL : &cports[cport];
 }
 
+static size_t gb_cport_heap_used(void)
+{
+#ifdef CONFIG_SYS_HEAP_RUNTIME_STATS
+	return gb_heap_used();
+#else
+	return 0;
+#endif // CONFIG_SYS_HEAP_RUNTIME_STATS
+}
+
+static int gb_cport_driver_init(struct gb_cport *cport_ptr, uint16_t cport)
+{
+	int ret;
+
+	if (cport_ptr->driver->init) {
+		ret = cport_ptr->driver->init(cport_ptr->priv, cport);
+		if (ret < 0) {
+			LOG_ERR("Failed to initialize cport %u", cport);
+			return ret;
+		}
+	}
+
+	cport_ptr->initialized = true;
+
+	return 0;
+}
+
+static void gb_cport_driver_exit(struct gb_cport *cport_ptr)
+{
+	if (!cport_ptr->initialized) {
+		return;
+	}
+
+	if (cport_ptr->driver->exit) {
+		cport_ptr->driver->exit(cport_ptr->priv);
+	}
+
+	cport_ptr->initialized = false;
+}
+
+/*
+ * With lazy initialization, drivers are initialized when AP connects their CPort. The control CPort
+ * is always connected, so it is initialized at boot.
+ */
+static bool gb_cport_init_on_connect(uint16_t cport)
+{
+	return IS_ENABLED(CONFIG_GREYBUS_CPORT_LAZY_INIT) && cport != GB_CONTROL_CPORT_ID;
+}
+
+int gb_cport_connect(uint16_t cport)
+{
+	struct gb_cport *cport_ptr = gb_cport_get(cport);
+	const uint8_t transport = cports[GB_CONTROL_CPORT_ID].rx_transport;
+	uint32_t start;
+	size_t heap_used;
+	int ret;
+
+	if (!cport_ptr || cport == GB_CONTROL_CPORT_ID) {
+		return -EINVAL;
+	}
+
+	/* Messages are dropped until the driver is ready for them */
+	if (!atomic_cas(&cport_ptr->state, GB_CPORT_STATE_DISCONNECTED,
+			GB_CPORT_STATE_CONNECTING)) {
+		if (atomic_get(&cport_ptr->state) != GB_CPORT_STATE_CONNECTED) {
+			return -EBUSY;
+		}
+
+		/* Only the AP that connected the CPort owns it */
+		return (cport_ptr->transport == transport) ? -EALREADY : -EPERM;
+	}
+
+	cport_ptr->transport = transport;
+
+	/* Still initialized if the events of the CPort were journaled */
+	if (gb_cport_init_on_connect(cport) && !cport_ptr->initialized) {
+		heap_used = gb_cport_heap_used();
+		start = k_cycle_get_32();
+
+		ret = gb_cport_driver_init(cport_ptr, cport);
+		if (ret < 0) {
+			atomic_set(&cport_ptr->state, GB_CPORT_STATE_DISCONNECTED);
+			return ret;
+		}
+
+		LOG_INF("CPort %u initialized in %u us, heap %zu -> %zu bytes", cport,
+			k_cyc_to_us_floor32(k_cycle_get_32() - start), heap_used,
+			gb_cport_heap_used());
+	}
+
+	atomic_set(&cport_ptr->state, GB_CPORT_STATE_CONNECTED);
+
+	return 0;
+}
+
+int gb_cport_disconnecting(uint16_t cport)
+{
+	struct gb_cport *cport_ptr = gb_cport_get(cport);
+
+	if (!cport_ptr || cport == GB_CONTROL_CPORT_ID) {
+		return -EINVAL;
+	}
+
+	if (!atomic_cas(&cport_ptr->state, GB_CPORT_STATE_CONNECTED,
+			GB_CPORT_STATE_DISCONNECTING)) {
+		return -ENOTCONN;
+	}
+
+	return 0;
+}
+
+int gb_cport_disconnect(uint16_t cport)
+{
+	struct gb_cport *cport_ptr = gb_cport_get(cport);
+
+	if (!cport_ptr || cport == GB_CONTROL_CPORT_ID) {
+		return -EINVAL;
+	}
+
+	atomic_set(&cport_ptr->state, GB_CPORT_STATE_DISCONNECTED);
+
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+	/* The driver keeps producing events for the journal */
+	if (gb_journal_armed(&cport_ptr->journal)) {
+		return 0;
+	}
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+
+	if (gb_cport_init_on_connect(cport)) {
+		/*
+		 * Other workers can still be executing operations of the CPort. A stuck one, e.g. a
+		 * bus transfer whose callback never fires, keeps the driver initialized, the next
+		 * connect uses it as is.
+		 */
+		if (gb_cport_handlers_wait(cport) < 0) {
+			LOG_ERR("CPort %u: operation still running, driver not exited", cport);
+			return 0;
+		}
+		gb_cport_driver_exit(cport_ptr);
+	}
+
+	return 0;
+}
+
+bool gb_cport_connected(uint16_t cport)
+{
+	const struct gb_cport *cport_ptr = gb_cport_get(cport);
+
+	return cport_ptr && atomic_get(&cport_ptr->state) == GB_CPORT_STATE_CONNECTED;
+}
+
+bool gb_cport_events_wanted(uint16_t cport)
+{
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+	const struct gb_cport *cport_ptr = gb_cport_get(cport);
+
+	if (cport_ptr && gb_journal_armed(&cport_ptr->journal)) {
+		return true;
+	}
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+
+	return gb_cport_connected(cport);
+}
+
+bool gb_cport_msg_allowed(const struct gb_cport *cport, const struct gb_message *msg)
+{
+	switch (atomic_get(&cport->state)) {
+	case GB_CPORT_STATE_CONNECTED:
+		return true;
+	case GB_CPORT_STATE_DISCONNECTING:
+		return gb_message_is_response(msg);
+	default:
+		return false;
+	}
+}
+
 int gb_cports_init()
 {
 	size_t i;
 	int ret;
-	const struct gb_cport *cport;
+	struct gb_cport *cport;
+	size_t heap_used = gb_cport_heap_used();
+	uint32_t start = k_cycle_get_32();
 
 	for (i = 0; i < ARRAY_SIZE(cports); ++i) {
 		cport = &cports[i];
 
-		if (cport->driver->init) {
-			ret = cport->driver->init(cport->priv, i);
-			if (ret < 0) {
-				LOG_ERR("Failed to initialize cport %u", i);
-				return ret;
-			}
+#ifdef CONFIG_GREYBUS_RX_LOCKLESS
+		gb_rx_ring_init(&cport->rx_ring);
+#else
+		k_msgq_init(&cport->rx_msgq, (char *)cport->rx_msgq_buf,
+			    sizeof(struct gb_message *), ARRAY_SIZE(cport->rx_msgq_buf));
+#endif // CONFIG_GREYBUS_RX_LOCKLESS
+		atomic_clear(&cport->rx_scheduled);
+		cport->op.req = NULL;
+		cport->op.cport = i;
+		atomic_clear(&cport->op.state);
+		atomic_clear(&cport->handlers);
+		/* The control CPort is always connected */
+		atomic_set(&cport->state, (i == GB_CONTROL_CPORT_ID)
+						  ? GB_CPORT_STATE_CONNECTED
+						  : GB_CPORT_STATE_DISCONNECTED);
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+		gb_journal_reset(&cport->journal);
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+		cport->initialized = false;
+		cport->transport = 0;
+		cport->rx_transport = 0;
+
+		if (gb_cport_init_on_connect(i)) {
+			continue;
+		}
+
+		ret = gb_cport_driver_init(cport, i);
+		if (ret < 0) {
+			return ret;
 		}
 	}
 
+	LOG_INF("CPort drivers initialized in %u us, heap %zu -> %zu bytes",
+		k_cyc_to_us_floor32(k_cycle_get_32() - start), heap_used, gb_cport_heap_used());
+
 	return 0;
 }
 
@@ -198,13 +410,14 @@ void gb_cports_deinit()
 {
 
 	size_t i;
-	const struct gb_cport *cport;
+	struct gb_cport *cport;
 
 	for (i = 0; i < ARRAY_SIZE(cports); ++i) {
 		cport = &cports[i];
 
-		if (cport->driver->exit) {
-			cport->driver->exit(cport->priv);
-		}
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+		gb_journal_reset(&cport->journal);
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+		gb_cport_driver_exit(cport);
 	}
 }
@@ -7,17 +7,119 @@
 #ifndef _GREYBUS_CPORT_H_
 #define _GREYBUS_CPORT_H_
 
+#include <zephyr/kernel.h>
 #include <greybus/greybus.h>
+#include "greybus_operation.h"
+#ifdef CONFIG_GREYBUS_RX_LOCKLESS
+#include "greybus_rx_ring.h"
+#endif // CONFIG_GREYBUS_RX_LOCKLESS
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+#include "greybus_journal.h"
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+
+/* Scheduling class of CPorts that do not ask for one */
+#define GB_RX_CLASS_LOWEST (CONFIG_GREYBUS_RX_PRIORITY_CLASSES - 1)
+
+/*
+ * Connection state of a CPort, driven by the control protocol.
+ *
+ * DISCONNECTED -> CONNECTING -> CONNECTED on Control Connected. The CPort is connecting while its
+ * driver is initialized, and does not take messages yet.
+ * CONNECTED -> DISCONNECTING on Control Disconnecting. New requests are refused, but pending
+ * operations can still be answered.
+ * CONNECTED/DISCONNECTING -> DISCONNECTED on Control Disconnected.
+ *
+ * The control CPort is always connected.
+ */
+enum gb_cport_state {
+	GB_CPORT_STATE_DISCONNECTED = 0,
+	GB_CPORT_STATE_CONNECTING,
+	GB_CPORT_STATE_CONNECTED,
+	GB_CPORT_STATE_DISCONNECTING,
+};
 
 struct gb_cport {
 	struct gb_driver *driver;
 	const void *priv;
+	/* Received messages waiting for dispatch, executed in order. */
+#ifdef CONFIG_GREYBUS_RX_LOCKLESS
+	struct gb_rx_ring rx_ring;
+	/* Serializes the receive threads of the transports, the ring has a single producer */
+	struct k_spinlock rx_put_lock;
+#else
+	struct k_msgq rx_msgq;
+	struct gb_message *rx_msgq_buf[CONFIG_GREYBUS_CPORT_RX_QUEUE_DEPTH];
+#endif // CONFIG_GREYBUS_RX_LOCKLESS
+	/* Set while the CPort is queued for, or owned by, a dispatch worker. */
+	atomic_t rx_scheduled;
+	/* Deferred request. Keeps the CPort owned until it is completed. */
+	struct gb_operation op;
+	/* enum gb_cport_state */
+	atomic_t state;
+	/* Handlers of the CPort being executed. The driver is only exited once they returned. */
+	atomic_t handlers;
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+	/* Unsolicited messages sent while the connection to AP is lost */
+	struct gb_journal journal;
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+	/* The driver init function ran, and exit did not run yet */
+	bool initialized;
+	/* Transport of the AP that connected the CPort. Unsolicited messages are sent on it. */
+	uint8_t transport;
+	/* Transport the request being executed arrived on. Responses are sent on it. */
+	uint8_t rx_transport;
 	uint8_t bundle;
 	uint8_t protocol;
+	/* Scheduling class, 0 being the highest. */
+	uint8_t rx_class;
 };
 
 struct gb_cport *gb_cport_get(uint16_t cport);
 
+/**
+ * Mark a CPort as connected, by the AP behind the transport the control request being executed
+ * arrived on. With CONFIG_GREYBUS_CPORT_LAZY_INIT, this also initializes the driver of the CPort.
+ *
+ * @return 0 on success, -EALREADY if the CPort is already connected by this AP, -EPERM if it is
+ *         connected by another AP, -EBUSY if it is connecting or disconnecting, or the error of
+ *         the driver init.
+ */
+int gb_cport_connect(uint16_t cport);
+
+/**
+ * Mark a connected CPort as disconnecting.
+ *
+ * @return 0 on success, -ENOTCONN if the CPort is not connected.
+ */
+int gb_cport_disconnecting(uint16_t cport);
+
+/**
+ * Mark a CPort as disconnected. With CONFIG_GREYBUS_CPORT_LAZY_INIT, this also exits the driver of
+ * the CPort if it was connected, unless the events of the CPort are journaled. The driver is exited
+ * once the operations of the CPort being executed returned, it stays initialized if they do not
+ * return within CONFIG_GREYBUS_OPERATION_TIMEOUT_MS.
+ */
+int gb_cport_disconnect(uint16_t cport);
+
+/**
+ * Check if a CPort is connected, i.e. new operations can be started on it.
+ */
+bool gb_cport_connected(uint16_t cport);
+
+/**
+ * Check if unsolicited messages of a CPort are wanted: the CPort is connected, or the connection to
+ * AP was lost and the messages are journaled until AP connects the CPort again.
+ */
+bool gb_cport_events_wanted(uint16_t cport);
+
+/**
+ * Check if a message can be exchanged on a CPort in its current state.
+ *
+ * Requests need a connected CPort. Responses are also allowed while the CPort is disconnecting so
+ * that pending operations can finish.
+ */
+bool gb_cport_msg_allowed(const struct gb_cport *cport, const struct gb_message *msg);
+
 /**
  * Initialize all cports.
  */
@@ -11,12 +11,164 @@
 
 K_HEAP_DEFINE(greybus_heap, CONFIG_GREYBUS_HEAP_MEM_POOL_SIZE);
 
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+#define GB_SLAB_ALIGN         sizeof(void *)
+#define GB_SLAB_BLOCK(_size)  ROUND_UP(_size, GB_SLAB_ALIGN)
+
+BUILD_ASSERT(CONFIG_GREYBUS_SLAB_SMALL_SIZE < CONFIG_GREYBUS_SLAB_MEDIUM_SIZE &&
+		     CONFIG_GREYBUS_SLAB_MEDIUM_SIZE < CONFIG_GREYBUS_SLAB_LARGE_SIZE &&
+		     CONFIG_GREYBUS_SLAB_LARGE_SIZE < CONFIG_GREYBUS_SLAB_MAX_SIZE,
+	     "Greybus slab sizes must be increasing");
+
+K_MEM_SLAB_DEFINE_STATIC(gb_slab_small, GB_SLAB_BLOCK(CONFIG_GREYBUS_SLAB_SMALL_SIZE),
+			 CONFIG_GREYBUS_SLAB_SMALL_COUNT, GB_SLAB_ALIGN);
+K_MEM_SLAB_DEFINE_STATIC(gb_slab_medium, GB_SLAB_BLOCK(CONFIG_GREYBUS_SLAB_MEDIUM_SIZE),
+			 CONFIG_GREYBUS_SLAB_MEDIUM_COUNT, GB_SLAB_ALIGN);
+K_MEM_SLAB_DEFINE_STATIC(gb_slab_large, GB_SLAB_BLOCK(CONFIG_GREYBUS_SLAB_LARGE_SIZE),
+			 CONFIG_GREYBUS_SLAB_LARGE_COUNT, GB_SLAB_ALIGN);
+K_MEM_SLAB_DEFINE_STATIC(gb_slab_max, GB_SLAB_BLOCK(CONFIG_GREYBUS_SLAB_MAX_SIZE),
+			 CONFIG_GREYBUS_SLAB_MAX_COUNT, GB_SLAB_ALIGN);
+
+/* Size classes, smallest first */
+static struct k_mem_slab *const gb_slabs[] = {
+	&gb_slab_small,
+	&gb_slab_medium,
+	&gb_slab_large,
+	&gb_slab_max,
+};
+
+static bool gb_slab_owns(const struct k_mem_slab *slab, const void *ptr)
+{
+	const char *start = slab->buffer;
+
+	return (const char *)ptr >= start &&
+	       (const char *)ptr < start + slab->info.block_size * slab->info.num_blocks;
+}
+
+/*
+ * Take a block of the smallest class that fits, or of a larger class if it is exhausted. Never
+ * blocks, so it works from ISR.
+ */
+static void *gb_slab_alloc(size_t len)
+{
+	size_t i;
+	void *ptr;
+
+	for (i = 0; i < ARRAY_SIZE(gb_slabs); ++i) {
+		if (len <= gb_slabs[i]->info.block_size &&
+		    k_mem_slab_alloc(gb_slabs[i], &ptr, K_NO_WAIT) == 0) {
+			return ptr;
+		}
+	}
+
+	return NULL;
+}
+
+static bool gb_slab_free(void *ptr)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(gb_slabs); ++i) {
+		if (gb_slab_owns(gb_slabs[i], ptr)) {
+			k_mem_slab_free(gb_slabs[i], ptr);
+			return true;
+		}
+	}
+
+	return false;
+}
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
+
 void *gb_alloc(size_t len)
 {
-	return k_heap_alloc(&greybus_heap, len, K_FOREVER);
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+	void *ptr = gb_slab_alloc(len);
+
+	if (ptr) {
+		return ptr;
+	}
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
+
+	/* Interrupt handlers, e.g. UART receive, must not wait for memory */
+	return k_heap_alloc(&greybus_heap, len, k_is_in_isr() ? K_NO_WAIT : K_FOREVER);
+}
+
+void *gb_alloc_nowait(size_t len)
+{
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+	void *ptr = gb_slab_alloc(len);
+
+	if (ptr) {
+		return ptr;
+	}
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
+
+	return k_heap_alloc(&greybus_heap, len, K_NO_WAIT);
 }
 
 void gb_free(void *ptr)
 {
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+	if (gb_slab_free(ptr)) {
+		return;
+	}
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
+
 	k_heap_free(&greybus_heap, ptr);
 }
+
+bool gb_heap_owns(const void *ptr)
+{
+	const char *start = greybus_heap.heap.init_mem;
+
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(gb_slabs); ++i) {
+		if (gb_slab_owns(gb_slabs[i], ptr)) {
+			return true;
+		}
+	}
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
+
+	return (const char *)ptr >= start &&
+	       (const char *)ptr < start + greybus_heap.heap.init_bytes;
+}
+
+size_t gb_alloc_size(void *ptr)
+{
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(gb_slabs); ++i) {
+		if (gb_slab_owns(gb_slabs[i], ptr)) {
+			return gb_slabs[i]->info.block_size;
+		}
+	}
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
+
+	/* The chunk header depends on the heap size and architecture, it is not counted */
+	return sys_heap_usable_size(&greybus_heap.heap, ptr);
+}
+
+#ifdef CONFIG_SYS_HEAP_RUNTIME_STATS
+size_t gb_heap_used(void)
+{
+	struct sys_memory_stats stats;
+	size_t used;
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+	size_t i;
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
+
+	sys_heap_runtime_stats_get(&greybus_heap.heap, &stats);
+	used = stats.allocated_bytes;
+
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+	for (i = 0; i < ARRAY_SIZE(gb_slabs); ++i) {
+		used += k_mem_slab_num_used_get(gb_slabs[i]) * gb_slabs[i]->info.block_size;
+	}
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
+
+	return used;
+}
+#endif // CONFIG_SYS_HEAP_RUNTIME_STATS
@@ -9,10 +9,28 @@
 #ifndef _GREYBUS_HEAP_H_
 #define _GREYBUS_HEAP_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 
 void *gb_alloc(size_t len);
 
+/* Same as gb_alloc, but fails instead of waiting for memory */
+void *gb_alloc_nowait(size_t len);
+
 void gb_free(void *ptr);
 
+/* Check if memory was allocated with gb_alloc */
+bool gb_heap_owns(const void *ptr);
+
+/*
+ * Bytes a block allocated with gb_alloc takes: the slab block, or the usable size of the heap
+ * chunk. The header of the heap chunk is not included.
+ */
+size_t gb_alloc_size(void *ptr);
+
+#ifdef CONFIG_SYS_HEAP_RUNTIME_STATS
+/* Number of bytes currently allocated from the greybus heap */
+size_t gb_heap_used(void);
+#endif // CONFIG_SYS_HEAP_RUNTIME_STATS
+
 #endif // _GREYBUS_HEAP_H_
@@ -0,0 +1,442 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * AP side of greybus. The traffic of a transport with a host goes to the host instead of the local
+ * CPorts: responses complete the requests the host sent, requests of the module go to the request
+ * handler of the host.
+ */
+
+#include <string.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <greybus/greybus_host.h>
+#include <greybus/greybus_protocols.h>
+#include "greybus-manifest.h"
+#include "greybus_host_internal.h"
+#include "greybus_outstanding.h"
+#include "greybus_transport.h"
+
+LOG_MODULE_REGISTER(greybus_host, CONFIG_GREYBUS_LOG_LEVEL);
+
+/* Only changed while greybus is stopped, so the receive threads can read it without locking */
+static struct gb_host *gb_hosts[CONFIG_GREYBUS_TRANSPORTS_MAX];
+
+static void gb_host_op_complete(const struct gb_outstanding_req *req, struct gb_message *resp,
+				int err)
+{
+	if (req->callback.host) {
+		req->callback.host(req->owner, req->cport, resp, err, req->user_data);
+	} else {
+		gb_message_dealloc(resp);
+	}
+}
+
+GB_OUTSTANDING_TABLE_DEFINE(gb_host_ops, CONFIG_GREYBUS_HOST_OPERATIONS_MAX, gb_host_op_complete);
+
+static struct gb_host *gb_host_find(const struct gb_transport_backend *transport)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(gb_hosts); ++i) {
+		if (gb_hosts[i] && gb_hosts[i]->transport == transport) {
+			return gb_hosts[i];
+		}
+	}
+
+	return NULL;
+}
+
+int gb_host_register(struct gb_host *host)
+{
+	size_t i;
+
+	if (!host || !host->transport) {
+		return -EINVAL;
+	}
+
+	if (gb_transport_get(0)) {
+		return -EBUSY;
+	}
+
+	if (gb_host_find(host->transport)) {
+		return -EALREADY;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(gb_hosts); ++i) {
+		if (!gb_hosts[i]) {
+			gb_hosts[i] = host;
+			return 0;
+		}
+	}
+
+	return -ENOMEM;
+}
+
+int gb_host_unregister(struct gb_host *host)
+{
+	size_t i;
+
+	if (gb_transport_get(0)) {
+		return -EBUSY;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(gb_hosts); ++i) {
+		if (gb_hosts[i] == host) {
+			gb_hosts[i] = NULL;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void gb_host_operations_init(void)
+{
+	gb_outstanding_init(&gb_host_ops);
+}
+
+int gb_host_request_send(struct gb_host *host, uint16_t cport, const struct gb_message *req,
+			 gb_host_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	int ret;
+	struct gb_outstanding *op;
+	const struct gb_outstanding_req op_req = {
+		.owner = host,
+		.callback.host = cb,
+		.user_data = user_data,
+		.cport = cport,
+		.operation_id = req->header.operation_id,
+	};
+
+	if (req->header.operation_id == 0) {
+		return -EINVAL;
+	}
+
+	if (gb_transport_id(host->transport) < 0) {
+		return -ENODEV;
+	}
+
+	/* Register before sending, the response can arrive before send returns */
+	op = gb_outstanding_add(&gb_host_ops, &op_req, timeout);
+	if (!op) {
+		LOG_WRN("Too many outstanding host requests");
+		return -EBUSY;
+	}
+
+	/* Not part of a dispatch batch, nothing else would flush it */
+	ret = host->transport->send(cport, req);
+	if (ret >= 0 && host->transport->flush) {
+		host->transport->flush();
+	}
+
+	if (ret < 0) {
+		gb_outstanding_remove(&gb_host_ops, op, &op_req);
+	}
+
+	return ret;
+}
+
+/*
+ * Send a request and free it.
+ */
+static int gb_host_request_send_free(struct gb_host *host, uint16_t cport, struct gb_message *req,
+				     gb_host_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	int ret;
+
+	if (!req) {
+		return -ENOMEM;
+	}
+
+	ret = gb_host_request_send(host, cport, req, cb, user_data, timeout);
+	gb_message_dealloc(req);
+
+	return ret;
+}
+
+int gb_host_request(struct gb_host *host, uint16_t cport, uint8_t type, const void *payload,
+		    size_t payload_len, gb_host_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	struct gb_message *req = gb_message_request_alloc(payload_len, type, false);
+
+	if (req && payload_len) {
+		memcpy(req->payload, payload, payload_len);
+	}
+
+	return gb_host_request_send_free(host, cport, req, cb, user_data, timeout);
+}
+
+static void gb_host_response_handle(struct gb_host *host, uint16_t cport, struct gb_message *resp)
+{
+	if (!gb_outstanding_response(&gb_host_ops, host, cport, resp)) {
+		LOG_WRN("CPort %u: dropping response to unknown host operation %u", cport,
+			resp->header.operation_id);
+		gb_message_dealloc(resp);
+	}
+}
+
+bool gb_host_rx(const struct gb_transport_backend *transport, uint16_t cport,
+		struct gb_message *msg)
+{
+	struct gb_host *host = gb_host_find(transport);
+
+	if (!host) {
+		return false;
+	}
+
+	if (gb_message_is_response(msg)) {
+		gb_host_response_handle(host, cport, msg);
+	} else if (host->request) {
+		host->request(host, cport, msg);
+	} else {
+		LOG_WRN("CPort %u: dropping module request of type %u", cport,
+			gb_message_type(msg));
+		gb_message_dealloc(msg);
+	}
+
+	return true;
+}
+
+void gb_host_cancel_all(void)
+{
+	gb_outstanding_cancel_all(&gb_host_ops);
+}
+
+int gb_host_manifest_get(struct gb_host *host, gb_host_callback_t cb, void *user_data,
+			 k_timeout_t timeout)
+{
+	return gb_host_request(host, GB_CONTROL_CPORT_ID, GB_CONTROL_TYPE_GET_MANIFEST, NULL, 0, cb,
+			       user_data, timeout);
+}
+
+int gb_host_manifest_foreach_cport(const void *manifest, size_t len,
+				   void (*cb)(uint16_t cport, uint8_t bundle, uint8_t protocol,
+					      void *user_data),
+				   void *user_data)
+{
+	const struct greybus_manifest_header *mh = manifest;
+	const struct greybus_descriptor_header *dh;
+	const struct greybus_descriptor_cport *desc;
+	const uint8_t *pos = manifest;
+	size_t offset, size;
+	int count = 0;
+
+	if (len < sizeof(*mh) || sys_le16_to_cpu(mh->size) > len) {
+		return -EINVAL;
+	}
+
+	len = sys_le16_to_cpu(mh->size);
+	for (offset = sizeof(*mh); offset < len; offset += size) {
+		if (len - offset < sizeof(*dh)) {
+			return -EINVAL;
+		}
+
+		dh = (const struct greybus_descriptor_header *)(pos + offset);
+		size = sys_le16_to_cpu(dh->size);
+		if (size < sizeof(*dh) || size > len - offset) {
+			return -EINVAL;
+		}
+
+		if (dh->type != GREYBUS_TYPE_CPORT) {
+			continue;
+		}
+
+		if (size < sizeof(*dh) + sizeof(*desc)) {
+			return -EINVAL;
+		}
+
+		desc = (const struct greybus_descriptor_cport *)(dh + 1);
+		if (cb) {
+			cb(sys_le16_to_cpu(desc->id), desc->bundle, desc->protocol_id, user_data);
+		}
+		count++;
+	}
+
+	return count;
+}
+
+static int gb_host_control_cport(struct gb_host *host, uint8_t type, uint16_t cport,
+				 gb_host_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	/* Same layout for connected and disconnected */
+	const struct gb_control_connected_request req_data = {
+		.cport_id = sys_cpu_to_le16(cport),
+	};
+
+	return gb_host_request(host, GB_CONTROL_CPORT_ID, type, &req_data, sizeof(req_data), cb,
+			       user_data, timeout);
+}
+
+int gb_host_connect(struct gb_host *host, uint16_t cport, gb_host_callback_t cb, void *user_data,
+		    k_timeout_t timeout)
+{
+	return gb_host_control_cport(host, GB_CONTROL_TYPE_CONNECTED, cport, cb, user_data,
+				     timeout);
+}
+
+int gb_host_disconnect(struct gb_host *host, uint16_t cport, gb_host_callback_t cb,
+		       void *user_data, k_timeout_t timeout)
+{
+	return gb_host_control_cport(host, GB_CONTROL_TYPE_DISCONNECTED, cport, cb, user_data,
+				     timeout);
+}
+
+int gb_host_gpio_direction_in(struct gb_host *host, uint16_t cport, uint8_t which,
+			      gb_host_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	const struct gb_gpio_direction_in_request req_data = {
+		.which = which,
+	};
+
+	return gb_host_request(host, cport, GB_GPIO_TYPE_DIRECTION_IN, &req_data, sizeof(req_data),
+			       cb, user_data, timeout);
+}
+
+int gb_host_gpio_direction_out(struct gb_host *host, uint16_t cport, uint8_t which,
+			       uint8_t value, gb_host_callback_t cb, void *user_data,
+			       k_timeout_t timeout)
+{
+	const struct gb_gpio_direction_out_request req_data = {
+		.which = which,
+		.value = value,
+	};
+
+	return gb_host_request(host, cport, GB_GPIO_TYPE_DIRECTION_OUT, &req_data,
+			       sizeof(req_data), cb, user_data, timeout);
+}
+
+int gb_host_gpio_get_value(struct gb_host *host, uint16_t cport, uint8_t which,
+			   gb_host_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	const struct gb_gpio_get_value_request req_data = {
+		.which = which,
+	};
+
+	return gb_host_request(host, cport, GB_GPIO_TYPE_GET_VALUE, &req_data, sizeof(req_data), cb,
+			       user_data, timeout);
+}
+
+int gb_host_gpio_set_value(struct gb_host *host, uint16_t cport, uint8_t which, uint8_t value,
+			   gb_host_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	const struct gb_gpio_set_value_request req_data = {
+		.which = which,
+		.value = value,
+	};
+
+	return gb_host_request(host, cport, GB_GPIO_TYPE_SET_VALUE, &req_data, sizeof(req_data), cb,
+			       user_data, timeout);
+}
+
+int gb_host_i2c_transfer(struct gb_host *host, uint16_t cport, const struct gb_host_i2c_msg *msgs,
+			 size_t num, gb_host_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	size_t i;
+	uint8_t *write_data;
+	size_t write_len = 0;
+	struct gb_message *req;
+	struct gb_i2c_transfer_request *req_data;
+
+	if (num == 0 || num > UINT16_MAX) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num; ++i) {
+		if (!(msgs[i].flags & GB_I2C_M_RD)) {
+			write_len += msgs[i].len;
+		}
+	}
+
+	req = gb_message_request_alloc(sizeof(*req_data) + sizeof(req_data->ops[0]) * num +
+					       write_len,
+				       GB_I2C_TYPE_TRANSFER, false);
+	if (!req) {
+		return -ENOMEM;
+	}
+
+	/* Write data immediately follows the ops, in order */
+	req_data = (struct gb_i2c_transfer_request *)req->payload;
+	req_data->op_count = sys_cpu_to_le16(num);
+	write_data = (uint8_t *)&req_data->ops[num];
+	for (i = 0; i < num; ++i) {
+		req_data->ops[i].addr = sys_cpu_to_le16(msgs[i].addr);
+		req_data->ops[i].flags = sys_cpu_to_le16(msgs[i].flags);
+		req_data->ops[i].size = sys_cpu_to_le16(msgs[i].len);
+		req_data->ops[i].minor = 0;
+
+		if (!(msgs[i].flags & GB_I2C_M_RD)) {
+			memcpy(write_data, msgs[i].buf, msgs[i].len);
+			write_data += msgs[i].len;
+		}
+	}
+
+	return gb_host_request_send_free(host, cport, req, cb, user_data, timeout);
+}
+
+int gb_host_spi_transfer(struct gb_host *host, uint16_t cport, uint8_t chip_select, uint8_t mode,
+			 const struct gb_host_spi_xfer *xfers, size_t num, gb_host_callback_t cb,
+			 void *user_data, k_timeout_t timeout)
+{
+	size_t i;
+	uint8_t *write_data;
+	size_t write_len = 0;
+	struct gb_message *req;
+	struct gb_spi_transfer_request *req_data;
+
+	if (num == 0 || num > UINT16_MAX) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num; ++i) {
+		if (xfers[i].tx_buf) {
+			write_len += xfers[i].len;
+		}
+	}
+
+	req = gb_message_request_alloc(sizeof(*req_data) + sizeof(req_data->transfers[0]) * num +
+					       write_len,
+				       GB_SPI_TYPE_TRANSFER, false);
+	if (!req) {
+		return -ENOMEM;
+	}
+
+	/* Write data immediately follows the transfers, in order */
+	req_data = (struct gb_spi_transfer_request *)req->payload;
+	req_data->chip_select = chip_select;
+	req_data->mode = mode;
+	req_data->count = sys_cpu_to_le16(num);
+	write_data = (uint8_t *)&req_data->transfers[num];
+	for (i = 0; i < num; ++i) {
+		req_data->transfers[i] = (struct gb_spi_transfer){
+			.speed_hz = sys_cpu_to_le32(xfers[i].speed_hz),
+			.len = sys_cpu_to_le32(xfers[i].len),
+			.bits_per_word = xfers[i].bits_per_word,
+			.xfer_flags = (xfers[i].tx_buf ? GB_SPI_XFER_WRITE : 0) |
+				      (xfers[i].rx ? GB_SPI_XFER_READ : 0),
+		};
+
+		if (xfers[i].tx_buf) {
+			memcpy(write_data, xfers[i].tx_buf, xfers[i].len);
+			write_data += xfers[i].len;
+		}
+	}
+
+	return gb_host_request_send_free(host, cport, req, cb, user_data, timeout);
+}
+
+int gb_host_uart_send(struct gb_host *host, uint16_t cport, const uint8_t *data, uint16_t len,
+		      gb_host_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	struct gb_uart_send_data_request *req_data;
+	struct gb_message *req =
+		gb_message_request_alloc(sizeof(*req_data) + len, GB_UART_TYPE_SEND_DATA, false);
+
+	if (req) {
+		req_data = (struct gb_uart_send_data_request *)req->payload;
+		req_data->size = sys_cpu_to_le16(len);
+		memcpy(req_data->data, data, len);
+	}
+
+	return gb_host_request_send_free(host, cport, req, cb, user_data, timeout);
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Hooks of the AP side of greybus into the core.
+ */
+
+#ifndef _GREYBUS_HOST_INTERNAL_H_
+#define _GREYBUS_HOST_INTERNAL_H_
+
+#include <stdbool.h>
+#include <greybus/greybus.h>
+
+/**
+ * Initialize the table of requests sent by hosts. All requests must have been completed.
+ */
+void gb_host_operations_init(void);
+
+/**
+ * Complete all requests sent by hosts with -ECANCELED.
+ */
+void gb_host_cancel_all(void);
+
+/*
+ * Hand a message received on the transport of a host to the host: responses to the callback of
+ * their request, requests to the request handler of the host.
+ *
+ * @return true if the host took ownership of the message, false if the transport has no host.
+ */
+bool gb_host_rx(const struct gb_transport_backend *transport, uint16_t cport,
+		struct gb_message *msg);
+
+#endif // _GREYBUS_HOST_INTERNAL_H_
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Virtual interfaces. Every interface is a subset of the bundles of the node, owned by the AP of
+ * one transport. The AP sees its CPorts numbered from 0 without the CPorts of other interfaces, so
+ * messages are renumbered when they enter and leave the node. The CPort ids in control requests
+ * are rewritten in place.
+ */
+
+#include <string.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <greybus/greybus_protocols.h>
+#include <greybus-utils/manifest.h>
+#include "greybus_interface.h"
+#include "greybus_transport.h"
+#include "greybus_cport.h"
+#include "greybus_internal.h"
+
+LOG_MODULE_REGISTER(greybus_interface, CONFIG_GREYBUS_LOG_LEVEL);
+
+#define GB_INTERFACE_NONE UINT8_MAX
+
+/*
+ * @iface: the interface
+ * @cports: node CPort of every CPort of the interface
+ * @cport_count: number of CPorts of the interface
+ * @heap_used: bytes held by the queued requests of the interface
+ */
+struct gb_interface_map {
+	const struct gb_interface *iface;
+	uint16_t cports[GREYBUS_CPORT_COUNT];
+	uint16_t cport_count;
+	atomic_t heap_used;
+};
+
+BUILD_ASSERT(CONFIG_GREYBUS_TRANSPORTS_MAX < GB_INTERFACE_NONE, "Too many interfaces");
+
+/* Only changed while greybus is stopped, so the receive threads can read it without locking */
+static struct gb_interface_map gb_interface_maps[CONFIG_GREYBUS_TRANSPORTS_MAX];
+static size_t gb_interface_maps_num;
+/* Interface of every node CPort, GB_INTERFACE_NONE for the control CPort and unused CPorts */
+static uint8_t gb_interface_of_cport[GREYBUS_CPORT_COUNT];
+/* CPort of every node CPort in its interface */
+static uint16_t gb_interface_cport_id[GREYBUS_CPORT_COUNT];
+
+static bool gb_interface_has_bundle(const struct gb_interface *iface, uint8_t bundle)
+{
+	return bundle == 0 || (iface->bundles & BIT(bundle));
+}
+
+static struct gb_interface_map *gb_interface_find(const struct gb_transport_backend *transport)
+{
+	size_t i;
+
+	for (i = 0; i < gb_interface_maps_num; ++i) {
+		if (gb_interface_maps[i].iface->transport == transport) {
+			return &gb_interface_maps[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Interface of a node CPort, NULL for the control CPort and CPorts without interface.
+ */
+static struct gb_interface_map *gb_interface_of(uint16_t cport)
+{
+	if (cport >= GREYBUS_CPORT_COUNT || gb_interface_of_cport[cport] >= gb_interface_maps_num) {
+		return NULL;
+	}
+
+	return &gb_interface_maps[gb_interface_of_cport[cport]];
+}
+
+int gb_interfaces_set(const struct gb_interface *interfaces, size_t num)
+{
+	size_t i, j;
+	uint16_t cport;
+	struct gb_interface_map *map;
+
+	if (gb_transport_get(0)) {
+		return -EBUSY;
+	}
+
+	if (num > ARRAY_SIZE(gb_interface_maps)) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num; ++i) {
+		if (!interfaces[i].transport) {
+			return -EINVAL;
+		}
+
+		for (j = 0; j < i; ++j) {
+			if (interfaces[i].transport == interfaces[j].transport ||
+			    (interfaces[i].bundles & interfaces[j].bundles & ~BIT(0))) {
+				return -EINVAL;
+			}
+		}
+	}
+
+	memset(gb_interface_of_cport, GB_INTERFACE_NONE, sizeof(gb_interface_of_cport));
+	for (i = 0; i < num; ++i) {
+		map = &gb_interface_maps[i];
+		map->iface = &interfaces[i];
+		map->cport_count = 0;
+		atomic_clear(&map->heap_used);
+
+		/* Same numbering as manifest_create_bundles */
+		for (cport = 0; cport < GREYBUS_CPORT_COUNT; ++cport) {
+			if (!gb_interface_has_bundle(map->iface, gb_cport_get(cport)->bundle)) {
+				continue;
+			}
+
+			gb_interface_cport_id[cport] = map->cport_count;
+			map->cports[map->cport_count++] = cport;
+			if (cport != GB_CONTROL_CPORT_ID) {
+				gb_interface_of_cport[cport] = i;
+			}
+		}
+	}
+	gb_interface_maps_num = num;
+
+	return 0;
+}
+
+void gb_interfaces_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < gb_interface_maps_num; ++i) {
+		atomic_clear(&gb_interface_maps[i].heap_used);
+	}
+}
+
+/*
+ * Control requests name CPorts the way the AP of the interface sees them. The control driver
+ * rejects CPorts that do not exist.
+ */
+static uint16_t gb_interface_control_map(uint16_t cport_id, const void *user_data)
+{
+	const struct gb_interface_map *map = user_data;
+
+	return (cport_id < map->cport_count) ? map->cports[cport_id] : UINT16_MAX;
+}
+
+int gb_interface_rx(const struct gb_transport_backend *transport, uint16_t *cport,
+		    struct gb_message **msg)
+{
+	const struct gb_interface_map *map = gb_interface_find(transport);
+
+	if (!map) {
+		return 0;
+	}
+
+	if (*cport >= map->cport_count) {
+		return -ENOENT;
+	}
+
+	*cport = map->cports[*cport];
+	if (*cport == GB_CONTROL_CPORT_ID) {
+		*msg = gb_control_cport_remap(*msg, gb_interface_control_map, map);
+		if (!*msg) {
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+int gb_interface_cport(const struct gb_transport_backend *transport, uint16_t cport)
+{
+	const struct gb_interface_map *map = gb_interface_find(transport);
+
+	if (!map || cport == GB_CONTROL_CPORT_ID) {
+		return cport;
+	}
+
+	if (gb_interface_of(cport) != map) {
+		return -ENOENT;
+	}
+
+	return gb_interface_cport_id[cport];
+}
+
+uint32_t gb_interface_bundles(const struct gb_transport_backend *transport)
+{
+	const struct gb_interface_map *map = gb_interface_find(transport);
+
+	return map ? map->iface->bundles : UINT32_MAX;
+}
+
+bool gb_interface_charge(uint16_t cport, const struct gb_message *msg)
+{
+	struct gb_interface_map *map = gb_interface_of(cport);
+	size_t len;
+	atomic_val_t used;
+
+	if (!map || map->iface->heap_budget == 0) {
+		return true;
+	}
+
+	len = gb_message_mem_size(msg);
+	used = atomic_add(&map->heap_used, len);
+	if (used + len > map->iface->heap_budget) {
+		atomic_sub(&map->heap_used, len);
+		return false;
+	}
+
+	return true;
+}
+
+void gb_interface_uncharge(uint16_t cport, const struct gb_message *msg)
+{
+	struct gb_interface_map *map = gb_interface_of(cport);
+
+	if (map && map->iface->heap_budget != 0) {
+		atomic_sub(&map->heap_used, gb_message_mem_size(msg));
+	}
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Virtual interfaces: CPort numbering, manifest and heap budget of the interface of a transport.
+ */
+
+#ifndef _GREYBUS_INTERFACE_H_
+#define _GREYBUS_INTERFACE_H_
+
+#include <stdbool.h>
+#include <greybus/greybus.h>
+
+/**
+ * Reset the heap use of all interfaces. No request must be queued.
+ */
+void gb_interfaces_init(void);
+
+/*
+ * Turn the CPort a message arrived on into the CPort of the node, and the CPort ids of control
+ * requests with it. Nothing changes on a transport without interface. A shared control request is
+ * copied before its CPort id is changed, @p msg is updated then.
+ *
+ * @return 0 on success, -ENOENT if the interface does not have the CPort, -ENOMEM if the copy
+ *         failed. @p msg is NULL after the copy failed.
+ */
+int gb_interface_rx(const struct gb_transport_backend *transport, uint16_t *cport,
+		    struct gb_message **msg);
+
+/*
+ * CPort a node CPort is known as on a transport.
+ *
+ * @return the CPort, -ENOENT if the interface of the transport does not have the CPort.
+ */
+int gb_interface_cport(const struct gb_transport_backend *transport, uint16_t cport);
+
+/*
+ * Bundles of the interface of a transport, bit n for bundle n. All bundles on a transport without
+ * interface.
+ */
+uint32_t gb_interface_bundles(const struct gb_transport_backend *transport);
+
+/*
+ * Account a request queued on a CPort to the heap budget of its interface.
+ *
+ * @return false if the interface is over its budget.
+ */
+bool gb_interface_charge(uint16_t cport, const struct gb_message *msg);
+
+/*
+ * Give back the budget taken by gb_interface_charge once the request left the queue.
+ */
+void gb_interface_uncharge(uint16_t cport, const struct gb_message *msg);
+
+#endif // _GREYBUS_INTERFACE_H_
@@ -7,10 +7,71 @@
 #ifndef _GREYBUS_INTERNAL_H_
 #define _GREYBUS_INTERNAL_H_
 
+#include <zephyr/kernel.h>
+#include <greybus/greybus.h>
 #include <greybus/greybus_messages.h>
 
 typedef void (*gb_operation_handler_t)(const void *priv, struct gb_message *msg, uint16_t cport);
 
+/* The operation never blocks and can be executed directly on the transport receive thread (see
+ * CONFIG_GREYBUS_INLINE_DISPATCH). */
+#define GB_HANDLER_F_INLINE         BIT(0)
+/* The operation has no response, not even when the core rejects it. */
+#define GB_HANDLER_F_UNIDIRECTIONAL BIT(1)
+/* The response is constant. The core sends it without calling a handler (see GB_HANDLER_STATIC). */
+#define GB_HANDLER_F_STATIC         BIT(2)
+
+struct gb_operation_handler {
+	uint8_t type;
+	uint8_t flags;
+	/* Requests with a shorter payload are rejected with GB_OP_INVALID before dispatch */
+	uint16_t min_payload_len;
+	/* Length of the static response payload */
+	uint16_t resp_len;
+	union {
+		gb_operation_handler_t handler;
+		/* Static response payload, with GB_HANDLER_F_STATIC */
+		const void *resp;
+	};
+};
+
+/*
+ * Entry of a driver operation table.
+ *
+ * @param _type Request type
+ * @param _handler Handler of the request
+ * @param _min_payload_len Minimum request payload length, usually sizeof the request struct
+ * @param _flags GB_HANDLER_F_* flags
+ */
+#define GB_HANDLER(_type, _handler, _min_payload_len, _flags)                                      \
+	{                                                                                          \
+		.type = _type,                                                                     \
+		.flags = _flags,                                                                   \
+		.min_payload_len = _min_payload_len,                                               \
+		.handler = _handler,                                                               \
+	}
+
+/*
+ * Entry of a driver operation table for an idempotent query with a constant response, e.g. a
+ * version or a capability mask. The core sends @p _resp with only the operation id filled in,
+ * built on the stack rather than allocated from the heap. @p _resp can be filled by the driver
+ * init, as long as it does not change afterwards.
+ *
+ * @param _type Request type
+ * @param _resp Response payload object, at most CONFIG_GREYBUS_STATIC_RESPONSE_MAX_SIZE bytes
+ */
+#define GB_HANDLER_STATIC(_type, _resp)                                                            \
+	{                                                                                          \
+		.type = _type,                                                                     \
+		.flags = GB_HANDLER_F_STATIC | GB_HANDLER_F_INLINE,                                \
+		.resp_len = sizeof(_resp),                                                         \
+		.resp = &(_resp),                                                                  \
+	}
+
+/* Set the operation table of a driver */
+#define GB_DRIVER_HANDLERS(_handlers)                                                              \
+	.op_handlers = _handlers, .op_handlers_num = ARRAY_SIZE(_handlers)
+
 struct gb_driver {
 	/*
 	 * This is the callback in which all the initialization of driver-specific
@@ -28,7 +89,18 @@ struct gb_driver {
 	void (*connected)(const void *priv);
 	void (*disconnected)(const void *priv);
 
-	gb_operation_handler_t op_handler;
+	/*
+	 * Operations of the driver. The core validates requests against this table and rejects
+	 * unknown types with GB_OP_PROTOCOL_BAD before they are queued.
+	 */
+	const struct gb_operation_handler *op_handlers;
+	size_t op_handlers_num;
+
+	/*
+	 * Execution time budget of an operation handler in milliseconds, checked with
+	 * CONFIG_GREYBUS_OPERATION_WATCHDOG. 0 for CONFIG_GREYBUS_OPERATION_BUDGET_MS.
+	 */
+	uint16_t op_budget_ms;
 };
 
 enum gb_event {
@@ -40,6 +112,99 @@ int gb_listen(uint16_t cport);
 int gb_stop_listening(uint16_t cport);
 int gb_notify(uint16_t cport, enum gb_event event);
 
+/*
+ * Disconnect all CPorts connected through a transport, for transports that lose the connection to
+ * AP. AP connects them again after it reconnects. With CONFIG_GREYBUS_EVENT_JOURNAL, unsolicited
+ * messages of the CPorts are journaled until then.
+ *
+ * @param transport Transport that lost AP, or NULL for all CPorts.
+ */
+void gb_disconnect_all(const struct gb_transport_backend *transport);
+
 uint8_t gb_errno_to_op_result(int err);
 
+/*
+ * Start a thread created with K_FOREVER. With CONFIG_GREYBUS_CPU_AFFINITY, the thread is pinned to
+ * the CPU of a dispatch partition first, partition 0 being CONFIG_GREYBUS_CPU_FIRST. Transport
+ * threads use partition 0.
+ */
+void gb_thread_start(k_tid_t thread, unsigned int partition);
+
+/*
+ * Handler for operations that have nothing to do and always succeed.
+ */
+void gb_handler_success(const void *priv, struct gb_message *msg, uint16_t cport);
+
+/*
+ * Number of operations that can still be queued on a CPort before it starts rejecting them with
+ * GB_OP_RETRY.
+ *
+ * @return number of free slots, or -EINVAL if the CPort is not valid.
+ */
+int gb_cport_credits(uint16_t cport);
+
+/*
+ * Wait until no handler of a disconnected CPort is executing, on any worker, and its deferred
+ * operation is completed. Must not be called from a handler of the CPort.
+ *
+ * @return 0 on success, -ETIMEDOUT if an operation is still running after
+ *         CONFIG_GREYBUS_OPERATION_TIMEOUT_MS.
+ */
+int gb_cport_handlers_wait(uint16_t cport);
+
+/*
+ * Remember the transport a received message arrived on until it is dispatched. Kept next to the
+ * reference count, out of the message itself, so that messages shared with a transport are not
+ * modified. Messages on the stack or in flash are not received, this does nothing for them.
+ *
+ * @param msg: greybus message
+ * @param transport: id of the transport, see gb_transport_id
+ */
+void gb_message_rx_transport_set(struct gb_message *msg, uint8_t transport);
+
+/*
+ * Transport a received message arrived on, see gb_message_rx_transport_set. 0 for messages on the
+ * stack or in flash.
+ */
+uint8_t gb_message_rx_transport(const struct gb_message *msg);
+
+/*
+ * Get a message that can be modified. A message nobody else holds is returned as is, a shared one
+ * is copied and the reference of the caller dropped.
+ *
+ * @param msg: greybus message allocated with gb_message_alloc
+ *
+ * @return the message to modify. Null if the copy failed, the reference of the caller is dropped
+ *         then too.
+ */
+struct gb_message *gb_message_unshare(struct gb_message *msg);
+
+/*
+ * Bytes a message takes in memory: its heap block when it was allocated with gb_message_alloc,
+ * its header and payload otherwise.
+ */
+size_t gb_message_mem_size(const struct gb_message *msg);
+
+/*
+ * Map a CPort id named by a control request to another numbering.
+ *
+ * @return the new CPort id. UINT16_MAX for an id outside of the numbering, no CPort has it, so the
+ *         request is refused.
+ */
+typedef uint16_t (*gb_control_cport_map_t)(uint16_t cport_id, const void *user_data);
+
+/*
+ * Rewrite the CPort id of a control request that names a CPort (Connected, Disconnecting,
+ * Disconnected and CPort Credits), for nodes that number CPorts differently than their AP. Other
+ * messages are returned as is. A shared request is copied before it is changed.
+ *
+ * @param msg: message received on the control CPort
+ * @param map: gives the new CPort id
+ * @param user_data: passed to @p map
+ *
+ * @return the message, a copy if it was shared. NULL if the copy failed, @p msg is released then.
+ */
+struct gb_message *gb_control_cport_remap(struct gb_message *msg, gb_control_cport_map_t map,
+					  const void *user_data);
+
 #endif // _GREYBUS_INTERNAL_H_
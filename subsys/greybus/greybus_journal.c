@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * Unsolicited messages (GPIO events, UART data, logs) sent while AP is disconnected are kept and
+ * sent again once AP connects the CPort again, instead of being lost.
+ */
+
+#include "greybus_journal.h"
+#include "greybus_transport.h"
+#include "greybus_operation.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(greybus_journal, CONFIG_GREYBUS_LOG_LEVEL);
+
+static void *gb_journal_slot(struct gb_journal *journal, size_t idx)
+{
+	return journal->slots[(journal->head + idx) % GB_JOURNAL_DEPTH];
+}
+
+void gb_journal_reset(struct gb_journal *journal)
+{
+	k_spinlock_key_t key = k_spin_lock(&journal->lock);
+
+	journal->armed = false;
+	journal->head = 0;
+	journal->count = 0;
+	journal->replay_msg = NULL;
+	journal->dropped = 0;
+
+	k_spin_unlock(&journal->lock, key);
+}
+
+void gb_journal_arm(struct gb_journal *journal)
+{
+	k_spinlock_key_t key = k_spin_lock(&journal->lock);
+
+	journal->armed = true;
+
+	k_spin_unlock(&journal->lock, key);
+}
+
+/*
+ * Check if an identical message is already journaled. Must be called with the lock held.
+ */
+static bool gb_journal_contains(struct gb_journal *journal, const struct gb_message *msg,
+				size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < journal->count; ++i) {
+		if (memcmp(gb_journal_slot(journal, i), msg, len) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool gb_journal_capture(struct gb_journal *journal, const struct gb_message *msg)
+{
+	size_t len = sys_le16_to_cpu(msg->header.size);
+	k_spinlock_key_t key;
+
+	if (gb_message_is_response(msg)) {
+		return false;
+	}
+
+	key = k_spin_lock(&journal->lock);
+
+	if (!journal->armed || msg == journal->replay_msg) {
+		k_spin_unlock(&journal->lock, key);
+		return false;
+	}
+
+	if (len > GB_JOURNAL_SLOT_SIZE) {
+		journal->dropped++;
+		goto unlock;
+	}
+
+	if (IS_ENABLED(CONFIG_GREYBUS_EVENT_JOURNAL_COALESCE) &&
+	    gb_journal_contains(journal, msg, len)) {
+		goto unlock;
+	}
+
+	if (journal->count == GB_JOURNAL_DEPTH) {
+		journal->dropped++;
+		if (IS_ENABLED(CONFIG_GREYBUS_EVENT_JOURNAL_DROP_NEWEST)) {
+			goto unlock;
+		}
+
+		journal->head = (journal->head + 1) % GB_JOURNAL_DEPTH;
+		journal->count--;
+	}
+
+	memcpy(gb_journal_slot(journal, journal->count), msg, len);
+	journal->count++;
+
+unlock:
+	k_spin_unlock(&journal->lock, key);
+
+	return true;
+}
+
+void gb_journal_replay(struct gb_journal *journal, uint16_t cport)
+{
+	uint32_t buf[GB_JOURNAL_SLOT_SIZE / sizeof(uint32_t)];
+	const struct gb_message *msg = (const struct gb_message *)buf;
+	k_spinlock_key_t key;
+	uint32_t dropped;
+	int ret;
+
+	key = k_spin_lock(&journal->lock);
+	dropped = journal->dropped;
+	journal->dropped = 0;
+	k_spin_unlock(&journal->lock, key);
+
+	if (dropped) {
+		LOG_WRN("CPort %u: %u messages lost while disconnected", cport, dropped);
+	}
+
+	while (true) {
+		key = k_spin_lock(&journal->lock);
+		if (journal->count == 0) {
+			journal->armed = false;
+			journal->replay_msg = NULL;
+			k_spin_unlock(&journal->lock, key);
+			break;
+		}
+
+		memcpy(buf, gb_journal_slot(journal, 0), sizeof(buf));
+		journal->head = (journal->head + 1) % GB_JOURNAL_DEPTH;
+		journal->count--;
+		journal->replay_msg = msg;
+		k_spin_unlock(&journal->lock, key);
+
+		/* Responses to replayed requests are consumed by the outstanding table */
+		if (msg->header.operation_id == 0) {
+			ret = gb_transport_message_send(msg, cport);
+		} else {
+			ret = gb_operation_request_send_default(msg, cport, NULL, NULL);
+		}
+
+		if (ret < 0) {
+			LOG_ERR("CPort %u: failed to replay message of type %u: %d", cport,
+				gb_message_type(msg), ret);
+		}
+	}
+
+	gb_transport_flush();
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Journal of unsolicited messages sent by the module while the connection to AP is lost.
+ */
+
+#ifndef _GREYBUS_JOURNAL_H_
+#define _GREYBUS_JOURNAL_H_
+
+#include <zephyr/kernel.h>
+#include <greybus/greybus_messages.h>
+
+#define GB_JOURNAL_DEPTH     CONFIG_GREYBUS_EVENT_JOURNAL_DEPTH
+#define GB_JOURNAL_SLOT_SIZE ROUND_UP(CONFIG_GREYBUS_EVENT_JOURNAL_MSG_SIZE, sizeof(uint32_t))
+
+/*
+ * Messages are copied in fixed size slots, so journaling works from ISR and never touches the
+ * greybus heap.
+ *
+ * @lock: protects the journal
+ * @armed: messages are journaled instead of sent, from the loss of the connection until the
+ *         journal is replayed
+ * @head: oldest slot
+ * @count: number of used slots
+ * @replay_msg: message being replayed, sent as is
+ * @dropped: messages lost since the journal was armed
+ * @slots: journaled messages
+ */
+struct gb_journal {
+	struct k_spinlock lock;
+	bool armed;
+	uint8_t head;
+	uint8_t count;
+	const struct gb_message *replay_msg;
+	uint32_t dropped;
+	uint32_t slots[GB_JOURNAL_DEPTH][GB_JOURNAL_SLOT_SIZE / sizeof(uint32_t)];
+};
+
+/**
+ * Empty and disarm a journal.
+ */
+void gb_journal_reset(struct gb_journal *journal);
+
+/**
+ * Start journaling, after the connection to AP was lost.
+ */
+void gb_journal_arm(struct gb_journal *journal);
+
+static inline bool gb_journal_armed(const struct gb_journal *journal)
+{
+	return journal->armed;
+}
+
+/**
+ * Journal an unsolicited message if the journal is armed. Can be called from ISR.
+ *
+ * @return true if the journal took care of the message, even if it had to drop it. false if the
+ *         message must be sent.
+ */
+bool gb_journal_capture(struct gb_journal *journal, const struct gb_message *msg);
+
+/**
+ * Send journaled messages in order and disarm the journal. Messages captured while replaying are
+ * sent too, so that ordering is kept.
+ */
+void gb_journal_replay(struct gb_journal *journal, uint16_t cport);
+
+#endif // _GREYBUS_JOURNAL_H_
@@ -7,9 +7,34 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include "greybus_heap.h"
+#include "greybus_internal.h"
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+#include "greybus_quota.h"
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
 
 #define OPERATION_ID_START 1
 
+/*
+ * Kept in front of every message allocated with gb_message_alloc. Transports send the message
+ * itself, so the reference count never goes on the wire.
+ */
+struct gb_message_alloc_hdr {
+	atomic_t refcount;
+	/* Transport a received message arrived on */
+	uint8_t rx_transport;
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+	/* CPort the message is charged to, GB_QUOTA_NONE if none */
+	uint16_t quota_cport;
+	/* Bytes charged, the size of the message can change when it becomes a response */
+	uint16_t quota_len;
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
+} __aligned(sizeof(void *));
+
+static inline struct gb_message_alloc_hdr *gb_message_alloc_hdr(const struct gb_message *msg)
+{
+	return (struct gb_message_alloc_hdr *)msg - 1;
+}
+
 LOG_MODULE_REGISTER(greybus_messages, CONFIG_GREYBUS_LOG_LEVEL);
 
 static atomic_t operation_id_counter = ATOMIC_INIT(OPERATION_ID_START);
@@ -24,16 +49,17 @@ uint16_t new_operation_id(void)
 	return temp;
 }
 
-struct gb_message *gb_message_alloc(size_t payload_len, uint8_t message_type, uint16_t operation_id,
-				    uint8_t status)
+static struct gb_message *gb_message_init(struct gb_message_alloc_hdr *alloc_hdr,
+					  size_t payload_len, uint8_t message_type,
+					  uint16_t operation_id, uint8_t status)
 {
-	struct gb_message *msg;
+	struct gb_message *msg = (struct gb_message *)(alloc_hdr + 1);
 
-	msg = gb_alloc(sizeof(struct gb_message) + payload_len);
-	if (msg == NULL) {
-		LOG_WRN("Failed to allocate Greybus request message");
-		return NULL;
-	}
+	atomic_set(&alloc_hdr->refcount, 1);
+	alloc_hdr->rx_transport = 0;
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+	alloc_hdr->quota_cport = GB_QUOTA_NONE;
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
 
 	msg->header.size = sizeof(struct gb_operation_msg_hdr) + payload_len;
 	msg->header.operation_id = operation_id;
@@ -43,9 +69,217 @@ struct gb_message *gb_message_alloc(size_t payload_len, uint8_t message_type, ui
 	return msg;
 }
 
+struct gb_message *gb_message_alloc(size_t payload_len, uint8_t message_type, uint16_t operation_id,
+				    uint8_t status)
+{
+	struct gb_message_alloc_hdr *alloc_hdr;
+
+	alloc_hdr = gb_alloc(sizeof(*alloc_hdr) + sizeof(struct gb_message) + payload_len);
+	if (alloc_hdr == NULL) {
+		LOG_WRN("Failed to allocate Greybus request message");
+		return NULL;
+	}
+
+	return gb_message_init(alloc_hdr, payload_len, message_type, operation_id, status);
+}
+
+struct gb_message *gb_message_alloc_cport(uint16_t cport, size_t payload_len,
+					  uint8_t message_type, uint16_t operation_id,
+					  uint8_t status)
+{
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+	struct gb_message_alloc_hdr *alloc_hdr;
+	size_t len;
+
+	alloc_hdr = gb_alloc_nowait(sizeof(*alloc_hdr) + sizeof(struct gb_message) + payload_len);
+	if (alloc_hdr == NULL) {
+		LOG_WRN("Failed to allocate Greybus message for CPort %u", cport);
+		return NULL;
+	}
+
+	/* Charge what the block really takes from the heap, not what was asked for */
+	len = gb_alloc_size(alloc_hdr);
+	if (len > UINT16_MAX || gb_quota_charge(cport, len) < 0) {
+		LOG_WRN("CPort %u over quota, cannot allocate message", cport);
+		gb_free(alloc_hdr);
+		return NULL;
+	}
+
+	gb_message_init(alloc_hdr, payload_len, message_type, operation_id, status);
+	alloc_hdr->quota_cport = cport;
+	alloc_hdr->quota_len = len;
+
+	return (struct gb_message *)(alloc_hdr + 1);
+#else
+	ARG_UNUSED(cport);
+
+	return gb_message_alloc(payload_len, message_type, operation_id, status);
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
+}
+
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+int gb_message_charge(struct gb_message *msg, uint16_t cport)
+{
+	struct gb_message_alloc_hdr *alloc_hdr = gb_message_alloc_hdr(msg);
+	size_t len;
+	int ret;
+
+	if (!gb_heap_owns(msg) || alloc_hdr->quota_cport == cport) {
+		return 0;
+	}
+
+	/* Transports charge the CPort AP numbers, which can differ from the CPort of the node */
+	len = (alloc_hdr->quota_cport != GB_QUOTA_NONE) ? alloc_hdr->quota_len
+							 : gb_alloc_size(alloc_hdr);
+
+	if (len > UINT16_MAX) {
+		return -ENOMEM;
+	}
+
+	ret = gb_quota_charge(cport, len);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (alloc_hdr->quota_cport != GB_QUOTA_NONE) {
+		gb_quota_uncharge(alloc_hdr->quota_cport, alloc_hdr->quota_len);
+	}
+
+	alloc_hdr->quota_cport = cport;
+	alloc_hdr->quota_len = len;
+
+	return 0;
+}
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
+
 void gb_message_dealloc(struct gb_message *msg)
 {
-	gb_free(msg);
+	gb_message_unref(msg);
+}
+
+struct gb_message *gb_message_ref(struct gb_message *msg)
+{
+	/* Only messages of the greybus heap have a reference count */
+	if (gb_heap_owns(msg)) {
+		atomic_inc(&gb_message_alloc_hdr(msg)->refcount);
+	}
+
+	return msg;
+}
+
+void gb_message_unref(struct gb_message *msg)
+{
+	struct gb_message_alloc_hdr *alloc_hdr;
+
+	/* Messages on the stack or in flash belong to their caller */
+	if (!msg || !gb_heap_owns(msg)) {
+		return;
+	}
+
+	alloc_hdr = gb_message_alloc_hdr(msg);
+	if (atomic_dec(&alloc_hdr->refcount) != 1) {
+		return;
+	}
+
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+	if (alloc_hdr->quota_cport != GB_QUOTA_NONE) {
+		gb_quota_uncharge(alloc_hdr->quota_cport, alloc_hdr->quota_len);
+	}
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
+
+	gb_free(alloc_hdr);
+}
+
+bool gb_message_is_shared(const struct gb_message *msg)
+{
+	return gb_heap_owns(msg) && atomic_get(&gb_message_alloc_hdr(msg)->refcount) > 1;
+}
+
+struct gb_message *gb_message_share(const struct gb_message *msg)
+{
+	if (gb_heap_owns(msg)) {
+		return gb_message_ref((struct gb_message *)msg);
+	}
+
+	return gb_message_copy(msg);
+}
+
+struct gb_message *gb_message_unshare(struct gb_message *msg)
+{
+	struct gb_message *copy;
+
+	if (!gb_message_is_shared(msg)) {
+		return msg;
+	}
+
+	copy = gb_message_copy(msg);
+	if (copy) {
+		gb_message_alloc_hdr(copy)->rx_transport = gb_message_alloc_hdr(msg)->rx_transport;
+	}
+	gb_message_unref(msg);
+
+	return copy;
+}
+
+size_t gb_message_mem_size(const struct gb_message *msg)
+{
+	if (gb_heap_owns(msg)) {
+		return gb_alloc_size(gb_message_alloc_hdr(msg));
+	}
+
+	return sizeof(struct gb_message) + gb_message_payload_len(msg);
+}
+
+void gb_message_rx_transport_set(struct gb_message *msg, uint8_t transport)
+{
+	if (gb_heap_owns(msg)) {
+		gb_message_alloc_hdr(msg)->rx_transport = transport;
+	}
+}
+
+uint8_t gb_message_rx_transport(const struct gb_message *msg)
+{
+	return gb_heap_owns(msg) ? gb_message_alloc_hdr(msg)->rx_transport : 0;
+}
+
+struct gb_message *gb_message_response_in_place(struct gb_message *req, size_t payload_len,
+						uint8_t status)
+{
+	size_t req_len = gb_message_payload_len(req);
+	struct gb_message *resp = req;
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+	/* The larger buffer is held by the CPort of the request */
+	uint16_t cport = gb_heap_owns(req) ? gb_message_alloc_hdr(req)->quota_cport : GB_QUOTA_NONE;
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
+
+	if (gb_message_is_shared(req) || payload_len > req_len) {
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+		resp = (cport != GB_QUOTA_NONE)
+			       ? gb_message_alloc_cport(cport, MAX(req_len, payload_len),
+							gb_message_type(req),
+							req->header.operation_id, 0)
+			       : gb_message_alloc(MAX(req_len, payload_len), gb_message_type(req),
+						  req->header.operation_id, 0);
+#else
+		resp = gb_message_alloc(MAX(req_len, payload_len), gb_message_type(req),
+					req->header.operation_id, 0);
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
+		if (!resp) {
+			return NULL;
+		}
+
+		memcpy(resp->payload, req->payload, req_len);
+		gb_message_unref(req);
+	}
+
+	/* The buffer may be larger than the response, the heap does not need its size */
+	resp->header.size = sys_cpu_to_le16(sizeof(struct gb_message) + payload_len);
+	resp->header.type = GB_RESPONSE(resp->header.type);
+	resp->header.result = status;
+	resp->header.pad[0] = 0;
+	resp->header.pad[1] = 0;
+
+	return resp;
 }
 
 struct gb_message *gb_message_request_alloc(size_t payload_len, uint8_t request_type,
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * Table of requests sent by the module that are waiting for a response from AP.
+ */
+
+#include "greybus_operation.h"
+#include "greybus_outstanding.h"
+#include "greybus_transport.h"
+#include "greybus_cport.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(greybus_operation, CONFIG_GREYBUS_LOG_LEVEL);
+
+static void gb_operation_outstanding_complete(const struct gb_outstanding_req *req,
+					     struct gb_message *resp, int err)
+{
+	if (req->callback.operation) {
+		req->callback.operation(req->cport, resp, err, req->user_data);
+	} else {
+		gb_message_dealloc(resp);
+	}
+}
+
+GB_OUTSTANDING_TABLE_DEFINE(gb_outstanding_ops, CONFIG_GREYBUS_OPERATIONS_MAX,
+			    gb_operation_outstanding_complete);
+
+void gb_operations_init(void)
+{
+	gb_outstanding_init(&gb_outstanding_ops);
+}
+
+int gb_operation_request_send(const struct gb_message *req, uint16_t cport,
+			      gb_operation_callback_t cb, void *user_data, k_timeout_t timeout)
+{
+	int ret;
+	struct gb_outstanding *op;
+	const struct gb_outstanding_req op_req = {
+		.callback.operation = cb,
+		.user_data = user_data,
+		.cport = cport,
+		.operation_id = req->header.operation_id,
+	};
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+	struct gb_cport *cport_ptr;
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+
+	if (req->header.operation_id == 0) {
+		return -EINVAL;
+	}
+
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+	/* Nobody waits for the response, the request can be journaled like an event */
+	cport_ptr = gb_cport_get(cport);
+	if (!cb && cport_ptr && gb_journal_capture(&cport_ptr->journal, req)) {
+		return 0;
+	}
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+
+	/* Fail before taking a slot, the request could only time out */
+	if (!gb_cport_connected(cport)) {
+		return -ENOTCONN;
+	}
+
+	/* Register before sending, the response can arrive before send returns */
+	op = gb_outstanding_add(&gb_outstanding_ops, &op_req, timeout);
+	if (!op) {
+		LOG_WRN("Too many outstanding requests");
+		return -EBUSY;
+	}
+
+	ret = gb_transport_message_send(req, cport);
+	if (ret < 0) {
+		gb_outstanding_remove(&gb_outstanding_ops, op, &op_req);
+	}
+
+	return ret;
+}
+
+void gb_operation_response_handle(struct gb_message *resp, uint16_t cport)
+{
+	if (!gb_outstanding_response(&gb_outstanding_ops, NULL, cport, resp)) {
+		LOG_WRN("CPort %u: dropping response to unknown operation %u", cport,
+			resp->header.operation_id);
+		gb_message_dealloc(resp);
+	}
+}
+
+void gb_operation_cancel_all(void)
+{
+	gb_outstanding_cancel_all(&gb_outstanding_ops);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _GREYBUS_OPERATION_H_
+#define _GREYBUS_OPERATION_H_
+
+#include <zephyr/kernel.h>
+#include <greybus/greybus_messages.h>
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG
+#include "greybus_watchdog.h"
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG
+
+/*
+ * A request received from AP whose response is sent after its handler returned. The CPort of the
+ * request does not execute other operations until the request is completed.
+ *
+ * @req: the request
+ * @cport: CPort of the request
+ * @state: handshake between the dispatch worker and gb_operation_complete
+ * @watch: checks the request against the budget of its protocol until it is completed
+ */
+struct gb_operation {
+	struct gb_message *req;
+	uint16_t cport;
+	atomic_t state;
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG
+	struct gb_op_watch watch;
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG
+};
+
+/**
+ * Keep a request after its handler returns, for example while waiting for a bus transfer callback.
+ * Must be called from the operation handler of the request, which must then not touch the request
+ * anymore except through the returned handle.
+ *
+ * @param req Request passed to the operation handler
+ * @param cport CPort passed to the operation handler
+ *
+ * @return handle to complete the request with
+ */
+struct gb_operation *gb_operation_defer(struct gb_message *req, uint16_t cport);
+
+/**
+ * Send the response of a deferred request, free the request and let its CPort continue with the
+ * next operation. Must not be called from ISR, bus callbacks running in interrupt context should
+ * submit a work item instead.
+ *
+ * @param op Handle returned by gb_operation_defer
+ * @param status Greybus result of the operation
+ * @param payload Response payload, copied. Can be NULL.
+ * @param payload_len
+ */
+void gb_operation_complete(struct gb_operation *op, uint8_t status, const void *payload,
+			   size_t payload_len);
+
+/*
+ * Called once for every request sent with gb_operation_request_send.
+ *
+ * @param cport CPort the request was sent on
+ * @param resp Response to the request, owned by the callback. NULL if err is not 0.
+ * @param err 0 if a response arrived, -ETIMEDOUT if none arrived in time, -ECANCELED if greybus
+ *            was stopped.
+ * @param user_data user_data given to gb_operation_request_send
+ */
+typedef void (*gb_operation_callback_t)(uint16_t cport, struct gb_message *resp, int err,
+					void *user_data);
+
+/**
+ * Send a request to AP and track it until a response arrives or the timeout expires.
+ *
+ * Responses are delivered on the dispatch worker of the CPort, in order with the other operations
+ * of the CPort. Timeouts are delivered on the system workqueue.
+ *
+ * This function does not take ownership over the request. Must not be called from ISR, the
+ * transport can block while sending. Interrupt handlers should submit a work item instead.
+ *
+ * With CONFIG_GREYBUS_EVENT_JOURNAL, a request without callback is journaled while the connection
+ * to AP is lost, and sent once AP connects the CPort again.
+ *
+ * @param req Request message. Must not be unidirectional.
+ * @param cport
+ * @param cb Callback. Can be NULL if the response is not interesting.
+ * @param user_data Passed to the callback
+ * @param timeout Time to wait for the response
+ *
+ * @return 0 on success, -ENOTCONN if the CPort is not connected, -EBUSY if too many requests are
+ *         outstanding, or a transport error.
+ */
+int gb_operation_request_send(const struct gb_message *req, uint16_t cport,
+			      gb_operation_callback_t cb, void *user_data, k_timeout_t timeout);
+
+/**
+ * Same as gb_operation_request_send, using CONFIG_GREYBUS_OPERATION_TIMEOUT_MS.
+ */
+static inline int gb_operation_request_send_default(const struct gb_message *req, uint16_t cport,
+						    gb_operation_callback_t cb, void *user_data)
+{
+	return gb_operation_request_send(req, cport, cb, user_data,
+					 K_MSEC(CONFIG_GREYBUS_OPERATION_TIMEOUT_MS));
+}
+
+/**
+ * Initialize the outstanding request table. All requests must have been completed.
+ */
+void gb_operations_init(void);
+
+/**
+ * Hand a received response to the callback of its request. Takes ownership of the response.
+ */
+void gb_operation_response_handle(struct gb_message *resp, uint16_t cport);
+
+/**
+ * Complete all outstanding requests with -ECANCELED.
+ */
+void gb_operation_cancel_all(void);
+
+#endif // _GREYBUS_OPERATION_H_
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * Tables of sent requests waiting for their response.
+ */
+
+#include "greybus_outstanding.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(greybus_outstanding, CONFIG_GREYBUS_LOG_LEVEL);
+
+static void gb_outstanding_timeout(struct k_work *work);
+
+/*
+ * Free a slot and return the request to complete. Must be called with the lock held.
+ */
+static struct gb_outstanding_req gb_outstanding_take(struct gb_outstanding *op)
+{
+	struct gb_outstanding_req req = op->req;
+
+	op->req.operation_id = 0;
+	k_work_cancel_delayable(&op->timeout_work);
+
+	return req;
+}
+
+static bool gb_outstanding_match(const struct gb_outstanding_req *a,
+				 const struct gb_outstanding_req *b)
+{
+	return a->operation_id == b->operation_id && a->owner == b->owner && a->cport == b->cport;
+}
+
+void gb_outstanding_init(struct gb_outstanding_table *table)
+{
+	size_t i;
+
+	for (i = 0; i < table->ops_num; ++i) {
+		table->ops[i].req.operation_id = 0;
+		table->ops[i].table = table;
+		k_work_init_delayable(&table->ops[i].timeout_work, gb_outstanding_timeout);
+	}
+}
+
+struct gb_outstanding *gb_outstanding_add(struct gb_outstanding_table *table,
+					  const struct gb_outstanding_req *req, k_timeout_t timeout)
+{
+	size_t i;
+	k_spinlock_key_t key;
+	struct gb_outstanding *op = NULL;
+
+	key = k_spin_lock(&table->lock);
+	for (i = 0; i < table->ops_num; ++i) {
+		if (table->ops[i].req.operation_id == 0) {
+			op = &table->ops[i];
+			break;
+		}
+	}
+
+	if (op) {
+		op->req = *req;
+		op->deadline = sys_timepoint_calc(timeout);
+		k_work_reschedule(&op->timeout_work, timeout);
+	}
+	k_spin_unlock(&table->lock, key);
+
+	return op;
+}
+
+void gb_outstanding_remove(struct gb_outstanding_table *table, struct gb_outstanding *op,
+			   const struct gb_outstanding_req *req)
+{
+	k_spinlock_key_t key = k_spin_lock(&table->lock);
+
+	if (gb_outstanding_match(&op->req, req)) {
+		gb_outstanding_take(op);
+	}
+	k_spin_unlock(&table->lock, key);
+}
+
+bool gb_outstanding_response(struct gb_outstanding_table *table, void *owner, uint16_t cport,
+			     struct gb_message *resp)
+{
+	size_t i;
+	k_spinlock_key_t key;
+	const struct gb_outstanding_req match = {
+		.owner = owner,
+		.cport = cport,
+		.operation_id = resp->header.operation_id,
+	};
+	struct gb_outstanding_req req = {.operation_id = 0};
+
+	key = k_spin_lock(&table->lock);
+	for (i = 0; i < table->ops_num; ++i) {
+		if (gb_outstanding_match(&table->ops[i].req, &match)) {
+			req = gb_outstanding_take(&table->ops[i]);
+			break;
+		}
+	}
+	k_spin_unlock(&table->lock, key);
+
+	if (req.operation_id == 0) {
+		return false;
+	}
+
+	table->complete(&req, resp, 0);
+
+	return true;
+}
+
+static void gb_outstanding_timeout(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct gb_outstanding *slot = CONTAINER_OF(dwork, struct gb_outstanding, timeout_work);
+	struct gb_outstanding_table *table = slot->table;
+	struct gb_outstanding_req req = {.operation_id = 0};
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&table->lock);
+	if (slot->req.operation_id != 0 && sys_timepoint_expired(slot->deadline)) {
+		req = gb_outstanding_take(slot);
+	}
+	k_spin_unlock(&table->lock, key);
+
+	if (req.operation_id == 0) {
+		return;
+	}
+
+	LOG_WRN("CPort %u: operation %u timed out", req.cport, req.operation_id);
+	table->complete(&req, NULL, -ETIMEDOUT);
+}
+
+void gb_outstanding_cancel_all(struct gb_outstanding_table *table)
+{
+	size_t i;
+	k_spinlock_key_t key;
+	struct gb_outstanding_req req;
+
+	for (i = 0; i < table->ops_num; ++i) {
+		req.operation_id = 0;
+
+		key = k_spin_lock(&table->lock);
+		if (table->ops[i].req.operation_id != 0) {
+			req = gb_outstanding_take(&table->ops[i]);
+		}
+		k_spin_unlock(&table->lock, key);
+
+		if (req.operation_id != 0) {
+			table->complete(&req, NULL, -ECANCELED);
+		}
+	}
+}
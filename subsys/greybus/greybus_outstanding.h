@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Tables of sent requests waiting for their response, shared by the requests the module sends to
+ * its AP and the requests hosts send to their modules.
+ */
+
+#ifndef _GREYBUS_OUTSTANDING_H_
+#define _GREYBUS_OUTSTANDING_H_
+
+#include <zephyr/kernel.h>
+#include <greybus/greybus_messages.h>
+#include "greybus_operation.h"
+#ifdef CONFIG_GREYBUS_HOST
+#include <greybus/greybus_host.h>
+#endif // CONFIG_GREYBUS_HOST
+
+/*
+ * @owner: host that sent the request, NULL for requests of the module
+ * @callback: callback of the request, called by the complete function of the table
+ * @user_data: user data of the callback
+ * @cport: CPort of the request
+ * @operation_id: operation id of the request. 0 if the slot is free.
+ */
+struct gb_outstanding_req {
+	void *owner;
+	union {
+		gb_operation_callback_t operation;
+#ifdef CONFIG_GREYBUS_HOST
+		gb_host_callback_t host;
+#endif // CONFIG_GREYBUS_HOST
+	} callback;
+	void *user_data;
+	uint16_t cport;
+	uint16_t operation_id;
+};
+
+struct gb_outstanding_table;
+
+/*
+ * @timeout_work: fails the request when it expires
+ * @deadline: expiry of the request. A timeout work item that is still running for a previous
+ *            request of the same slot must not fail a new one.
+ * @table: table of the slot
+ * @req: the request
+ */
+struct gb_outstanding {
+	struct k_work_delayable timeout_work;
+	k_timepoint_t deadline;
+	struct gb_outstanding_table *table;
+	struct gb_outstanding_req req;
+};
+
+/*
+ * @ops: slots
+ * @ops_num: number of slots
+ * @lock: protects the slots
+ * @complete: called once for every request, with its response or an error. Outside of the lock.
+ */
+struct gb_outstanding_table {
+	struct gb_outstanding *ops;
+	size_t ops_num;
+	struct k_spinlock lock;
+	void (*complete)(const struct gb_outstanding_req *req, struct gb_message *resp, int err);
+};
+
+/*
+ * Define a table of outstanding requests.
+ *
+ * @param _name Name of the table
+ * @param _num Maximum number of outstanding requests
+ * @param _complete Complete function of the table
+ */
+#define GB_OUTSTANDING_TABLE_DEFINE(_name, _num, _complete)                                        \
+	static struct gb_outstanding _name##_ops[_num];                                            \
+	static struct gb_outstanding_table _name = {                                               \
+		.ops = _name##_ops,                                                                \
+		.ops_num = _num,                                                                   \
+		.complete = _complete,                                                             \
+	}
+
+/**
+ * Initialize a table. All its requests must have been completed.
+ */
+void gb_outstanding_init(struct gb_outstanding_table *table);
+
+/**
+ * Track a request until its response arrives or the timeout expires. Must be called before the
+ * request is sent, the response can arrive before send returns.
+ *
+ * @return the slot of the request, NULL if the table is full.
+ */
+struct gb_outstanding *gb_outstanding_add(struct gb_outstanding_table *table,
+					  const struct gb_outstanding_req *req,
+					  k_timeout_t timeout);
+
+/**
+ * Stop tracking a request that could not be sent, without completing it. Nothing happens if the
+ * request was already completed.
+ */
+void gb_outstanding_remove(struct gb_outstanding_table *table, struct gb_outstanding *op,
+			   const struct gb_outstanding_req *req);
+
+/**
+ * Complete the request a response belongs to. Takes ownership of the response if it returns true.
+ *
+ * @return false if no request of @p owner on @p cport waits for the response.
+ */
+bool gb_outstanding_response(struct gb_outstanding_table *table, void *owner, uint16_t cport,
+			     struct gb_message *resp);
+
+/**
+ * Complete all requests of a table with -ECANCELED.
+ */
+void gb_outstanding_cancel_all(struct gb_outstanding_table *table);
+
+#endif // _GREYBUS_OUTSTANDING_H_
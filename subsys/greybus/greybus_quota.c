@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Quotas of the greybus heap. Messages held by a CPort, its queued requests and the messages
+ * allocated on its behalf, are charged to the CPort until they are freed. A CPort over its quota
+ * gets allocation failures right away instead of waiting for the heap, so a noisy bundle cannot
+ * take the heap from the control CPort and the other bundles.
+ */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <greybus-utils/manifest.h>
+#include "greybus_quota.h"
+#include "greybus_cport.h"
+
+LOG_MODULE_REGISTER(greybus_quota, CONFIG_GREYBUS_LOG_LEVEL);
+
+/* Bundles are numbered like in interface bundle masks */
+#define GB_QUOTA_BUNDLES 32
+
+BUILD_ASSERT(CONFIG_GREYBUS_CONTROL_RESERVED_BYTES < CONFIG_GREYBUS_HEAP_MEM_POOL_SIZE,
+	     "The control CPort reserve must leave heap for the other CPorts");
+
+/*
+ * @bytes: bytes charged
+ * @messages: messages charged
+ */
+struct gb_quota {
+	size_t bytes;
+	size_t messages;
+};
+
+static struct k_spinlock gb_quota_lock;
+static struct gb_quota gb_cport_quotas[GREYBUS_CPORT_COUNT];
+static size_t gb_bundle_bytes[GB_QUOTA_BUNDLES];
+/* Bytes charged to all CPorts but the control CPort */
+static size_t gb_quota_shared_bytes;
+
+static bool gb_quota_over(size_t used, size_t len, size_t limit)
+{
+	return limit != 0 && used + len > limit;
+}
+
+int gb_quota_charge(uint16_t cport, size_t len)
+{
+	const struct gb_cport *cport_ptr = gb_cport_get(cport);
+	struct gb_quota *quota;
+	k_spinlock_key_t key;
+	uint8_t bundle;
+	const size_t shared_limit =
+		CONFIG_GREYBUS_HEAP_MEM_POOL_SIZE - CONFIG_GREYBUS_CONTROL_RESERVED_BYTES;
+	int ret = 0;
+
+	if (!cport_ptr || cport == GB_CONTROL_CPORT_ID) {
+		return 0;
+	}
+
+	quota = &gb_cport_quotas[cport];
+	bundle = cport_ptr->bundle;
+
+	key = k_spin_lock(&gb_quota_lock);
+
+	if (gb_quota_over(quota->bytes, len, CONFIG_GREYBUS_CPORT_QUOTA_BYTES) ||
+	    gb_quota_over(quota->messages, 1, CONFIG_GREYBUS_CPORT_QUOTA_MESSAGES) ||
+	    (bundle < GB_QUOTA_BUNDLES &&
+	     gb_quota_over(gb_bundle_bytes[bundle], len, CONFIG_GREYBUS_BUNDLE_QUOTA_BYTES)) ||
+	    gb_quota_over(gb_quota_shared_bytes, len, shared_limit)) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	quota->bytes += len;
+	quota->messages++;
+	if (bundle < GB_QUOTA_BUNDLES) {
+		gb_bundle_bytes[bundle] += len;
+	}
+	gb_quota_shared_bytes += len;
+
+unlock:
+	k_spin_unlock(&gb_quota_lock, key);
+
+	if (ret < 0) {
+		LOG_DBG("CPort %u over quota, %zu bytes refused", cport, len);
+	}
+
+	return ret;
+}
+
+void gb_quota_uncharge(uint16_t cport, size_t len)
+{
+	const struct gb_cport *cport_ptr = gb_cport_get(cport);
+	struct gb_quota *quota;
+	k_spinlock_key_t key;
+
+	if (!cport_ptr || cport == GB_CONTROL_CPORT_ID) {
+		return;
+	}
+
+	quota = &gb_cport_quotas[cport];
+
+	key = k_spin_lock(&gb_quota_lock);
+
+	quota->bytes -= len;
+	quota->messages--;
+	if (cport_ptr->bundle < GB_QUOTA_BUNDLES) {
+		gb_bundle_bytes[cport_ptr->bundle] -= len;
+	}
+	gb_quota_shared_bytes -= len;
+
+	k_spin_unlock(&gb_quota_lock, key);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Quotas of the greybus heap per CPort and per bundle, with a share reserved for the control CPort.
+ */
+
+#ifndef _GREYBUS_QUOTA_H_
+#define _GREYBUS_QUOTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <greybus/greybus_messages.h>
+
+/* CPort of messages not charged to any quota */
+#define GB_QUOTA_NONE UINT16_MAX
+
+/*
+ * Account bytes of the greybus heap and one message to a CPort and its bundle. The control CPort
+ * has no quota. Never blocks, so it works from ISR.
+ *
+ * @return 0 on success, -ENOMEM if the CPort, its bundle, or the CPorts other than the control
+ *         CPort together are over their quota.
+ */
+int gb_quota_charge(uint16_t cport, size_t len);
+
+/*
+ * Give back what gb_quota_charge took.
+ */
+void gb_quota_uncharge(uint16_t cport, size_t len);
+
+/*
+ * Charge a received message to a CPort until it is freed, including the response built in its
+ * buffer. A message charged to another CPort, e.g. by the transport before the CPort was
+ * renumbered, moves to this one. Messages not allocated from the greybus heap are not charged.
+ *
+ * @return 0 on success, -ENOMEM if the CPort is over its quota.
+ */
+int gb_message_charge(struct gb_message *msg, uint16_t cport);
+
+#endif // _GREYBUS_QUOTA_H_
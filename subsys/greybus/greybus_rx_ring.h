@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Lock-free single producer, single consumer ring of received greybus messages.
+ */
+
+#ifndef _GREYBUS_RX_RING_H_
+#define _GREYBUS_RX_RING_H_
+
+#include <zephyr/kernel.h>
+#include <greybus/greybus_messages.h>
+
+#define GB_RX_RING_SIZE CONFIG_GREYBUS_CPORT_RX_QUEUE_DEPTH
+
+BUILD_ASSERT(IS_POWER_OF_TWO(GB_RX_RING_SIZE), "Ring size must be a power of 2");
+
+/*
+ * Indices run over twice the ring size, so that a full ring (head and tail differ only in the
+ * wrap bit) can be told apart from an empty one (head == tail).
+ */
+#define GB_RX_RING_INDEX_MASK (2 * GB_RX_RING_SIZE - 1)
+
+/*
+ * @head: next slot to consume. Only written by the consumer.
+ * @tail: next slot to produce. Only written by the producer.
+ * @msgs: message slots
+ */
+struct gb_rx_ring {
+	atomic_t head;
+	atomic_t tail;
+	struct gb_message *msgs[GB_RX_RING_SIZE];
+};
+
+static inline void gb_rx_ring_init(struct gb_rx_ring *ring)
+{
+	atomic_set(&ring->head, 0);
+	atomic_set(&ring->tail, 0);
+}
+
+/*
+ * Number of messages available to the consumer.
+ */
+static inline size_t gb_rx_ring_used(struct gb_rx_ring *ring)
+{
+	return (atomic_get(&ring->tail) - atomic_get(&ring->head)) & GB_RX_RING_INDEX_MASK;
+}
+
+/*
+ * Add a message to the ring. Must only be called by one producer at a time.
+ *
+ * @return true on success, false if the ring is full.
+ */
+static inline bool gb_rx_ring_put(struct gb_rx_ring *ring, struct gb_message *msg)
+{
+	atomic_val_t tail = atomic_get(&ring->tail);
+
+	if (((tail - atomic_get(&ring->head)) & GB_RX_RING_INDEX_MASK) == GB_RX_RING_SIZE) {
+		return false;
+	}
+
+	ring->msgs[tail & (GB_RX_RING_SIZE - 1)] = msg;
+	/* Publish the slot only after it has been written */
+	atomic_set(&ring->tail, (tail + 1) & GB_RX_RING_INDEX_MASK);
+
+	return true;
+}
+
+/*
+ * Remove the oldest message from the ring. Must only be called by the consumer.
+ *
+ * @return the message, or NULL if the ring is empty.
+ */
+static inline struct gb_message *gb_rx_ring_get(struct gb_rx_ring *ring)
+{
+	struct gb_message *msg;
+	atomic_val_t head = atomic_get(&ring->head);
+
+	if (head == atomic_get(&ring->tail)) {
+		return NULL;
+	}
+
+	msg = ring->msgs[head & (GB_RX_RING_SIZE - 1)];
+	atomic_set(&ring->head, (head + 1) & GB_RX_RING_INDEX_MASK);
+
+	return msg;
+}
+
+#endif // _GREYBUS_RX_RING_H_
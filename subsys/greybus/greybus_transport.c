@@ -2,20 +2,162 @@
 /*
  * Copyright (c) 2025 Ayush Singh BeagleBoard.org
  *
- * This file contains some common functions for all greybus transports. Probably will remove this in
- * future since I don't see much point in making transports a vtable.
+ * This file contains some common functions for all greybus transports, and routes messages
+ * between the transports greybus runs on.
  */
 
 #include "greybus_transport.h"
+#include "greybus_cport.h"
 #include "greybus/greybus.h"
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG
+#include "greybus_watchdog.h"
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG
+#ifdef CONFIG_GREYBUS_INTERFACES
+#include "greybus_interface.h"
+#endif // CONFIG_GREYBUS_INTERFACES
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_REGISTER(greybus_transport_common, CONFIG_GREYBUS_LOG_LEVEL);
 
-int gb_transport_message_send(const struct gb_message *msg, uint16_t cport)
+/* Transports greybus runs on. The id of a transport is its index, unused slots are NULL. */
+static const struct gb_transport_backend *gb_transports[CONFIG_GREYBUS_TRANSPORTS_MAX];
+
+int gb_transports_start(const struct gb_transport_backend *const *transports, size_t num)
+{
+	size_t i;
+	int ret;
+
+	if (num == 0 || num > ARRAY_SIZE(gb_transports)) {
+		return -EINVAL;
+	}
+
+	/* A backend can deliver messages as soon as its init started the receive thread */
+	for (i = 0; i < num; ++i) {
+		gb_transports[i] = transports[i];
+	}
+
+	for (i = 0; i < num; ++i) {
+		ret = transports[i]->init();
+		if (ret < 0) {
+			LOG_ERR("Failed to initialize transport %zu: error %d", i, ret);
+			break;
+		}
+	}
+
+	if (i == num) {
+		return 0;
+	}
+
+	while (i-- > 0) {
+		if (transports[i]->exit) {
+			transports[i]->exit();
+		}
+	}
+	memset(gb_transports, 0, sizeof(gb_transports));
+
+	return ret;
+}
+
+void gb_transports_stop(void)
+{
+	size_t i = ARRAY_SIZE(gb_transports);
+
+	while (i-- > 0) {
+		if (gb_transports[i] && gb_transports[i]->exit) {
+			gb_transports[i]->exit();
+		}
+	}
+
+	memset(gb_transports, 0, sizeof(gb_transports));
+}
+
+const struct gb_transport_backend *gb_transport_get(uint8_t id)
+{
+	return (id < ARRAY_SIZE(gb_transports)) ? gb_transports[id] : NULL;
+}
+
+int gb_transport_id(const struct gb_transport_backend *transport)
+{
+	size_t i;
+
+	for (i = 0; transport && i < ARRAY_SIZE(gb_transports); ++i) {
+		if (gb_transports[i] == transport) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Checks shared by all sends, and the CPort the AP of the transport knows the CPort as. Only the
+ * header of the message is read.
+ *
+ * @return the backend to send on, or NULL with @ret set if the message must not be sent.
+ */
+static const struct gb_transport_backend *gb_transport_send_check(uint8_t transport,
+								  const struct gb_message *msg,
+								  uint16_t *cport, int *ret)
+{
+	const struct gb_transport_backend *transport_backend = gb_transport_get(transport);
+	struct gb_cport *cport_ptr = gb_cport_get(*cport);
+
+	/* AP is not listening on CPorts it did not connect */
+	if (cport_ptr && !gb_cport_msg_allowed(cport_ptr, msg)) {
+		LOG_DBG("CPort %u not connected, dropping message of type %u", *cport,
+			gb_message_type(msg));
+		*ret = -ENOTCONN;
+		return NULL;
+	}
+
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG
+	/* AP already got GB_OP_TIMEOUT for the operation */
+	if (!gb_op_watch_msg_allowed(msg, *cport)) {
+		LOG_DBG("CPort %u: dropping late response to operation %u", *cport,
+			msg->header.operation_id);
+		*ret = 0;
+		return NULL;
+	}
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG
+
+	if (!transport_backend) {
+		LOG_DBG("Transport %u not running, dropping message of type %u", transport,
+			gb_message_type(msg));
+		*ret = -ENODEV;
+		return NULL;
+	}
+
+#ifdef CONFIG_GREYBUS_INTERFACES
+	/* The AP of an interface numbers CPorts its own way */
+	*ret = gb_interface_cport(transport_backend, *cport);
+	if (*ret < 0) {
+		LOG_DBG("CPort %u not part of the interface of transport %u, dropping message",
+			*cport, transport);
+		return NULL;
+	}
+	*cport = *ret;
+#endif // CONFIG_GREYBUS_INTERFACES
+
+	return transport_backend;
+}
+
+int gb_transport_message_send_on(uint8_t transport, const struct gb_message *msg, uint16_t cport)
 {
-	int retval;
-	const struct gb_transport_backend *transport_backend = gb_transport_get_backend();
+	int retval = 0;
+	const struct gb_transport_backend *transport_backend;
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+	struct gb_cport *cport_ptr = gb_cport_get(cport);
+
+	/* Kept until AP connects the CPort again, or until the journal is replayed */
+	if (cport_ptr && gb_journal_capture(&cport_ptr->journal, msg)) {
+		return 0;
+	}
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
+
+	transport_backend = gb_transport_send_check(transport, msg, &cport, &retval);
+	if (!transport_backend) {
+		return retval;
+	}
 
 	retval = transport_backend->send(cport, msg);
 	if (retval) {
@@ -24,3 +166,110 @@ int gb_transport_message_send(const struct gb_message *msg, uint16_t cport)
 
 	return retval;
 }
+
+/*
+ * Send a message given as pieces on a backend without send_iov. Small messages are assembled on
+ * the stack.
+ */
+static int gb_transport_message_send_assembled(uint8_t transport,
+					       const struct gb_operation_msg_hdr *hdr,
+					       const struct gb_iovec *iov, size_t iov_num,
+					       uint16_t cport)
+{
+	uint8_t buf[sizeof(struct gb_message) + CONFIG_GREYBUS_STATIC_RESPONSE_MAX_SIZE] __aligned(
+		__alignof__(struct gb_message));
+	size_t payload_len = gb_hdr_payload_len(hdr);
+	struct gb_message *msg = (struct gb_message *)buf;
+	size_t i, off = 0;
+	int ret;
+
+	if (payload_len > CONFIG_GREYBUS_STATIC_RESPONSE_MAX_SIZE) {
+		msg = gb_message_alloc(payload_len, hdr->type, hdr->operation_id, hdr->result);
+		if (!msg) {
+			return -ENOMEM;
+		}
+	}
+
+	memcpy(&msg->header, hdr, sizeof(*hdr));
+	for (i = 0; i < iov_num; ++i) {
+		memcpy(msg->payload + off, iov[i].base, iov[i].len);
+		off += iov[i].len;
+	}
+
+	ret = gb_transport_message_send_on(transport, msg, cport);
+
+	if (msg != (struct gb_message *)buf) {
+		gb_message_dealloc(msg);
+	}
+
+	return ret;
+}
+
+int gb_transport_message_send_iov(const struct gb_operation_msg_hdr *hdr,
+				  const struct gb_iovec *iov, size_t iov_num, uint16_t cport)
+{
+	/* Only the header is read by the checks */
+	const struct gb_message *msg = (const struct gb_message *)hdr;
+	const struct gb_transport_backend *transport_backend;
+	const struct gb_cport *cport_ptr = gb_cport_get(cport);
+	uint8_t transport = 0;
+	size_t i, len = 0;
+	int retval = 0;
+
+	for (i = 0; i < iov_num; ++i) {
+		len += iov[i].len;
+	}
+
+	if (len != gb_hdr_payload_len(hdr)) {
+		return -EINVAL;
+	}
+
+	if (cport_ptr) {
+		transport = gb_hdr_is_response(hdr) ? cport_ptr->rx_transport
+						    : cport_ptr->transport;
+	}
+
+	transport_backend = gb_transport_get(transport);
+
+	/* The journal keeps whole requests */
+	if (!transport_backend || !transport_backend->send_iov ||
+	    (IS_ENABLED(CONFIG_GREYBUS_EVENT_JOURNAL) && !gb_hdr_is_response(hdr))) {
+		return gb_transport_message_send_assembled(transport, hdr, iov, iov_num, cport);
+	}
+
+	transport_backend = gb_transport_send_check(transport, msg, &cport, &retval);
+	if (!transport_backend) {
+		return retval;
+	}
+
+	retval = transport_backend->send_iov(cport, hdr, iov, iov_num);
+	if (retval) {
+		LOG_ERR("Greybus backend failed to send: error %d", retval);
+	}
+
+	return retval;
+}
+
+int gb_transport_message_send(const struct gb_message *msg, uint16_t cport)
+{
+	const struct gb_cport *cport_ptr = gb_cport_get(cport);
+	uint8_t transport = 0;
+
+	if (cport_ptr) {
+		transport = gb_message_is_response(msg) ? cport_ptr->rx_transport
+							: cport_ptr->transport;
+	}
+
+	return gb_transport_message_send_on(transport, msg, cport);
+}
+
+void gb_transport_flush(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(gb_transports); ++i) {
+		if (gb_transports[i] && gb_transports[i]->flush) {
+			gb_transports[i]->flush();
+		}
+	}
+}
@@ -7,13 +7,64 @@
 #ifndef _GREYBUS_TRANSPORT_H_
 #define _GREYBUS_TRANSPORT_H_
 
+#include <string.h>
+#include <greybus/greybus.h>
 #include <greybus/greybus_messages.h>
 
-extern const struct gb_transport_backend gb_trans_backend;
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP
+extern const struct gb_transport_backend gb_trans_tcpip;
+#endif // CONFIG_GREYBUS_XPORT_TCPIP
+#ifdef CONFIG_GREYBUS_XPORT_DUMMY
+extern const struct gb_transport_backend gb_trans_dummy;
+#endif // CONFIG_GREYBUS_XPORT_DUMMY
+
+/**
+ * Initialize transport backends and make them available for routing. The id of a transport is its
+ * index in @p transports.
+ *
+ * @return 0 on success, -EINVAL if there are no transports or more than
+ *         CONFIG_GREYBUS_TRANSPORTS_MAX, or the error of a backend init. Nothing is left running
+ *         on error.
+ */
+int gb_transports_start(const struct gb_transport_backend *const *transports, size_t num);
+
+/**
+ * De-initialize all transport backends.
+ */
+void gb_transports_stop(void);
+
+/**
+ * Get a running transport backend.
+ *
+ * @return the backend, or NULL if no transport runs with this id.
+ */
+const struct gb_transport_backend *gb_transport_get(uint8_t id);
+
+/**
+ * Get the id of a running transport backend.
+ *
+ * @return the id, or -ENOENT if the backend does not run.
+ */
+int gb_transport_id(const struct gb_transport_backend *transport);
+
+/**
+ * Send message to AP, on the given transport.
+ *
+ * This function does not take ownership over the message. Hence it is the caller's responsibility
+ * to cleanup.
+ *
+ * @param transport Transport id
+ * @param msg
+ * @param cport
+ */
+int gb_transport_message_send_on(uint8_t transport, const struct gb_message *msg, uint16_t cport);
 
 /**
  * Send message to AP.
  *
+ * Responses go back on the transport their request arrived on. Other messages go to the transport
+ * of the AP that connected the CPort.
+ *
  * This function does not take ownership over the message. Hence it is the caller's responsibility
  * to cleanup.
  *
@@ -23,7 +74,30 @@ extern const struct gb_transport_backend gb_trans_backend;
 int gb_transport_message_send(const struct gb_message *msg, uint16_t cport);
 
 /**
- * Helper to allocate and send success response
+ * Send a message made of a header and payload pieces, routed like gb_transport_message_send.
+ *
+ * Backends with send_iov get the pieces as they are, so payloads on the stack or in flash are sent
+ * without being copied into a message. The message is assembled for other backends.
+ *
+ * @param hdr Message header. Its size must cover all pieces.
+ * @param iov Payload pieces
+ * @param iov_num Number of pieces
+ * @param cport
+ *
+ * @return 0 on success, -EINVAL if the size of the header does not match the pieces, or the error
+ *         of gb_transport_message_send.
+ */
+int gb_transport_message_send_iov(const struct gb_operation_msg_hdr *hdr,
+				  const struct gb_iovec *iov, size_t iov_num, uint16_t cport);
+
+/**
+ * Send messages the transport backends staged, at the end of a batch of operations.
+ */
+void gb_transport_flush(void);
+
+/**
+ * Helper to send success response. The payload is sent from where it is, no response is
+ * allocated.
  *
  * NOTE: This will dealloc request message.
  *
@@ -35,16 +109,20 @@ static inline void gb_transport_message_response_success_send(struct gb_message
 							      const void *payload,
 							      size_t payload_len, uint16_t cport)
 {
-	/* Very low chance of allocation failure. However, if it happens, the only thing we can do
-	 * is either busy wait or drop the message. Choosing to drop for now. */
-	struct gb_message *resp =
-		gb_message_response_alloc_from_req(payload, payload_len, req, GB_OP_SUCCESS);
-	if (resp) {
-		gb_transport_message_send(resp, cport);
-	}
+	const struct gb_operation_msg_hdr hdr = {
+		.size = sys_cpu_to_le16(sizeof(struct gb_message) + payload_len),
+		.operation_id = req->header.operation_id,
+		.type = GB_RESPONSE(req->header.type),
+		.result = GB_OP_SUCCESS,
+		.pad = {0, 0},
+	};
+	const struct gb_iovec iov = {
+		.base = payload,
+		.len = payload_len,
+	};
 
+	gb_transport_message_send_iov(&hdr, &iov, 1, cport);
 	gb_message_dealloc(req);
-	gb_message_dealloc(resp);
 }
 
 /**
@@ -74,12 +152,4 @@ static inline void gb_transport_message_empty_response_send(struct gb_message *r
 	gb_message_dealloc(req);
 }
 
-/**
- * Get the current greybus transport backend
- */
-static inline const struct gb_transport_backend *gb_transport_get_backend(void)
-{
-	return &gb_trans_backend;
-}
-
 #endif // _GREYBUS_TRANSPORT_H_
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * Reports operation handlers that run longer than the budget of their protocol, and optionally
+ * answers them with GB_OP_TIMEOUT so that AP does not wait for them.
+ */
+
+#include "greybus_watchdog.h"
+#include "greybus_transport.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(greybus_watchdog, CONFIG_GREYBUS_LOG_LEVEL);
+
+/* Handlers that are currently executing */
+static sys_slist_t gb_op_watches = SYS_SLIST_STATIC_INIT(&gb_op_watches);
+static struct k_spinlock gb_op_watch_lock;
+
+static void gb_op_watch_expired(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct gb_op_watch *watch = CONTAINER_OF(dwork, struct gb_op_watch, work);
+	const struct gb_message resp = {
+		.header =
+			{
+				.size = sys_cpu_to_le16(sizeof(struct gb_message)),
+				.operation_id = watch->operation_id,
+				.pad = {0, 0},
+				.type = GB_RESPONSE(watch->type),
+				.result = GB_OP_TIMEOUT,
+			},
+	};
+	k_spinlock_key_t key;
+
+	LOG_ERR("CPort %u: operation %u of type %u over budget, running for %u cycles",
+		watch->cport, watch->operation_id, watch->type, k_cycle_get_32() - watch->start);
+
+	if (!IS_ENABLED(CONFIG_GREYBUS_OPERATION_WATCHDOG_ABORT) || !watch->abortable) {
+		return;
+	}
+
+	/* From now on, only this response gets through for the operation */
+	key = k_spin_lock(&gb_op_watch_lock);
+	watch->aborted = true;
+	watch->abort_resp = &resp;
+	k_spin_unlock(&gb_op_watch_lock, key);
+
+	gb_transport_message_send(&resp, watch->cport);
+	gb_transport_flush();
+
+	key = k_spin_lock(&gb_op_watch_lock);
+	watch->abort_resp = NULL;
+	k_spin_unlock(&gb_op_watch_lock, key);
+}
+
+void gb_op_watch_start(struct gb_op_watch *watch, const struct gb_driver *drv,
+		       const struct gb_operation_handler *handler, const struct gb_message *req,
+		       uint16_t cport)
+{
+	k_spinlock_key_t key;
+	uint32_t budget_ms = drv->op_budget_ms ? drv->op_budget_ms
+					       : CONFIG_GREYBUS_OPERATION_BUDGET_MS;
+
+	watch->start = k_cycle_get_32();
+	watch->abort_resp = NULL;
+	watch->aborted = false;
+	watch->cport = cport;
+	watch->operation_id = req->header.operation_id;
+	watch->type = gb_message_type(req);
+	watch->abortable =
+		req->header.operation_id != 0 && !(handler->flags & GB_HANDLER_F_UNIDIRECTIONAL);
+
+	key = k_spin_lock(&gb_op_watch_lock);
+	sys_slist_append(&gb_op_watches, &watch->node);
+	k_spin_unlock(&gb_op_watch_lock, key);
+
+	k_work_init_delayable(&watch->work, gb_op_watch_expired);
+	k_work_schedule(&watch->work, K_MSEC(budget_ms));
+}
+
+void gb_op_watch_stop(struct gb_op_watch *watch)
+{
+	struct k_work_sync sync;
+	k_spinlock_key_t key;
+
+	/* The watch lives on the stack of the caller, the work must be done with it */
+	k_work_cancel_delayable_sync(&watch->work, &sync);
+
+	key = k_spin_lock(&gb_op_watch_lock);
+	sys_slist_find_and_remove(&gb_op_watches, &watch->node);
+	k_spin_unlock(&gb_op_watch_lock, key);
+
+	if (watch->aborted) {
+		LOG_WRN("CPort %u: aborted operation %u returned after %u cycles", watch->cport,
+			watch->operation_id, k_cycle_get_32() - watch->start);
+	}
+}
+
+bool gb_op_watch_msg_allowed(const struct gb_message *msg, uint16_t cport)
+{
+	struct gb_op_watch *watch;
+	k_spinlock_key_t key;
+	bool allowed = true;
+
+	if (!gb_message_is_response(msg)) {
+		return true;
+	}
+
+	key = k_spin_lock(&gb_op_watch_lock);
+	SYS_SLIST_FOR_EACH_CONTAINER(&gb_op_watches, watch, node) {
+		if (watch->aborted && watch->abort_resp != msg && watch->cport == cport &&
+		    watch->operation_id == msg->header.operation_id) {
+			allowed = false;
+			break;
+		}
+	}
+	k_spin_unlock(&gb_op_watch_lock, key);
+
+	return allowed;
+}
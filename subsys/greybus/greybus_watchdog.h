@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2025 Ayush Singh BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Execution time budgets of operation handlers.
+ */
+
+#ifndef _GREYBUS_WATCHDOG_H_
+#define _GREYBUS_WATCHDOG_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/slist.h>
+#include "greybus_internal.h"
+
+/*
+ * An operation handler being executed. Lives on the stack of the dispatching thread, or in the
+ * deferred operation of the CPort until it is completed.
+ *
+ * @node: entry in the list of watched operations
+ * @work: fires when the budget is exhausted
+ * @start: cycle count when the handler was called
+ * @abort_resp: timeout response while the watchdog is sending it
+ * @cport: CPort of the request
+ * @operation_id: operation id of the request
+ * @type: type of the request
+ * @abortable: the request expects a response
+ * @aborted: the request was answered with GB_OP_TIMEOUT by the watchdog
+ */
+struct gb_op_watch {
+	sys_snode_t node;
+	struct k_work_delayable work;
+	uint32_t start;
+	const struct gb_message *abort_resp;
+	uint16_t cport;
+	uint16_t operation_id;
+	uint8_t type;
+	bool abortable;
+	bool aborted;
+};
+
+/**
+ * Start watching a request handler. Must be followed by gb_op_watch_stop once the handler returns.
+ *
+ * @param watch
+ * @param drv Driver of the CPort, gives the budget
+ * @param handler Handler of the request
+ * @param req Request. Only read here, the handler is free to release it.
+ * @param cport
+ */
+void gb_op_watch_start(struct gb_op_watch *watch, const struct gb_driver *drv,
+		       const struct gb_operation_handler *handler, const struct gb_message *req,
+		       uint16_t cport);
+
+/**
+ * Stop watching a request handler that returned.
+ */
+void gb_op_watch_stop(struct gb_op_watch *watch);
+
+/**
+ * Check if a message can be sent. Responses of operations that were already answered with
+ * GB_OP_TIMEOUT by the watchdog are not.
+ */
+bool gb_op_watch_msg_allowed(const struct gb_message *msg, uint16_t cport);
+
+#endif // _GREYBUS_WATCHDOG_H_
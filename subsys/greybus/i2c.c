@@ -34,53 +34,271 @@
 #include <zephyr/sys/byteorder.h>
 #include <zephyr/logging/log.h>
 #include "greybus_transport.h"
+#include "greybus_operation.h"
+#include "greybus_heap.h"
 #include "greybus_internal.h"
 
 LOG_MODULE_REGISTER(greybus_i2c, CONFIG_GREYBUS_LOG_LEVEL);
 
-static void gb_i2c_protocol_functionality(uint16_t cport, struct gb_message *req)
+static const struct gb_i2c_functionality_response gb_i2c_functionality = {
+	.functionality = GB_I2C_FUNC_I2C | GB_I2C_FUNC_SMBUS_READ_BYTE |
+			 GB_I2C_FUNC_SMBUS_WRITE_BYTE | GB_I2C_FUNC_SMBUS_READ_BYTE_DATA |
+			 GB_I2C_FUNC_SMBUS_WRITE_BYTE_DATA | GB_I2C_FUNC_SMBUS_READ_WORD_DATA |
+			 GB_I2C_FUNC_SMBUS_WRITE_WORD_DATA | GB_I2C_FUNC_SMBUS_READ_I2C_BLOCK |
+			 GB_I2C_FUNC_SMBUS_WRITE_I2C_BLOCK,
+};
+
+#ifdef CONFIG_I2C_CALLBACK
+/*
+ * State of a transfer running in the background.
+ *
+ * @work: completes the operation in thread context
+ * @op: the deferred operation
+ * @result: result of the transfer
+ * @read_len: number of bytes read
+ * @read_data: buffer for the read data
+ * @msgs: messages of the transfer
+ */
+struct gb_i2c_async_transfer {
+	struct k_work work;
+	struct gb_operation *op;
+	int result;
+	size_t read_len;
+	uint8_t *read_data;
+	struct i2c_msg msgs[];
+};
+
+static void gb_i2c_async_transfer_work(struct k_work *work)
+{
+	struct gb_i2c_async_transfer *xfer = CONTAINER_OF(work, struct gb_i2c_async_transfer, work);
+
+	if (xfer->result < 0) {
+		LOG_ERR("Failed to transfer i2c data: %d", xfer->result);
+		gb_operation_complete(xfer->op, gb_errno_to_op_result(xfer->result), NULL, 0);
+	} else {
+		gb_operation_complete(xfer->op, GB_OP_SUCCESS, xfer->read_data, xfer->read_len);
+	}
+
+	gb_free(xfer);
+}
+
+/* Called from ISR by most drivers */
+static void gb_i2c_async_transfer_cb(const struct device *dev, int result, void *data)
+{
+	struct gb_i2c_async_transfer *xfer = data;
+
+	ARG_UNUSED(dev);
+
+	xfer->result = result;
+	k_work_submit(&xfer->work);
+}
+
+/*
+ * Start the transfer as a single I2C transaction and complete the operation from the transfer
+ * callback, so the worker can serve other CPorts in the meantime.
+ *
+ * @return 0 if the operation was deferred, or a negative error if the transfer needs to be done
+ *         synchronously.
+ */
+static int gb_i2c_protocol_transfer_async(uint16_t cport, struct gb_message *req,
+					  const struct device *dev, size_t resp_size)
+{
+	size_t i;
+	int ret;
+	uint8_t *write_data, *read_data;
+	const struct gb_i2c_transfer_op *desc;
+	struct gb_i2c_async_transfer *xfer;
+	const struct gb_i2c_transfer_request *req_data =
+		(const struct gb_i2c_transfer_request *)req->payload;
+	uint16_t op_count = sys_le16_to_cpu(req_data->op_count);
+	const struct i2c_driver_api *api = (const struct i2c_driver_api *)dev->api;
+
+	if (!api->transfer_cb) {
+		return -ENOTSUP;
+	}
+
+	/* A transaction only has a single address */
+	for (i = 1; i < op_count; i++) {
+		if (req_data->ops[i].addr != req_data->ops[0].addr) {
+			return -ENOTSUP;
+		}
+	}
+
+	if (op_count == 0 || op_count > UINT8_MAX) {
+		return -ENOTSUP;
+	}
+
+	xfer = gb_alloc(sizeof(*xfer) + op_count * sizeof(struct i2c_msg) + resp_size);
+	if (!xfer) {
+		return -ENOMEM;
+	}
+
+	k_work_init(&xfer->work, gb_i2c_async_transfer_work);
+	xfer->read_len = resp_size;
+	xfer->read_data = (uint8_t *)&xfer->msgs[op_count];
+
+	write_data = (uint8_t *)&req_data->ops[op_count];
+	read_data = xfer->read_data;
+	for (i = 0; i < op_count; i++) {
+		desc = &req_data->ops[i];
+		xfer->msgs[i].len = sys_le16_to_cpu(desc->size);
+
+		if (desc->flags & GB_I2C_M_RD) {
+			xfer->msgs[i].buf = read_data;
+			xfer->msgs[i].flags = I2C_MSG_READ;
+			read_data += xfer->msgs[i].len;
+		} else {
+			xfer->msgs[i].buf = write_data;
+			xfer->msgs[i].flags = I2C_MSG_WRITE;
+			write_data += xfer->msgs[i].len;
+		}
+
+		if (i > 0) {
+			xfer->msgs[i].flags |= I2C_MSG_RESTART;
+		}
+	}
+	xfer->msgs[op_count - 1].flags |= I2C_MSG_STOP;
+
+	/* The request must stay alive for the write data */
+	xfer->op = gb_operation_defer(req, cport);
+
+	ret = i2c_transfer_cb(dev, xfer->msgs, op_count, sys_le16_to_cpu(req_data->ops[0].addr),
+			      gb_i2c_async_transfer_cb, xfer);
+	if (ret < 0) {
+		xfer->result = ret;
+		gb_i2c_async_transfer_work(&xfer->work);
+	}
+
+	return 0;
+}
+#endif // CONFIG_I2C_CALLBACK
+
+/*
+ * The read data can go to the front of the request payload, turning the request into the response,
+ * if no read overwrites a descriptor or write data that is still to be used.
+ */
+static bool gb_i2c_read_in_place(const struct gb_i2c_transfer_request *req_data,
+				 uint16_t op_count)
+{
+	const struct gb_i2c_transfer_op *desc;
+	size_t i, live, read_end = 0;
+	size_t write_pos = sizeof(*req_data) + op_count * sizeof(*desc);
+	size_t write_end = write_pos;
+
+	for (i = 0; i < op_count; i++) {
+		desc = &req_data->ops[i];
+		if (!(desc->flags & GB_I2C_M_RD)) {
+			write_end += sys_le16_to_cpu(desc->size);
+		}
+	}
+
+	for (i = 0; i < op_count; i++) {
+		desc = &req_data->ops[i];
+		if (!(desc->flags & GB_I2C_M_RD)) {
+			write_pos += sys_le16_to_cpu(desc->size);
+			continue;
+		}
+
+		/* The descriptor of the read itself is done with once the read starts */
+		live = (write_pos < write_end) ? write_pos : SIZE_MAX;
+		if (i + 1 < op_count) {
+			live = MIN(live, sizeof(*req_data) + (i + 1) * sizeof(*desc));
+		}
+
+		read_end += sys_le16_to_cpu(desc->size);
+		if (read_end > live) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * The core only checks the fixed part of the request. The descriptors and the write data must be in
+ * the payload, and the read data must fit in a response.
+ *
+ * @return size of the response payload, or -EINVAL if the request is malformed.
+ */
+static int gb_i2c_transfer_check(const struct gb_message *req, uint16_t op_count)
 {
-	const struct gb_i2c_functionality_response resp_data = {
-		.functionality =
-			GB_I2C_FUNC_I2C | GB_I2C_FUNC_SMBUS_READ_BYTE |
-			GB_I2C_FUNC_SMBUS_WRITE_BYTE | GB_I2C_FUNC_SMBUS_READ_BYTE_DATA |
-			GB_I2C_FUNC_SMBUS_WRITE_BYTE_DATA | GB_I2C_FUNC_SMBUS_READ_WORD_DATA |
-			GB_I2C_FUNC_SMBUS_WRITE_WORD_DATA | GB_I2C_FUNC_SMBUS_READ_I2C_BLOCK |
-			GB_I2C_FUNC_SMBUS_WRITE_I2C_BLOCK,
-	};
-
-	gb_transport_message_response_success_send(req, &resp_data, sizeof(resp_data), cport);
+	const struct gb_i2c_transfer_request *req_data =
+		(const struct gb_i2c_transfer_request *)req->payload;
+	const struct gb_i2c_transfer_op *desc;
+	size_t i, op_size, resp_size = 0;
+	size_t left = gb_message_payload_len(req);
+
+	if (left < sizeof(*req_data) + op_count * sizeof(*desc)) {
+		return -EINVAL;
+	}
+	left -= sizeof(*req_data) + op_count * sizeof(*desc);
+
+	for (i = 0; i < op_count; i++) {
+		desc = &req_data->ops[i];
+		op_size = sys_le16_to_cpu(desc->size);
+
+		if (desc->flags & GB_I2C_M_RD) {
+			if (op_size > UINT16_MAX - sizeof(struct gb_message) - resp_size) {
+				return -EINVAL;
+			}
+			resp_size += op_size;
+		} else {
+			if (op_size > left) {
+				return -EINVAL;
+			}
+			left -= op_size;
+		}
+	}
+
+	return resp_size;
 }
 
-static void gb_i2c_protocol_transfer(uint16_t cport, struct gb_message *req,
-				     const struct device *dev)
+static void gb_i2c_protocol_transfer(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct device *dev = priv;
 	const struct gb_i2c_transfer_op *desc;
 	const uint8_t *write_data;
 	uint8_t *read_data;
 	const struct gb_i2c_transfer_request *req_data =
 		(const struct gb_i2c_transfer_request *)req->payload;
 	struct gb_message *resp;
-	size_t i, resp_size = 0;
+	size_t i;
 	uint16_t op_size, addr, op_count;
-	int ret;
+	bool in_place;
+	int ret, resp_size;
 
 	op_count = sys_le16_to_cpu(req_data->op_count);
-	write_data = (const uint8_t *)&req_data->ops[op_count];
 
-	for (i = 0; i < op_count; i++) {
-		desc = &req_data->ops[i];
-		if (desc->flags & GB_I2C_M_RD) {
-			resp_size += sys_le16_to_cpu(desc->size);
-		}
+	resp_size = gb_i2c_transfer_check(req, op_count);
+	if (resp_size < 0) {
+		LOG_ERR("Operations do not match the request size");
+		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
+	}
+
+#ifdef CONFIG_I2C_CALLBACK
+	if (gb_i2c_protocol_transfer_async(cport, req, dev, resp_size) == 0) {
+		return;
+	}
+#endif // CONFIG_I2C_CALLBACK
+
+	in_place = gb_i2c_read_in_place(req_data, op_count);
+	if (in_place) {
+		resp = gb_message_response_in_place(req, resp_size, GB_OP_SUCCESS);
+	} else {
+		resp = gb_message_alloc_cport(cport, resp_size, GB_RESPONSE(req->header.type),
+					      req->header.operation_id, GB_OP_SUCCESS);
 	}
 
-	resp = gb_message_alloc(resp_size, GB_RESPONSE(req->header.type), req->header.operation_id,
-				GB_OP_SUCCESS);
 	if (!resp) {
 		LOG_ERR("Failed to allocate response");
 		return gb_transport_message_empty_response_send(req, GB_OP_NO_MEMORY, cport);
 	}
+
+	/* The request may have moved to a larger buffer */
+	if (in_place) {
+		req_data = (const struct gb_i2c_transfer_request *)resp->payload;
+	}
+	write_data = (const uint8_t *)&req_data->ops[op_count];
 	read_data = resp->payload;
 
 	for (i = 0; i < op_count; i++) {
@@ -89,7 +307,7 @@ static void gb_i2c_protocol_transfer(uint16_t cport, struct gb_message *req,
 		addr = sys_le16_to_cpu(desc->addr);
 
 		if (desc->flags & GB_I2C_M_RD) {
-			ret = i2c_read(dev, read_data, op_size, desc->addr);
+			ret = i2c_read(dev, read_data, op_size, addr);
 			if (ret < 0) {
 				LOG_ERR("Failed to read i2c data");
 				ret = gb_errno_to_op_result(ret);
@@ -97,7 +315,7 @@ static void gb_i2c_protocol_transfer(uint16_t cport, struct gb_message *req,
 			}
 			read_data += op_size;
 		} else {
-			ret = i2c_write(dev, write_data, op_size, desc->addr);
+			ret = i2c_write(dev, write_data, op_size, addr);
 			if (ret < 0) {
 				LOG_ERR("Failed to write i2c data");
 				ret = gb_errno_to_op_result(ret);
@@ -108,28 +326,30 @@ static void gb_i2c_protocol_transfer(uint16_t cport, struct gb_message *req,
 	}
 
 	gb_transport_message_send(resp, cport);
-	return gb_message_dealloc(resp);
+	gb_message_dealloc(resp);
+	if (!in_place) {
+		gb_message_dealloc(req);
+	}
+	return;
 
 free_msg:
+	if (in_place) {
+		return gb_transport_message_empty_response_send(resp, ret, cport);
+	}
+
 	gb_message_dealloc(resp);
 	return gb_transport_message_empty_response_send(req, ret, cport);
 }
 
-static void gb_i2c_handler(const void *priv, struct gb_message *msg, uint16_t cport)
-{
-	const struct device *dev = priv;
-
-	switch (gb_message_type(msg)) {
-	case GB_I2C_TYPE_FUNCTIONALITY:
-		return gb_i2c_protocol_functionality(cport, msg);
-	case GB_I2C_TYPE_TRANSFER:
-		return gb_i2c_protocol_transfer(cport, msg, dev);
-	default:
-		LOG_ERR("Invalid type");
-		gb_transport_message_empty_response_send(msg, GB_OP_INVALID, cport);
-	}
-}
+/* Operations that do not touch the bus are inline */
+static const struct gb_operation_handler gb_i2c_handlers[] = {
+	GB_HANDLER_STATIC(GB_I2C_TYPE_FUNCTIONALITY, gb_i2c_functionality),
+	GB_HANDLER(GB_I2C_TYPE_TRANSFER, gb_i2c_protocol_transfer,
+		   sizeof(struct gb_i2c_transfer_request), 0),
+};
 
 struct gb_driver gb_i2c_driver = {
-	.op_handler = gb_i2c_handler,
+	GB_DRIVER_HANDLERS(gb_i2c_handlers),
+	/* A few hundred bytes at 100 kHz, with clock stretching */
+	.op_budget_ms = 100,
 };
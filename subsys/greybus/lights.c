@@ -46,9 +46,9 @@ LOG_MODULE_REGISTER(greybus_lights, CONFIG_GREYBUS_LOG_LEVEL);
  * @param operation pointer to structure of Greybus operation message
  * @return GB_OP_SUCCESS on success, error code on failure
  */
-static void gb_lights_get_lights(uint16_t cport, struct gb_message *req,
-				 const struct gb_lights_driver_data *data)
+static void gb_lights_get_lights(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_lights_driver_data *data = priv;
 	/* TODO: Add API in zephyr to get led count */
 	const struct gb_lights_get_lights_response resp_data = {
 		.lights_count = data->lights_num,
@@ -67,9 +67,9 @@ static void gb_lights_get_lights(uint16_t cport, struct gb_message *req,
  * @param operation pointer to structure of Greybus operation message
  * @return GB_OP_SUCCESS on success, error code on failure
  */
-static void gb_lights_get_light_config(uint16_t cport, struct gb_message *req,
-				       const struct gb_lights_driver_data *data)
+static void gb_lights_get_light_config(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_lights_driver_data *data = priv;
 	const struct gb_lights_get_light_config_request *req_data =
 		(const struct gb_lights_get_light_config_request *)req->payload;
 	struct gb_lights_get_light_config_response resp_data = {
@@ -103,9 +103,9 @@ static void gb_lights_get_light_config(uint16_t cport, struct gb_message *req,
  * @param operation pointer to structure of Greybus operation message
  * @return GB_OP_SUCCESS on success, error code on failure
  */
-static void gb_lights_get_channel_config(uint16_t cport, struct gb_message *req,
-					 const struct gb_lights_driver_data *data)
+static void gb_lights_get_channel_config(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_lights_driver_data *data = priv;
 	/* TODO: Implement properly */
 	const struct gb_lights_get_channel_config_response resp_data = {
 		.max_brightness = LED_BRIGHTNESS_MAX,
@@ -127,9 +127,9 @@ static void gb_lights_get_channel_config(uint16_t cport, struct gb_message *req,
  * @param operation pointer to structure of Greybus operation message
  * @return GB_OP_SUCCESS on success, error code on failure
  */
-static void gb_lights_set_brightness(uint16_t cport, struct gb_message *req,
-				     const struct gb_lights_driver_data *data)
+static void gb_lights_set_brightness(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_lights_driver_data *data = priv;
 	const struct gb_lights_set_brightness_request *req_data =
 		(const struct gb_lights_set_brightness_request *)req->payload;
 	int ret;
@@ -140,36 +140,37 @@ static void gb_lights_set_brightness(uint16_t cport, struct gb_message *req,
 }
 
 /**
- * @brief Greybus Lights Protocol operation handler
+ * @brief Reply to operations the lights device driver does not implement
  */
-static void gb_lights_handler(const void *priv, struct gb_message *msg, uint16_t cport)
+static void gb_lights_unsupported(const void *priv, struct gb_message *req, uint16_t cport)
 {
-	const struct gb_lights_driver_data *data = priv;
+	ARG_UNUSED(priv);
 
-	switch (gb_message_type(msg)) {
-	case GB_LIGHTS_TYPE_GET_LIGHTS:
-		return gb_lights_get_lights(cport, msg, data);
-	case GB_LIGHTS_TYPE_GET_LIGHT_CONFIG:
-		return gb_lights_get_light_config(cport, msg, data);
-	case GB_LIGHTS_TYPE_GET_CHANNEL_CONFIG:
-		return gb_lights_get_channel_config(cport, msg, data);
-	case GB_LIGHTS_TYPE_SET_BRIGHTNESS:
-		return gb_lights_set_brightness(cport, msg, data);
-	case GB_LIGHTS_TYPE_SET_BLINK:
-	case GB_LIGHTS_TYPE_SET_COLOR:
-	case GB_LIGHTS_TYPE_SET_FADE:
-	case GB_LIGHTS_TYPE_GET_CHANNEL_FLASH_CONFIG:
-	case GB_LIGHTS_TYPE_SET_FLASH_INTENSITY:
-	case GB_LIGHTS_TYPE_SET_FLASH_STROBE:
-	case GB_LIGHTS_TYPE_SET_FLASH_TIMEOUT:
-	case GB_LIGHTS_TYPE_GET_FLASH_FAULT:
-		return gb_transport_message_empty_response_send(msg, GB_OP_INTERNAL, cport);
-	default:
-		LOG_ERR("Invalid type");
-		return gb_transport_message_empty_response_send(msg, GB_OP_PROTOCOL_BAD, cport);
-	}
+	gb_transport_message_empty_response_send(req, GB_OP_INTERNAL, cport);
 }
 
+/**
+ * @brief Greybus Lights Protocol operation handlers
+ *
+ * Operations that only report static information are inline.
+ */
+static const struct gb_operation_handler gb_lights_handlers[] = {
+	GB_HANDLER(GB_LIGHTS_TYPE_GET_LIGHTS, gb_lights_get_lights, 0, GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_LIGHTS_TYPE_GET_LIGHT_CONFIG, gb_lights_get_light_config,
+		   sizeof(struct gb_lights_get_light_config_request), 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_GET_CHANNEL_CONFIG, gb_lights_get_channel_config, 0, 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_SET_BRIGHTNESS, gb_lights_set_brightness,
+		   sizeof(struct gb_lights_set_brightness_request), 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_SET_BLINK, gb_lights_unsupported, 0, 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_SET_COLOR, gb_lights_unsupported, 0, 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_SET_FADE, gb_lights_unsupported, 0, 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_GET_CHANNEL_FLASH_CONFIG, gb_lights_unsupported, 0, 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_SET_FLASH_INTENSITY, gb_lights_unsupported, 0, 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_SET_FLASH_STROBE, gb_lights_unsupported, 0, 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_SET_FLASH_TIMEOUT, gb_lights_unsupported, 0, 0),
+	GB_HANDLER(GB_LIGHTS_TYPE_GET_FLASH_FAULT, gb_lights_unsupported, 0, 0),
+};
+
 struct gb_driver gb_lights_driver = {
-	.op_handler = gb_lights_handler,
+	GB_DRIVER_HANDLERS(gb_lights_handlers),
 };
@@ -6,27 +6,22 @@
 
 #include <greybus/greybus_protocols.h>
 #include "greybus_transport.h"
+#include "greybus_operation.h"
+#include "greybus_cport.h"
 #include <greybus-utils/manifest.h>
 #include "greybus_internal.h"
 
-static void op_handler(const void *priv, struct gb_message *msg, uint16_t cport)
-{
-	ARG_UNUSED(priv);
-
-	switch (gb_message_type(msg)) {
-	case GB_RESPONSE(GB_LOG_TYPE_SEND_LOG):
-		return gb_message_dealloc(msg);
-	default:
-		return gb_transport_message_empty_response_send(msg, GB_OP_PROTOCOL_BAD, cport);
-	}
-}
-
 void gb_log_send_log(uint16_t len, const char *log)
 {
 	struct gb_log_send_log_request *req_data;
-	struct gb_message *msg =
-		gb_message_request_alloc(sizeof(*req_data) + len, GB_LOG_TYPE_SEND_LOG, false);
+	struct gb_message *msg;
+
+	/* Do not allocate logs that AP is not listening for */
+	if (!gb_cport_events_wanted(GREYBUS_LOG_CPORT)) {
+		return;
+	}
 
+	msg = gb_message_request_alloc(sizeof(*req_data) + len, GB_LOG_TYPE_SEND_LOG, false);
 	if (!msg) {
 		return;
 	}
@@ -36,10 +31,11 @@ void gb_log_send_log(uint16_t len, const char *log)
 	req_data->len = sys_cpu_to_le16(len);
 	memcpy(req_data->msg, log, len);
 
-	gb_transport_message_send(msg, GREYBUS_LOG_CPORT);
+	/* A log that AP failed to take cannot be logged */
+	gb_operation_request_send_default(msg, GREYBUS_LOG_CPORT, NULL, NULL);
 	gb_message_dealloc(msg);
 }
 
 struct gb_driver gb_log_driver = {
-	.op_handler = op_handler,
+	/* AP never sends requests on the log CPort */
 };
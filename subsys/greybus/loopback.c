@@ -35,33 +35,32 @@
 
 LOG_MODULE_REGISTER(greybus_loopback, CONFIG_GREYBUS_LOG_LEVEL);
 
-static void gb_loopback_transfer_req_cb(struct gb_message *req, uint16_t cport)
+static void gb_loopback_transfer(const void *priv, struct gb_message *req, uint16_t cport)
 {
-	req->header.type = GB_RESPONSE(GB_LOOPBACK_TYPE_TRANSFER);
-	req->header.result = GB_OP_SUCCESS;
+	ARG_UNUSED(priv);
+
+	/* Others still read a shared request, it cannot become the response */
+	if (gb_message_is_shared(req)) {
+		return gb_transport_message_response_success_send(req, req->payload,
+								  gb_message_payload_len(req),
+								  cport);
+	}
+
+	/* Never moved, the response is as large as the request */
+	req = gb_message_response_in_place(req, gb_message_payload_len(req), GB_OP_SUCCESS);
 
 	gb_transport_message_send(req, cport);
 
 	gb_message_dealloc(req);
 }
 
-static void gb_loopback_handler(const void *priv, struct gb_message *msg, uint16_t cport)
-{
-	ARG_UNUSED(priv);
-
-	switch (gb_message_type(msg)) {
-	case GB_LOOPBACK_TYPE_PING:
-		return gb_transport_message_empty_response_send(msg, GB_OP_SUCCESS, cport);
-	case GB_LOOPBACK_TYPE_TRANSFER:
-		return gb_loopback_transfer_req_cb(msg, cport);
-	case GB_LOOPBACK_TYPE_SINK:
-		return gb_transport_message_empty_response_send(msg, GB_OP_SUCCESS, cport);
-	default:
-		LOG_ERR("Invalid type");
-		gb_transport_message_empty_response_send(msg, GB_OP_INVALID, cport);
-	}
-}
+/* Latency measurement should not include the dispatch queue */
+static const struct gb_operation_handler gb_loopback_handlers[] = {
+	GB_HANDLER(GB_LOOPBACK_TYPE_PING, gb_handler_success, 0, GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_LOOPBACK_TYPE_TRANSFER, gb_loopback_transfer, 0, 0),
+	GB_HANDLER(GB_LOOPBACK_TYPE_SINK, gb_handler_success, 0, 0),
+};
 
 struct gb_driver gb_loopback_driver = {
-	.op_handler = gb_loopback_handler,
+	GB_DRIVER_HANDLERS(gb_loopback_handlers),
 };
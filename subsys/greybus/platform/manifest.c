@@ -69,18 +69,42 @@ static uint8_t bundles[] = {
 #endif // CONFIG_GREYBUS_LOOPBACK
 	DT_FOREACH_CHILD_STATUS_OKAY_SEP(_GREYBUS_BASE_NODE, _GB_BUNDLE_CB, (, ))};
 
-#define GREYBUS_MANIFEST_SIZE                                                                      \
+#define _GREYBUS_MANIFEST_SIZE(_cports, _bundles)                                                  \
 	(sizeof(struct greybus_manifest_header) + GREYBUS_MANIFEST_INTERFACE_SIZE +                \
 	 GREYBUS_MANIFEST_STRING_SIZE(CONFIG_GREYBUS_VENDOR_STRING) +                              \
 	 GREYBUS_MANIFEST_STRING_SIZE(CONFIG_GREYBUS_PRODUCT_STRING) +                             \
-	 _GREYBUS_MANIFEST_CPORTS_SIZE(GREYBUS_CPORT_COUNT) +                                      \
-	 _GREYBUS_MANIFEST_BUNDLES_SIZE(ARRAY_SIZE(bundles)))
+	 _GREYBUS_MANIFEST_CPORTS_SIZE(_cports) + _GREYBUS_MANIFEST_BUNDLES_SIZE(_bundles))
+
+#define GREYBUS_MANIFEST_SIZE _GREYBUS_MANIFEST_SIZE(GREYBUS_CPORT_COUNT, ARRAY_SIZE(bundles))
+
+BUILD_ASSERT(ARRAY_SIZE(bundles) <= 32, "Bundles do not fit in a bundle mask");
+
+/* The control bundle is part of every manifest */
+static bool manifest_has_bundle(uint32_t bundle_mask, uint8_t bundle)
+{
+	return bundle == 0 || (bundle_mask & BIT(bundle));
+}
 
 size_t manifest_size(void)
 {
 	return GREYBUS_MANIFEST_SIZE;
 }
 
+size_t manifest_size_bundles(uint32_t bundle_mask)
+{
+	size_t i, cports = 0, bundle_count = 0;
+
+	for (i = 0; i < ARRAY_SIZE(bundles); i++) {
+		bundle_count += manifest_has_bundle(bundle_mask, i);
+	}
+
+	for (i = 0; i < GREYBUS_CPORT_COUNT; ++i) {
+		cports += manifest_has_bundle(bundle_mask, gb_cport_get(i)->bundle);
+	}
+
+	return _GREYBUS_MANIFEST_SIZE(cports, bundle_count);
+}
+
 static void set_greybus_descriptor_header(struct greybus_descriptor_header *hdr, uint16_t size,
 					  uint8_t type)
 {
@@ -88,9 +112,9 @@ static void set_greybus_descriptor_header(struct greybus_descriptor_header *hdr,
 	hdr->size = sys_cpu_to_le16(size);
 }
 
-static void set_greybus_manifest_header(struct greybus_manifest *mnfb)
+static void set_greybus_manifest_header(struct greybus_manifest *mnfb, size_t size)
 {
-	mnfb->header.size = sys_cpu_to_le16(manifest_size());
+	mnfb->header.size = sys_cpu_to_le16(size);
 	mnfb->header.version_major = CONFIG_GREYBUS_VERSION_MAJOR;
 	mnfb->header.version_minor = CONFIG_GREYBUS_VERSION_MINOR;
 }
@@ -143,20 +167,27 @@ static int set_greybus_cport(struct greybus_descriptor *desc, uint8_t id, uint8_
 }
 
 int manifest_create(uint8_t buf[], size_t len)
+{
+	return manifest_create_bundles(buf, len, UINT32_MAX);
+}
+
+int manifest_create_bundles(uint8_t buf[], size_t len, uint32_t bundle_mask)
 {
 	int ret, i;
+	uint8_t id = 0;
 	struct greybus_manifest *mnfb;
 	struct greybus_descriptor *desc;
 	struct gb_cport *cport;
+	size_t size = manifest_size_bundles(bundle_mask);
 
-	if (len < manifest_size()) {
+	if (len < size) {
 		return -E2BIG;
 	}
 
 	memset(buf, 0, len);
 	mnfb = (struct greybus_manifest *)buf;
 
-	set_greybus_manifest_header(mnfb);
+	set_greybus_manifest_header(mnfb, size);
 
 	desc = &mnfb->descriptors[0];
 	ret = set_greybus_interface(desc);
@@ -168,18 +199,26 @@ int manifest_create(uint8_t buf[], size_t len)
 	ret = _set_greybus_string(desc, GREYBUS_PRODUCT_STRING_ID, CONFIG_GREYBUS_PRODUCT_STRING);
 
 	for (i = 0; i < ARRAY_SIZE(bundles); i++) {
+		if (!manifest_has_bundle(bundle_mask, i)) {
+			continue;
+		}
+
 		desc = (struct greybus_descriptor *)((uint8_t *)desc + ret);
 		ret = set_greybus_bundle(desc, i, bundles[i]);
 	}
 
+	/* CPorts of the manifest are numbered in order, skipping the CPorts of other bundles */
 	for (i = 0; i < GREYBUS_CPORT_COUNT; ++i) {
 		cport = gb_cport_get(i);
-		desc = (struct greybus_descriptor *)((uint8_t *)desc + ret);
+		if (!manifest_has_bundle(bundle_mask, cport->bundle)) {
+			continue;
+		}
 
-		ret = set_greybus_cport(desc, i, cport->bundle, cport->protocol);
+		desc = (struct greybus_descriptor *)((uint8_t *)desc + ret);
+		ret = set_greybus_cport(desc, id++, cport->bundle, cport->protocol);
 	}
 
-	return manifest_size();
+	return size;
 }
 
 void manifest_print(uint8_t buf[])
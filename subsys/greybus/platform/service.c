@@ -14,10 +14,21 @@ LOG_MODULE_REGISTER(greybus_service, CONFIG_GREYBUS_LOG_LEVEL);
 
 #include "certificate.h"
 
+/* Transports enabled in Kconfig, the first one also gets messages from greybus_rx_handler */
+static const struct gb_transport_backend *const xports[] = {
+#ifdef CONFIG_GREYBUS_XPORT_DUMMY
+	&gb_trans_dummy,
+#endif // CONFIG_GREYBUS_XPORT_DUMMY
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP
+	&gb_trans_tcpip,
+#endif // CONFIG_GREYBUS_XPORT_TCPIP
+};
+
+BUILD_ASSERT(ARRAY_SIZE(xports) <= CONFIG_GREYBUS_TRANSPORTS_MAX);
+
 static int greybus_service_init(void)
 {
 	int r;
-	const struct gb_transport_backend *xport = gb_transport_get_backend();
 
 	r = greybus_tls_init();
 	if (r < 0) {
@@ -31,9 +42,9 @@ static int greybus_service_init(void)
 		return -EINVAL;
 	}
 
-	r = gb_init(xport);
+	r = gb_init_transports(xports, ARRAY_SIZE(xports));
 	if (r < 0) {
-		LOG_ERR("gb_init() failed: %d", r);
+		LOG_ERR("gb_init_transports() failed: %d", r);
 		goto clear_mnfb;
 	}
 
@@ -37,9 +37,9 @@
 
 LOG_MODULE_REGISTER(greybus_pwm, CONFIG_GREYBUS_LOG_LEVEL);
 
-static void gb_pwm_protocol_count(uint16_t cport, struct gb_message *req,
-				  struct gb_pwm_driver_data *data)
+static void gb_pwm_protocol_count(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	struct gb_pwm_driver_data *data = (struct gb_pwm_driver_data *)priv;
 	/* The spec states that count should be 1 less than the number of channels. */
 	const struct gb_pwm_count_response resp_data = {
 		.count = data->channel_num - 1,
@@ -51,9 +51,9 @@ static void gb_pwm_protocol_count(uint16_t cport, struct gb_message *req,
 /**
  * @brief Configure specific generator for a particular duty cycle and period.
  */
-static void gb_pwm_protocol_config(uint16_t cport, struct gb_message *req,
-				   struct gb_pwm_driver_data *data)
+static void gb_pwm_protocol_config(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	struct gb_pwm_driver_data *data = (struct gb_pwm_driver_data *)priv;
 	const struct gb_pwm_config_request *req_data =
 		(const struct gb_pwm_config_request *)req->payload;
 
@@ -70,9 +70,9 @@ static void gb_pwm_protocol_config(uint16_t cport, struct gb_message *req,
 /**
  * @brief Configure specific generator for a particular polarity.
  */
-static void gb_pwm_protocol_polarity(uint16_t cport, struct gb_message *req,
-				     struct gb_pwm_driver_data *data)
+static void gb_pwm_protocol_polarity(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	struct gb_pwm_driver_data *data = (struct gb_pwm_driver_data *)priv;
 	const struct gb_pwm_polarity_request *req_data =
 		(const struct gb_pwm_polarity_request *)req->payload;
 
@@ -88,9 +88,9 @@ static void gb_pwm_protocol_polarity(uint16_t cport, struct gb_message *req,
 /**
  * @brief Enable a specific generator to start toggling.
  */
-static void gb_pwm_protocol_enable(uint16_t cport, struct gb_message *req,
-				   struct gb_pwm_driver_data *data)
+static void gb_pwm_protocol_enable(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	struct gb_pwm_driver_data *data = (struct gb_pwm_driver_data *)priv;
 	const struct gb_pwm_enable_request *req_data =
 		(const struct gb_pwm_enable_request *)req->payload;
 	const struct gb_pwm_channel_data *chan;
@@ -110,9 +110,9 @@ static void gb_pwm_protocol_enable(uint16_t cport, struct gb_message *req,
 /**
  * @brief Stop the pulse on a specific channel.
  */
-static void gb_pwm_protocol_disable(uint16_t cport, struct gb_message *req,
-				    struct gb_pwm_driver_data *data)
+static void gb_pwm_protocol_disable(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	struct gb_pwm_driver_data *data = (struct gb_pwm_driver_data *)priv;
 	const struct gb_pwm_disable_request *req_data =
 		(const struct gb_pwm_disable_request *)req->payload;
 	const struct gb_pwm_channel_data *chan;
@@ -128,34 +128,22 @@ static void gb_pwm_protocol_disable(uint16_t cport, struct gb_message *req,
 	gb_transport_message_empty_response_send(req, gb_errno_to_op_result(ret), cport);
 }
 
-/*
- * This structure is to define each PWM protocol operation of handling function.
- */
-static void gb_pwm_handler(const void *priv, struct gb_message *msg, uint16_t cport)
-{
-	struct gb_pwm_driver_data *data = (struct gb_pwm_driver_data *)priv;
-
-	switch (gb_message_type(msg)) {
-	case GB_PWM_TYPE_PWM_COUNT:
-		return gb_pwm_protocol_count(cport, msg, data);
+/* Operations that only update the cached channel configuration are inline */
+static const struct gb_operation_handler gb_pwm_handlers[] = {
+	GB_HANDLER(GB_PWM_TYPE_PWM_COUNT, gb_pwm_protocol_count, 0, GB_HANDLER_F_INLINE),
 	/* No activate/deactivate for PWM. Maybe can do pm stuff at some point. */
-	case GB_PWM_TYPE_ACTIVATE:
-	case GB_PWM_TYPE_DEACTIVATE:
-		return gb_transport_message_empty_response_send(msg, GB_OP_SUCCESS, cport);
-	case GB_PWM_TYPE_CONFIG:
-		return gb_pwm_protocol_config(cport, msg, data);
-	case GB_PWM_TYPE_POLARITY:
-		return gb_pwm_protocol_polarity(cport, msg, data);
-	case GB_PWM_TYPE_ENABLE:
-		return gb_pwm_protocol_enable(cport, msg, data);
-	case GB_PWM_TYPE_DISABLE:
-		return gb_pwm_protocol_disable(cport, msg, data);
-	default:
-		LOG_ERR("Invalid type");
-		return gb_transport_message_empty_response_send(msg, GB_OP_PROTOCOL_BAD, cport);
-	}
-}
+	GB_HANDLER(GB_PWM_TYPE_ACTIVATE, gb_handler_success, 0, GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_PWM_TYPE_DEACTIVATE, gb_handler_success, 0, GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_PWM_TYPE_CONFIG, gb_pwm_protocol_config, sizeof(struct gb_pwm_config_request),
+		   GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_PWM_TYPE_POLARITY, gb_pwm_protocol_polarity,
+		   sizeof(struct gb_pwm_polarity_request), GB_HANDLER_F_INLINE),
+	GB_HANDLER(GB_PWM_TYPE_ENABLE, gb_pwm_protocol_enable, sizeof(struct gb_pwm_enable_request),
+		   0),
+	GB_HANDLER(GB_PWM_TYPE_DISABLE, gb_pwm_protocol_disable,
+		   sizeof(struct gb_pwm_disable_request), 0),
+};
 
 struct gb_driver gb_pwm_driver = {
-	.op_handler = gb_pwm_handler,
+	GB_DRIVER_HANDLERS(gb_pwm_handlers),
 };
@@ -37,24 +37,17 @@
 LOG_MODULE_REGISTER(greybus_spi, CONFIG_GREYBUS_LOG_LEVEL);
 
 /**
- * @brief Returns a set of configuration parameters related to SPI master.
+ * @brief Configuration parameters related to SPI master.
+ *
+ * TODO: Zephyr should provide API to get these details
  */
-static void gb_spi_protocol_master_config(uint16_t cport, struct gb_message *req,
-					  const struct gb_spi_driver_data *data)
-{
-	ARG_UNUSED(data);
-
-	/* TODO: Zephyr should provide API to get these details */
-	const struct gb_spi_master_config_response resp_data = {
-		.min_speed_hz = 738,
-		.max_speed_hz = 24000000,
-		.mode = 0,
-		.flags = 0,
-		.num_chipselect = 1,
-	};
-
-	gb_transport_message_response_success_send(req, &resp_data, sizeof(resp_data), cport);
-}
+static const struct gb_spi_master_config_response gb_spi_master_config = {
+	.min_speed_hz = 738,
+	.max_speed_hz = 24000000,
+	.mode = 0,
+	.flags = 0,
+	.num_chipselect = 1,
+};
 
 /**
  * @brief Get configuration parameters from chip
@@ -62,9 +55,9 @@ static void gb_spi_protocol_master_config(uint16_t cport, struct gb_message *req
  * Returns a set of configuration parameters taht related to SPI device is
  * selected.
  */
-static void gb_spi_protocol_device_config(uint16_t cport, struct gb_message *req,
-					  const struct gb_spi_driver_data *data)
+static void gb_spi_protocol_device_config(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_spi_driver_data *data = priv;
 	const struct gb_spi_device_config_request *req_data =
 		(const struct gb_spi_device_config_request *)req->payload;
 	struct gb_spi_device_config_response dev_data;
@@ -91,21 +84,107 @@ static void gb_spi_protocol_device_config(uint16_t cport, struct gb_message *req
 	gb_transport_message_response_success_send(req, &dev_data, sizeof(dev_data), cport);
 }
 
+/*
+ * The read data can go to the front of the request payload, turning the request into the response,
+ * if no read overwrites a descriptor or write data that is still to be used. Full duplex transfers
+ * must not read over their own write data.
+ */
+static bool gb_spi_read_in_place(const struct gb_spi_transfer_request *req_data, uint16_t count)
+{
+	const struct gb_spi_transfer *desc;
+	size_t i, live, read_end = 0;
+	size_t write_pos = sizeof(*req_data) + count * sizeof(*desc);
+	size_t write_end = write_pos;
+
+	for (i = 0; i < count; ++i) {
+		desc = &req_data->transfers[i];
+		if (desc->xfer_flags & GB_SPI_XFER_WRITE) {
+			write_end += desc->len;
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		desc = &req_data->transfers[i];
+		if (desc->xfer_flags & GB_SPI_XFER_READ) {
+			/* The descriptor of the transfer is copied before it starts */
+			live = (write_pos < write_end) ? write_pos : SIZE_MAX;
+			if (i + 1 < count) {
+				live = MIN(live, sizeof(*req_data) + (i + 1) * sizeof(*desc));
+			}
+
+			read_end += desc->len;
+			if (read_end > live) {
+				return false;
+			}
+		}
+
+		if (desc->xfer_flags & GB_SPI_XFER_WRITE) {
+			write_pos += desc->len;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * The core only checks the fixed part of the request. The descriptors and the write data must be in
+ * the payload, and the read data must fit in a response.
+ *
+ * @return size of the response payload, or -EINVAL if the request is malformed.
+ */
+static int gb_spi_transfer_check(const struct gb_message *req, uint16_t count)
+{
+	const struct gb_spi_transfer_request *req_data =
+		(const struct gb_spi_transfer_request *)req->payload;
+	const struct gb_spi_transfer *desc;
+	size_t i, resp_size = 0;
+	size_t left = gb_message_payload_len(req);
+
+	if (left < sizeof(*req_data) + count * sizeof(*desc)) {
+		return -EINVAL;
+	}
+	left -= sizeof(*req_data) + count * sizeof(*desc);
+
+	for (i = 0; i < count; ++i) {
+		desc = &req_data->transfers[i];
+
+		if (desc->xfer_flags & GB_SPI_XFER_WRITE) {
+			if (desc->len > left) {
+				return -EINVAL;
+			}
+			left -= desc->len;
+		}
+
+		if (desc->xfer_flags & GB_SPI_XFER_READ) {
+			if (desc->len > UINT16_MAX - sizeof(struct gb_message) - resp_size) {
+				return -EINVAL;
+			}
+			resp_size += desc->len;
+		}
+	}
+
+	return resp_size;
+}
+
 /**
  * @brief Performs a SPI transaction as one or more SPI transfers, defined
  *        in the supplied array.
  */
-static void gb_spi_protocol_transfer(uint16_t cport, struct gb_message *req,
-				     const struct gb_spi_driver_data *data)
+static void gb_spi_protocol_transfer(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct gb_spi_driver_data *data = priv;
 	int ret;
 	struct gb_spi_transfer_request *req_data = (struct gb_spi_transfer_request *)req->payload;
-	struct gb_spi_transfer *desc;
+	struct gb_spi_transfer desc;
 	struct spi_config conf = {0};
-	size_t i, resp_pos = 0, resp_size = 0;
+	size_t i, resp_pos = 0;
+	uint16_t count = req_data->count;
+	int resp_size;
 	struct gb_message *resp;
 	struct spi_buf tx_buf, rx_buf;
-	uint8_t *trans_data = req->payload + 4 + (13 * req_data->count);
+	uint8_t *trans_data;
+	uint8_t result = GB_OP_INTERNAL;
+	bool in_place;
 	const struct spi_buf_set tx_buf_set = {
 		.buffers = &tx_buf,
 		.count = 1,
@@ -137,102 +216,113 @@ static void gb_spi_protocol_transfer(uint16_t cport, struct gb_message *req,
 		conf.operation |= SPI_MODE_LOOP;
 	}
 
-	/* Calculate the response size */
-	for (i = 0; i < req_data->count; ++i) {
-		desc = &req_data->transfers[i];
-		if (desc->xfer_flags & GB_SPI_XFER_READ) {
-			resp_size += desc->len;
-		}
+	resp_size = gb_spi_transfer_check(req, count);
+	if (resp_size < 0) {
+		LOG_ERR("Transfers do not match the request size");
+		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
 	}
 
-	resp = gb_message_alloc(resp_size, GB_RESPONSE(GB_SPI_TYPE_TRANSFER),
-				req->header.operation_id, GB_OP_SUCCESS);
-	for (i = 0; i < req_data->count; ++i) {
-		desc = &req_data->transfers[i];
-		conf.frequency = desc->speed_hz;
-		conf.operation |= SPI_WORD_SET(desc->bits_per_word);
+	in_place = gb_spi_read_in_place(req_data, count);
+	if (in_place) {
+		resp = gb_message_response_in_place(req, resp_size, GB_OP_SUCCESS);
+	} else {
+		resp = gb_message_alloc_cport(cport, resp_size, GB_RESPONSE(GB_SPI_TYPE_TRANSFER),
+					      req->header.operation_id, GB_OP_SUCCESS);
+	}
 
-		if (desc->cs_change) {
+	if (!resp) {
+		LOG_ERR("Failed to allocate response");
+		return gb_transport_message_empty_response_send(req, GB_OP_NO_MEMORY, cport);
+	}
+
+	/* The request may have moved to a larger buffer */
+	if (in_place) {
+		req_data = (struct gb_spi_transfer_request *)resp->payload;
+	}
+	trans_data = (uint8_t *)&req_data->transfers[count];
+
+	for (i = 0; i < count; ++i) {
+		/* Read data can overwrite the descriptor */
+		desc = req_data->transfers[i];
+		conf.frequency = desc.speed_hz;
+		conf.operation |= SPI_WORD_SET(desc.bits_per_word);
+
+		if (desc.cs_change) {
 			LOG_ERR("cs_change not supported");
-			gb_transport_message_empty_response_send(req, GB_OP_INTERNAL, cport);
 			goto free_resp;
 		}
 
-		if ((desc->xfer_flags & GB_SPI_XFER_READ) &&
-		    (desc->xfer_flags & GB_SPI_XFER_WRITE)) {
+		if ((desc.xfer_flags & GB_SPI_XFER_READ) && (desc.xfer_flags & GB_SPI_XFER_WRITE)) {
 			rx_buf.buf = resp->payload + resp_pos;
-			rx_buf.len = desc->len;
+			rx_buf.len = desc.len;
 			tx_buf.buf = trans_data;
-			tx_buf.len = desc->len;
+			tx_buf.len = desc.len;
 
 			ret = spi_transceive(data->dev, &conf, &tx_buf_set, &rx_buf_set);
 			if (ret < 0) {
 				LOG_ERR("SPI transceive failed");
-				gb_transport_message_empty_response_send(req, GB_OP_INTERNAL,
-									 cport);
 				goto free_resp;
 			}
 
-			trans_data += desc->len;
-			resp_pos += desc->len;
-		} else if (desc->xfer_flags & GB_SPI_XFER_READ) {
+			trans_data += desc.len;
+			resp_pos += desc.len;
+		} else if (desc.xfer_flags & GB_SPI_XFER_READ) {
 			rx_buf.buf = resp->payload + resp_pos;
-			rx_buf.len = desc->len;
+			rx_buf.len = desc.len;
 
 			ret = spi_read(data->dev, &conf, &rx_buf_set);
 			if (ret < 0) {
 				LOG_ERR("SPI read failed");
-				gb_transport_message_empty_response_send(req, GB_OP_INTERNAL,
-									 cport);
 				goto free_resp;
 			}
 
-			resp_pos += desc->len;
-		} else if (desc->xfer_flags & GB_SPI_XFER_WRITE) {
+			resp_pos += desc.len;
+		} else if (desc.xfer_flags & GB_SPI_XFER_WRITE) {
 			tx_buf.buf = trans_data;
-			tx_buf.len = desc->len;
+			tx_buf.len = desc.len;
 			ret = spi_write(data->dev, &conf, &tx_buf_set);
 			if (ret < 0) {
 				LOG_ERR("SPI write failed");
-				gb_transport_message_empty_response_send(req, GB_OP_INTERNAL,
-									 cport);
 				goto free_resp;
 			}
 
-			trans_data += desc->len;
+			trans_data += desc.len;
 		} else {
 			LOG_ERR("Invalid flag");
-			gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
+			result = GB_OP_INVALID;
 			goto free_resp;
 		}
 
-		k_sleep(K_USEC(desc->delay_usecs));
+		k_sleep(K_USEC(desc.delay_usecs));
 	}
 
 	gb_transport_message_send(resp, cport);
-	gb_message_dealloc(req);
+	gb_message_dealloc(resp);
+	if (!in_place) {
+		gb_message_dealloc(req);
+	}
+	return;
 
 free_resp:
+	if (in_place) {
+		return gb_transport_message_empty_response_send(resp, result, cport);
+	}
+
 	gb_message_dealloc(resp);
+	gb_transport_message_empty_response_send(req, result, cport);
 }
 
-static void gb_spi_handler(const void *priv, struct gb_message *msg, uint16_t cport)
-{
-	const struct gb_spi_driver_data *data = priv;
-
-	switch (gb_message_type(msg)) {
-	case GB_SPI_TYPE_MASTER_CONFIG:
-		return gb_spi_protocol_master_config(cport, msg, data);
-	case GB_SPI_TYPE_DEVICE_CONFIG:
-		return gb_spi_protocol_device_config(cport, msg, data);
-	case GB_SPI_TYPE_TRANSFER:
-		return gb_spi_protocol_transfer(cport, msg, data);
-	default:
-		LOG_ERR("Invalid type");
-		gb_transport_message_empty_response_send(msg, GB_OP_INVALID, cport);
-	}
-}
+/* Operations that do not touch the bus are inline */
+static const struct gb_operation_handler gb_spi_handlers[] = {
+	GB_HANDLER_STATIC(GB_SPI_TYPE_MASTER_CONFIG, gb_spi_master_config),
+	GB_HANDLER(GB_SPI_TYPE_DEVICE_CONFIG, gb_spi_protocol_device_config,
+		   sizeof(struct gb_spi_device_config_request), 0),
+	GB_HANDLER(GB_SPI_TYPE_TRANSFER, gb_spi_protocol_transfer,
+		   sizeof(struct gb_spi_transfer_request), 0),
+};
 
 struct gb_driver gb_spi_driver = {
-	.op_handler = gb_spi_handler,
+	GB_DRIVER_HANDLERS(gb_spi_handlers),
+	/* Transfers run at MHz clocks, long ones are split by AP */
+	.op_budget_ms = 20,
 };
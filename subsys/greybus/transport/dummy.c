@@ -17,6 +17,15 @@ static int init()
 	return 0;
 }
 
+static void trans_exit(void)
+{
+	struct gb_msg_with_cport msg;
+
+	while (k_msgq_get(&rx_msgq, &msg, K_NO_WAIT) == 0) {
+		gb_message_dealloc(msg.msg);
+	}
+}
+
 static int listen(uint16_t cport)
 {
 	return 0;
@@ -24,18 +33,55 @@ static int listen(uint16_t cport)
 
 static int trans_send(uint16_t cport, const struct gb_message *msg)
 {
-	const struct gb_msg_with_cport msg_copy = {
+	int ret;
+	const struct gb_msg_with_cport msg_ref = {
 		.cport = cport,
-		.msg = gb_message_copy(msg),
+		.msg = gb_message_share(msg),
 	};
 
-	return k_msgq_put(&rx_msgq, &msg_copy, K_NO_WAIT);
+	if (!msg_ref.msg) {
+		return -ENOMEM;
+	}
+
+	ret = k_msgq_put(&rx_msgq, &msg_ref, K_NO_WAIT);
+	if (ret < 0) {
+		gb_message_unref(msg_ref.msg);
+	}
+
+	return ret;
+}
+
+static int trans_send_iov(uint16_t cport, const struct gb_operation_msg_hdr *hdr,
+			  const struct gb_iovec *iov, size_t iov_num)
+{
+	struct gb_message *msg;
+	size_t i, off = 0;
+	int ret;
+
+	/* The receiving side owns what it gets, so the message is assembled */
+	msg = gb_message_alloc(gb_hdr_payload_len(hdr), hdr->type, hdr->operation_id, hdr->result);
+	if (!msg) {
+		return -ENOMEM;
+	}
+
+	memcpy(&msg->header, hdr, sizeof(*hdr));
+	for (i = 0; i < iov_num; ++i) {
+		memcpy(msg->payload + off, iov[i].base, iov[i].len);
+		off += iov[i].len;
+	}
+
+	ret = trans_send(cport, msg);
+	gb_message_unref(msg);
+
+	return ret;
 }
 
-const struct gb_transport_backend gb_trans_backend = {
+const struct gb_transport_backend gb_trans_dummy = {
 	.init = init,
+	.exit = trans_exit,
 	.listen = listen,
 	.send = trans_send,
+	.send_iov = trans_send_iov,
 };
 
 struct gb_msg_with_cport gb_transport_get_message(void)
@@ -12,6 +12,7 @@
 #include "../platform/certificate.h"
 #include <greybus/greybus_messages.h>
 #include "../greybus_internal.h"
+#include "../greybus_transport.h"
 
 LOG_MODULE_REGISTER(greybus_transport_tcpip, CONFIG_GREYBUS_LOG_LEVEL);
 
@@ -24,9 +25,18 @@ LOG_MODULE_REGISTER(greybus_transport_tcpip, CONFIG_GREYBUS_LOG_LEVEL);
 /* Based on UniPro, from Linux */
 #define CPORT_ID_MAX 4095
 
-#define GB_TRANS_RX_STACK_SIZE     1024
+#define GB_TRANS_RX_STACK_SIZE     CONFIG_GREYBUS_XPORT_TCPIP_RX_STACK_SIZE
 #define GB_TRANS_RX_STACK_PRIORITY 6
 
+/* Interval at which the receive thread checks if the transport is stopping */
+#define GB_TRANS_POLL_TIMEOUT_MS 50
+
+/* Pieces handed to one zsock_sendmsg: CPort, header and payload pieces */
+#define GB_TRANS_TX_IOV_MAX 8
+
+/* Messages sent from ISR that can wait for the ISR send work */
+#define GB_TRANS_ISR_TX_QUEUE_LEN 8
+
 #ifdef CONFIG_GREYBUS_ENABLE_TLS
 DNS_SD_REGISTER_TCP_SERVICE(gb_service_advertisement, CONFIG_NET_HOSTNAME, "_greybuss", "local",
 			    DNS_SD_EMPTY_TXT, GB_TRANSPORT_TCPIP_BASE_PORT);
@@ -37,17 +47,35 @@ DNS_SD_REGISTER_TCP_SERVICE(gb_service_advertisement, CONFIG_NET_HOSTNAME, "_gre
 
 K_THREAD_STACK_DEFINE(gb_trans_rx_stack, GB_TRANS_RX_STACK_SIZE);
 
+/* Messages sent from ISR, e.g. GPIO events, until isr_tx_work sends them */
+K_MSGQ_DEFINE(gb_trans_isr_tx_msgq, sizeof(struct gb_msg_with_cport), GB_TRANS_ISR_TX_QUEUE_LEN,
+	      sizeof(void *));
+
 /*
  * struct gb_trans_ctx: Transport Context
  *
  * @rx_thread: rx_thread
+ * @tx_lock: serializes messages sent from concurrent dispatch workers
  * @server_sock: socket on which the server listens for connections
  * @client_sock: socket with connection to a client
+ * @stopping: asks the receive thread to exit
+ * @isr_tx_work: sends the messages sent from ISR, which must not block on tx_lock or the socket
+ * @tx_flush_work: sends staged messages when the flush deadline expires
+ * @tx_len: number of bytes staged in tx_buf
+ * @tx_buf: messages waiting to be sent in one go
  */
 struct gb_trans_ctx {
 	struct k_thread rx_thread;
+	struct k_mutex tx_lock;
 	int server_sock;
 	int client_sock;
+	atomic_t stopping;
+	struct k_work isr_tx_work;
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+	struct k_work_delayable tx_flush_work;
+	size_t tx_len;
+	uint8_t tx_buf[CONFIG_GREYBUS_XPORT_TCPIP_TX_BUF_SIZE];
+#endif // CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
 };
 
 static struct gb_trans_ctx ctx;
@@ -73,6 +101,7 @@ static int read_data(int sock, void *data, size_t len)
 	return received;
 }
 
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
 /*
  * Helper to write data to socket
  */
@@ -90,6 +119,81 @@ static int write_data(int sock, const void *data, size_t len)
 	}
 	return transmitted;
 }
+#else
+/*
+ * Helper to write pieces of data to socket in one go. The pieces are consumed.
+ */
+static int write_iov(int sock, struct iovec *iov, size_t iov_num)
+{
+	struct zsock_msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = iov_num,
+	};
+	ssize_t ret;
+
+	while (msg.msg_iovlen) {
+		ret = zsock_sendmsg(sock, &msg, 0);
+		if (ret < 0) {
+			LOG_ERR("Failed to transmit data");
+			return ret;
+		}
+
+		/* A partial send can stop in the middle of a piece */
+		while (msg.msg_iovlen && (size_t)ret >= msg.msg_iov->iov_len) {
+			ret -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+
+		if (msg.msg_iovlen) {
+			msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + ret;
+			msg.msg_iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+#endif // CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+
+static int gb_trans_send_iov(uint16_t cport, const struct gb_operation_msg_hdr *hdr,
+			     const struct gb_iovec *iov, size_t iov_num);
+
+/*
+ * Helper to skip the payload of a message that cannot be received, so the stream stays in sync
+ */
+static int skip_data(int sock, size_t len)
+{
+	uint8_t buf[32];
+	int ret;
+
+	while (len) {
+		ret = read_data(sock, buf, MIN(len, sizeof(buf)));
+		if (ret <= 0) {
+			return ret;
+		}
+		len -= ret;
+	}
+
+	return 1;
+}
+
+/*
+ * Answer a request that cannot be received right away, instead of waiting for memory
+ */
+static void gb_trans_reject(uint16_t cport, const struct gb_operation_msg_hdr *hdr, uint8_t result)
+{
+	const struct gb_operation_msg_hdr resp = {
+		.size = sys_cpu_to_le16(sizeof(resp)),
+		.operation_id = hdr->operation_id,
+		.type = GB_RESPONSE(hdr->type),
+		.result = result,
+	};
+
+	/* Unidirectional requests are not answered */
+	if (!gb_hdr_is_response(hdr) && hdr->operation_id != 0) {
+		gb_trans_send_iov(cport, &resp, NULL, 0);
+	}
+}
 
 /*
  * Helper to receive a greybus message from socket
@@ -113,10 +217,18 @@ static struct gb_msg_with_cport gb_message_receive(int sock, bool *flag)
 		goto early_exit;
 	}
 
-	msg.msg =
-		gb_message_alloc(gb_hdr_payload_len(&hdr), hdr.type, hdr.operation_id, hdr.result);
+	/* Fails at once instead of blocking the control CPort when the CPort is over its quota */
+	msg.msg = gb_message_alloc_cport(msg.cport, gb_hdr_payload_len(&hdr), hdr.type,
+					 hdr.operation_id, hdr.result);
 	if (!msg.msg) {
-		LOG_ERR("Failed to allocate node message");
+		LOG_WRN("Failed to allocate message for CPort %u, rejecting it", msg.cport);
+		ret = skip_data(sock, gb_hdr_payload_len(&hdr));
+		if (ret <= 0) {
+			*flag = ret == 0;
+			goto early_exit;
+		}
+
+		gb_trans_reject(msg.cport, &hdr, GB_OP_NO_MEMORY);
 		goto early_exit;
 	}
 
@@ -146,25 +258,245 @@ static int gb_trans_listen_stop(uint16_t cport)
 	return 0;
 }
 
-static int gb_trans_send(uint16_t cport, const struct gb_message *msg)
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+/*
+ * Send the staged messages. Must be called with tx_lock held.
+ */
+static int gb_trans_tx_flush_locked(void)
+{
+	int ret = 0;
+
+	if (ctx.tx_len) {
+		ret = write_data(ctx.client_sock, ctx.tx_buf, ctx.tx_len);
+		ctx.tx_len = 0;
+	}
+
+	return ret;
+}
+
+/*
+ * Make room for a message of len bytes, sending what is already staged if it does not fit. Must be
+ * called with tx_lock held.
+ *
+ * @return 0 if the message can be staged, 1 if it is too large and must be sent directly, or a
+ *         negative error if the staged messages could not be sent.
+ */
+static int gb_trans_tx_reserve(size_t len)
 {
 	int ret;
-	__le16 cport_u16 = sys_cpu_to_le16(cport);
 
-	if (msg->header.result) {
-		LOG_INF("CPort %u, Type: %u, Result: %u, Id: %u", cport, msg->header.type,
-			msg->header.result, msg->header.operation_id);
+	if (ctx.tx_len + len > sizeof(ctx.tx_buf)) {
+		ret = gb_trans_tx_flush_locked();
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	/* The staged data was sent, so order is kept */
+	if (len > sizeof(ctx.tx_buf)) {
+		return 1;
+	}
+
+	/* Bound the latency of messages sent outside of a dispatch batch */
+	if (ctx.tx_len == 0) {
+		k_work_schedule(&ctx.tx_flush_work,
+				K_USEC(CONFIG_GREYBUS_XPORT_TCPIP_TX_FLUSH_DEADLINE_US));
+	}
+
+	return 0;
+}
+
+/*
+ * Stage a piece of a message, or send it directly if the message does not fit in tx_buf. Must be
+ * called with tx_lock held, after gb_trans_tx_reserve.
+ */
+static int gb_trans_tx_stage(const void *data, size_t len, bool direct)
+{
+	if (direct) {
+		return write_data(ctx.client_sock, data, len);
+	}
+
+	memcpy(ctx.tx_buf + ctx.tx_len, data, len);
+	ctx.tx_len += len;
+
+	return 0;
+}
+
+static void gb_trans_tx_flush_work_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&ctx.tx_lock, K_FOREVER);
+	gb_trans_tx_flush_locked();
+	k_mutex_unlock(&ctx.tx_lock);
+}
+#endif // CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+
+static void gb_trans_flush(void)
+{
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+	int ret;
+
+	k_mutex_lock(&ctx.tx_lock, K_FOREVER);
+	ret = gb_trans_tx_flush_locked();
+	k_mutex_unlock(&ctx.tx_lock);
+
+	if (ret < 0) {
+		LOG_ERR("Failed to send staged messages: %d", ret);
+	}
+#endif // CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+}
+
+/*
+ * Queue a message sent from ISR for isr_tx_work. Takes ownership of the message.
+ */
+static int gb_trans_isr_tx_queue(uint16_t cport, struct gb_message *msg)
+{
+	int ret;
+	const struct gb_msg_with_cport msg_ref = {
+		.cport = cport,
+		.msg = msg,
+	};
+
+	if (!msg) {
+		return -ENOMEM;
 	}
 
-	ret = write_data(ctx.client_sock, &cport_u16, sizeof(cport_u16));
+	ret = k_msgq_put(&gb_trans_isr_tx_msgq, &msg_ref, K_NO_WAIT);
 	if (ret < 0) {
+		gb_message_unref(msg);
 		return ret;
 	}
 
-	ret = write_data(ctx.client_sock, msg, sys_le16_to_cpu(msg->header.size));
+	k_work_submit(&ctx.isr_tx_work);
+
+	return 0;
+}
+
+/*
+ * Copy the pieces of a message sent from ISR in one message, they are gone once the ISR returns.
+ */
+static struct gb_message *gb_trans_isr_tx_assemble(const struct gb_operation_msg_hdr *hdr,
+						   const struct gb_iovec *iov, size_t iov_num)
+{
+	size_t i, offset = 0;
+	struct gb_message *msg = gb_message_alloc(gb_hdr_payload_len(hdr), hdr->type,
+						  hdr->operation_id, hdr->result);
+
+	if (!msg) {
+		return NULL;
+	}
+
+	for (i = 0; i < iov_num; ++i) {
+		memcpy(msg->payload + offset, iov[i].base, iov[i].len);
+		offset += iov[i].len;
+	}
+
+	return msg;
+}
+
+static int gb_trans_send_iov(uint16_t cport, const struct gb_operation_msg_hdr *hdr,
+			     const struct gb_iovec *iov, size_t iov_num)
+{
+	int ret;
+	size_t i;
+	__le16 cport_u16 = sys_cpu_to_le16(cport);
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+	size_t len;
+	bool direct;
+#else
+	struct iovec vec[GB_TRANS_TX_IOV_MAX];
+	size_t vec_num = 0;
+#endif // CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+
+	if (k_is_in_isr()) {
+		return gb_trans_isr_tx_queue(cport, gb_trans_isr_tx_assemble(hdr, iov, iov_num));
+	}
+
+	if (hdr->result) {
+		LOG_INF("CPort %u, Type: %u, Result: %u, Id: %u", cport, hdr->type, hdr->result,
+			hdr->operation_id);
+	}
+
+	k_mutex_lock(&ctx.tx_lock, K_FOREVER);
+
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+	len = sizeof(cport_u16) + sizeof(*hdr);
+	for (i = 0; i < iov_num; ++i) {
+		len += iov[i].len;
+	}
+
+	/* Staged as a whole, a failed send cannot leave part of the message in tx_buf */
+	ret = gb_trans_tx_reserve(len);
+	if (ret < 0) {
+		goto unlock;
+	}
+	direct = ret;
+
+	ret = gb_trans_tx_stage(&cport_u16, sizeof(cport_u16), direct);
+	if (ret >= 0) {
+		ret = gb_trans_tx_stage(hdr, sizeof(*hdr), direct);
+	}
+	for (i = 0; i < iov_num && ret >= 0; ++i) {
+		ret = gb_trans_tx_stage(iov[i].base, iov[i].len, direct);
+	}
+#else
+	vec[vec_num++] = (struct iovec){.iov_base = &cport_u16, .iov_len = sizeof(cport_u16)};
+	vec[vec_num++] = (struct iovec){.iov_base = (void *)hdr, .iov_len = sizeof(*hdr)};
+
+	for (i = 0; i < iov_num; ++i) {
+		/* The lock keeps the message in one piece on the stream */
+		if (vec_num == ARRAY_SIZE(vec)) {
+			ret = write_iov(ctx.client_sock, vec, vec_num);
+			if (ret < 0) {
+				goto unlock;
+			}
+			vec_num = 0;
+		}
+
+		vec[vec_num++] =
+			(struct iovec){.iov_base = (void *)iov[i].base, .iov_len = iov[i].len};
+	}
+
+	ret = write_iov(ctx.client_sock, vec, vec_num);
+#endif // CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+
+unlock:
+	k_mutex_unlock(&ctx.tx_lock);
 	return MIN(0, ret);
 }
 
+static int gb_trans_send(uint16_t cport, const struct gb_message *msg)
+{
+	const struct gb_iovec iov = {
+		.base = msg->payload,
+		.len = gb_message_payload_len(msg),
+	};
+
+	/* Sent by isr_tx_work, the message is shared so the ISR can free its own */
+	if (k_is_in_isr()) {
+		return gb_trans_isr_tx_queue(cport, gb_message_share(msg));
+	}
+
+	return gb_trans_send_iov(cport, &msg->header, &iov, 1);
+}
+
+static void gb_trans_isr_tx_work_handler(struct k_work *work)
+{
+	int ret;
+	struct gb_msg_with_cport msg_ref;
+
+	ARG_UNUSED(work);
+
+	while (k_msgq_get(&gb_trans_isr_tx_msgq, &msg_ref, K_NO_WAIT) == 0) {
+		ret = gb_trans_send(msg_ref.cport, msg_ref.msg);
+		if (ret < 0) {
+			LOG_ERR("Failed to send message of CPort %u: %d", msg_ref.cport, ret);
+		}
+		gb_message_unref(msg_ref.msg);
+	}
+}
+
 static int netsetup()
 {
 	int sock, ret, family, proto = IPPROTO_TCP;
@@ -281,7 +613,7 @@ static void gb_trans_accept(struct gb_trans_ctx *ctx)
 	};
 	socklen_t addrlen = sizeof(addr);
 
-	ret = zsock_poll(&fd, 1, -1);
+	ret = zsock_poll(&fd, 1, GB_TRANS_POLL_TIMEOUT_MS);
 	if (ret < 0) {
 		LOG_ERR("Socket poll failed");
 		return;
@@ -294,9 +626,8 @@ static void gb_trans_accept(struct gb_trans_ctx *ctx)
 			return;
 		}
 		ctx->client_sock = ret;
+		LOG_INF("Accepted new connection");
 	}
-
-	LOG_INF("Accepted new connection");
 }
 
 /*
@@ -312,7 +643,13 @@ static void gb_trans_rx(struct gb_trans_ctx *ctx)
 		.events = ZSOCK_POLLIN,
 	};
 
-	ret = zsock_poll(&fd, 1, -1);
+	ret = zsock_poll(&fd, 1, 0);
+	if (ret == 0) {
+		/* Nothing more to read, send the responses of inline operations before waiting */
+		gb_trans_flush();
+		ret = zsock_poll(&fd, 1, GB_TRANS_POLL_TIMEOUT_MS);
+	}
+
 	if (ret < 0) {
 		LOG_ERR("Socket poll failed");
 		return;
@@ -321,8 +658,15 @@ static void gb_trans_rx(struct gb_trans_ctx *ctx)
 	if (fd.revents & ZSOCK_POLLIN) {
 		msg = gb_message_receive(fd.fd, &flag);
 		if (flag) {
+			k_mutex_lock(&ctx->tx_lock, K_FOREVER);
 			zsock_close(fd.fd);
 			ctx->client_sock = -1;
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+			/* Staged for the old connection */
+			ctx->tx_len = 0;
+#endif // CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+			k_mutex_unlock(&ctx->tx_lock);
+			gb_disconnect_all(&gb_trans_tcpip);
 			return;
 		}
 
@@ -331,7 +675,7 @@ static void gb_trans_rx(struct gb_trans_ctx *ctx)
 			return;
 		}
 
-		ret = greybus_rx_handler(msg.cport, msg.msg);
+		ret = greybus_rx_handler_from(&gb_trans_tcpip, msg.cport, msg.msg);
 		if (ret < 0) {
 			LOG_ERR("Failed to receive greybus message");
 			gb_message_dealloc(msg.msg);
@@ -344,7 +688,7 @@ static void gb_trans_rx(struct gb_trans_ctx *ctx)
  */
 static void gb_trans_rx_thread_handler(void *p1, void *p2, void *p3)
 {
-	while (true) {
+	while (!atomic_get(&ctx.stopping)) {
 		if (ctx.client_sock == -1) {
 			gb_trans_accept(&ctx);
 		} else {
@@ -362,25 +706,66 @@ static int gb_trans_init(void)
 		return -ESOCKTNOSUPPORT;
 	}
 	ctx.client_sock = -1;
+	atomic_clear(&ctx.stopping);
+	k_mutex_init(&ctx.tx_lock);
+	k_work_init(&ctx.isr_tx_work, gb_trans_isr_tx_work_handler);
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+	ctx.tx_len = 0;
+	k_work_init_delayable(&ctx.tx_flush_work, gb_trans_tx_flush_work_handler);
+#endif // CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
 
 	k_thread_create(&ctx.rx_thread, gb_trans_rx_stack, K_THREAD_STACK_SIZEOF(gb_trans_rx_stack),
 			gb_trans_rx_thread_handler, NULL, NULL, NULL, GB_TRANS_RX_STACK_PRIORITY, 0,
-			K_NO_WAIT);
+			K_FOREVER);
+	gb_thread_start(&ctx.rx_thread, 0);
 
 	return 0;
 }
 
 static void gb_trans_exit(void)
 {
-	k_thread_abort(&ctx.rx_thread);
+	struct k_work_sync sync;
+
+	/* Let the receive thread finish the message it is reading, it owns the allocation */
+	atomic_set(&ctx.stopping, 1);
+	if (k_thread_join(&ctx.rx_thread, K_MSEC(GB_TRANS_POLL_TIMEOUT_MS * 4)) < 0) {
+		LOG_WRN("Receive thread is stuck, aborting it");
+		k_thread_abort(&ctx.rx_thread);
+	}
+
+	/*
+	 * Send what interrupt handlers queued, then wait for messages that are being sent, AP must
+	 * not see a truncated message.
+	 */
+	k_work_cancel_sync(&ctx.isr_tx_work, &sync);
+	gb_trans_isr_tx_work_handler(&ctx.isr_tx_work);
+	k_mutex_lock(&ctx.tx_lock, K_FOREVER);
+
+#ifdef CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+	k_work_cancel_delayable(&ctx.tx_flush_work);
+	if (ctx.client_sock >= 0) {
+		gb_trans_tx_flush_locked();
+	}
+	ctx.tx_len = 0;
+#endif // CONFIG_GREYBUS_XPORT_TCPIP_TX_BATCH
+
+	if (ctx.client_sock >= 0) {
+		zsock_close(ctx.client_sock);
+		ctx.client_sock = -1;
+	}
+
 	zsock_close(ctx.server_sock);
-	zsock_close(ctx.client_sock);
+	ctx.server_sock = -1;
+
+	k_mutex_unlock(&ctx.tx_lock);
 }
 
-const struct gb_transport_backend gb_trans_backend = {
+const struct gb_transport_backend gb_trans_tcpip = {
 	.init = gb_trans_init,
 	.exit = gb_trans_exit,
 	.listen = gb_trans_listen_start,
 	.stop_listening = gb_trans_listen_stop,
 	.send = gb_trans_send,
+	.send_iov = gb_trans_send_iov,
+	.flush = gb_trans_flush,
 };
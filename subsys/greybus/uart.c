@@ -28,6 +28,7 @@
 
 #include "greybus_uart.h"
 #include "greybus_transport.h"
+#include "greybus_cport.h"
 #include <zephyr/logging/log.h>
 #include <greybus/greybus_protocols.h>
 #include "greybus_internal.h"
@@ -44,12 +45,18 @@ LOG_MODULE_REGISTER(greybus_uart, CONFIG_GREYBUS_LOG_LEVEL);
 /**
  * @brief Protocol send data function.
  */
-static void gb_uart_send_data(uint16_t cport, struct gb_message *req, const struct device *dev)
+static void gb_uart_send_data(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct device *dev = priv;
 	size_t i;
 	const struct gb_uart_send_data_request *req_data =
 		(const struct gb_uart_send_data_request *)req->payload;
 
+	/* The core only checks the fixed part of the request */
+	if (gb_message_payload_len(req) < sizeof(*req_data) + sys_le16_to_cpu(req_data->size)) {
+		return gb_transport_message_empty_response_send(req, GB_OP_INVALID, cport);
+	}
+
 	for (i = 0; i < sys_le16_to_cpu(req_data->size); i++) {
 		uart_poll_out(dev, req_data->data[i]);
 	}
@@ -60,9 +67,9 @@ static void gb_uart_send_data(uint16_t cport, struct gb_message *req, const stru
 /**
  * @brief Protocol set line coding function.
  */
-static void gb_uart_set_line_coding(uint16_t cport, struct gb_message *req,
-				    const struct device *dev)
+static void gb_uart_set_line_coding(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct device *dev = priv;
 	int ret;
 	const struct gb_uart_set_line_coding_request *req_data =
 		(const struct gb_uart_set_line_coding_request *)req->payload;
@@ -140,9 +147,9 @@ static void gb_uart_set_line_coding(uint16_t cport, struct gb_message *req,
 /**
  * @brief Protocol set RTS & DTR line status function.
  */
-static void gb_uart_set_control_line_state(uint16_t cport, struct gb_message *req,
-					   const struct device *dev)
+static void gb_uart_set_control_line_state(const void *priv, struct gb_message *req, uint16_t cport)
 {
+	const struct device *dev = priv;
 	int ret;
 	const struct gb_uart_set_control_line_state_request *req_data =
 		(const struct gb_uart_set_control_line_state_request *)req->payload;
@@ -161,15 +168,6 @@ static void gb_uart_set_control_line_state(uint16_t cport, struct gb_message *re
 	gb_transport_message_empty_response_send(req, gb_errno_to_op_result(ret), cport);
 }
 
-/**
- * @brief Protocol send break function.
- */
-static void gb_uart_send_break(uint16_t cport, struct gb_message *req, const struct device *dev)
-{
-	/* TODO: zephyr should provide API for this. */
-	gb_transport_message_empty_response_send(req, GB_OP_SUCCESS, cport);
-}
-
 static void uart_irq_cb(const struct device *dev, void *user_data)
 {
 	uint16_t cport = POINTER_TO_UINT(user_data);
@@ -181,7 +179,18 @@ static void uart_irq_cb(const struct device *dev, void *user_data)
 		return;
 	}
 
-	req = gb_message_request_alloc(MAX_RX_BUF_SIZE, GB_UART_TYPE_RECEIVE_DATA, false);
+	/* Nobody is listening, drain the FIFO without allocating a message */
+	if (!gb_cport_events_wanted(cport)) {
+		uint8_t discard[MAX_RX_BUF_SIZE];
+
+		while (uart_fifo_read(dev, discard, sizeof(discard)) > 0) {
+		}
+		return;
+	}
+
+	/* Unidirectional, AP does not respond to received data. Charged to the CPort, so a burst
+	 * cannot take the heap of the others. */
+	req = gb_message_alloc_cport(cport, MAX_RX_BUF_SIZE, GB_UART_TYPE_RECEIVE_DATA, 0, 0);
 	if (!req) {
 		LOG_ERR("Failed to allocate message");
 		return;
@@ -233,27 +242,21 @@ static void gb_uart_exit(const void *priv)
 	uart_irq_rx_disable(dev);
 }
 
-static void gb_uart_handler(const void *priv, struct gb_message *msg, uint16_t cport)
-{
-	const struct device *dev = priv;
-
-	switch (gb_message_type(msg)) {
-	case GB_UART_TYPE_SEND_DATA:
-		return gb_uart_send_data(cport, msg, dev);
-	case GB_UART_TYPE_SET_LINE_CODING:
-		return gb_uart_set_line_coding(cport, msg, dev);
-	case GB_UART_TYPE_SET_CONTROL_LINE_STATE:
-		return gb_uart_set_control_line_state(cport, msg, dev);
-	case GB_UART_TYPE_SEND_BREAK:
-		return gb_uart_send_break(cport, msg, dev);
-	default:
-		LOG_ERR("Invalid type");
-		return gb_transport_message_empty_response_send(msg, GB_OP_PROTOCOL_BAD, cport);
-	}
-}
+static const struct gb_operation_handler gb_uart_handlers[] = {
+	GB_HANDLER(GB_UART_TYPE_SEND_DATA, gb_uart_send_data,
+		   sizeof(struct gb_uart_send_data_request), 0),
+	GB_HANDLER(GB_UART_TYPE_SET_LINE_CODING, gb_uart_set_line_coding,
+		   sizeof(struct gb_uart_set_line_coding_request), 0),
+	GB_HANDLER(GB_UART_TYPE_SET_CONTROL_LINE_STATE, gb_uart_set_control_line_state,
+		   sizeof(struct gb_uart_set_control_line_state_request), 0),
+	/* TODO: zephyr should provide API for this. */
+	GB_HANDLER(GB_UART_TYPE_SEND_BREAK, gb_handler_success, 0, 0),
+};
 
 struct gb_driver gb_uart_driver = {
 	.init = gb_uart_init,
 	.exit = gb_uart_exit,
-	.op_handler = gb_uart_handler,
+	GB_DRIVER_HANDLERS(gb_uart_handlers),
+	/* Send Data polls every byte out, a few hundred bytes at 115200 baud */
+	.op_budget_ms = 50,
 };
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2025 Ayush Singh, BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gb_test_common.h"
+#include <greybus/greybus_messages.h>
+#include <greybus/greybus_protocols.h>
+#include <zephyr/ztest.h>
+#include <zephyr/sys/byteorder.h>
+
+void gb_test_control_request(uint8_t type, uint16_t cport)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_message *req =
+		gb_message_request_alloc(sizeof(struct gb_control_connected_request), type, false);
+	struct gb_control_connected_request *req_data =
+		(struct gb_control_connected_request *)req->payload;
+
+	req_data->cport_id = sys_cpu_to_le16(cport);
+
+	greybus_rx_handler(0, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 0, "Invalid cport");
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(type), "Invalid response type");
+	zassert_true(gb_message_is_success(resp.msg), "Control request failed");
+
+	gb_message_dealloc(resp.msg);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2025 Ayush Singh, BeagleBoard.org
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Helpers shared by the greybus integration tests.
+ */
+
+#ifndef _GB_TEST_COMMON_H_
+#define _GB_TEST_COMMON_H_
+
+#include <stdint.h>
+#include <greybus/greybus.h>
+#include <greybus/greybus_protocols.h>
+
+struct gb_msg_with_cport gb_transport_get_message(void);
+
+/*
+ * Send a control request for a CPort the way AP does and check that it succeeds.
+ *
+ * @param type: control request type, e.g. GB_CONTROL_TYPE_CONNECTED
+ * @param cport: CPort the request is for
+ */
+void gb_test_control_request(uint8_t type, uint16_t cport);
+
+/*
+ * AP connects the CPort under test before using it.
+ *
+ * @param cport: CPort under test
+ */
+static inline void gb_test_connect(uint16_t cport)
+{
+	gb_test_control_request(GB_CONTROL_TYPE_CONNECTED, cport);
+}
+
+#endif // _GB_TEST_COMMON_H_
@@ -8,6 +8,8 @@
 #include <zephyr/ztest.h>
 #include <greybus/greybus.h>
 #include <greybus-utils/manifest.h>
+#include "gb_test_common.h"
+#include "greybus_internal.h"
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/gpio.h>
@@ -15,15 +17,6 @@
 
 static const struct device *dev = DEVICE_DT_GET(DT_NODELABEL(gpio0));
 
-struct gb_msg_with_cport gb_transport_get_message(void);
-
-ZTEST_SUITE(greybus_gpio_tests, NULL, NULL, NULL, NULL, NULL);
-
-ZTEST(greybus_gpio_tests, test_cport_count)
-{
-	zassert_equal(GREYBUS_CPORT_COUNT, 2, "Invalid number of cports");
-}
-
 static struct gb_msg_with_cport get_first_non_event(void)
 {
 	struct gb_msg_with_cport msg = gb_transport_get_message();
@@ -36,6 +29,21 @@ static struct gb_msg_with_cport get_first_non_event(void)
 	return msg;
 }
 
+/* AP connects the CPort under test before using it */
+static void *greybus_gpio_setup(void)
+{
+	gb_test_connect(1);
+
+	return NULL;
+}
+
+ZTEST_SUITE(greybus_gpio_tests, NULL, greybus_gpio_setup, NULL, NULL, NULL);
+
+ZTEST(greybus_gpio_tests, test_cport_count)
+{
+	zassert_equal(GREYBUS_CPORT_COUNT, 2, "Invalid number of cports");
+}
+
 /* Returns msg after some common checks */
 static struct gb_msg_with_cport get_first_non_event_checked(uint8_t type, uint16_t payload_len)
 {
@@ -193,3 +201,89 @@ ZTEST(greybus_gpio_tests, test_set_value)
 
 	zassert_equal(gpio_emul_output_get(dev, 0), 0, "Pin was not configured as output");
 }
+
+#ifdef CONFIG_GREYBUS_EVENT_JOURNAL
+#define JOURNAL_DEPTH CONFIG_GREYBUS_EVENT_JOURNAL_DEPTH
+
+BUILD_ASSERT(JOURNAL_DEPTH >= 2 && JOURNAL_DEPTH + 1 < 31, "Journal test uses pins 1 to depth + 1");
+
+static void journal_irq_event(uint8_t pin)
+{
+	gpio_emul_input_set(dev, pin, 0);
+	gpio_emul_input_set(dev, pin, 1);
+}
+
+ZTEST(greybus_gpio_tests, test_event_journal)
+{
+	size_t i;
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	struct gb_control_connected_request *req_data;
+	uint8_t expected[JOURNAL_DEPTH];
+
+	for (i = 1; i <= JOURNAL_DEPTH + 1; i++) {
+		gpio_pin_configure(dev, i, GPIO_INPUT);
+		gpio_emul_input_set(dev, i, 0);
+		gpio_pin_interrupt_configure(dev, i, GPIO_INT_EDGE_RISING);
+	}
+
+	/* AP is lost, events of the CPort are journaled from now on */
+	gb_disconnect_all(NULL);
+
+	/* Pin 1 comes twice, and one event more than the journal holds */
+	for (i = 1; i <= JOURNAL_DEPTH; i++) {
+		journal_irq_event(i);
+	}
+	journal_irq_event(1);
+	journal_irq_event(JOURNAL_DEPTH + 1);
+
+	for (i = 0; i < JOURNAL_DEPTH; i++) {
+		if (IS_ENABLED(CONFIG_GREYBUS_EVENT_JOURNAL_DROP_NEWEST)) {
+			/* The last two events are dropped */
+			expected[i] = i + 1;
+		} else if (IS_ENABLED(CONFIG_GREYBUS_EVENT_JOURNAL_COALESCE)) {
+			/* The second event of pin 1 is coalesced, the first one dropped */
+			expected[i] = i + 2;
+		} else if (i < JOURNAL_DEPTH - 2) {
+			/* The first two events are dropped */
+			expected[i] = i + 3;
+		} else {
+			expected[i] = (i == JOURNAL_DEPTH - 2) ? 1 : JOURNAL_DEPTH + 1;
+		}
+	}
+
+	/* AP is back and connects the CPort again */
+	req = gb_message_request_alloc(sizeof(*req_data), GB_CONTROL_TYPE_CONNECTED, false);
+	req_data = (struct gb_control_connected_request *)req->payload;
+	req_data->cport_id = sys_cpu_to_le16(1);
+	greybus_rx_handler(0, req);
+
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 0, "Invalid cport");
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_CONTROL_TYPE_CONNECTED),
+		      "Connected response must come before the journal");
+	zassert_true(gb_message_is_success(resp.msg), "Failed to connect cport");
+	gb_message_dealloc(resp.msg);
+
+	for (i = 0; i < JOURNAL_DEPTH; i++) {
+		resp = gb_transport_get_message();
+		zassert_equal(resp.cport, 1, "Invalid cport");
+		zassert_equal(gb_message_type(resp.msg), GB_GPIO_TYPE_IRQ_EVENT,
+			      "Expected a replayed event");
+		zassert_equal(((const struct gb_gpio_irq_event_request *)resp.msg->payload)->which,
+			      expected[i], "Event %zu replayed out of order", i);
+		gb_message_dealloc(resp.msg);
+	}
+
+	/* Dropped events are not sent, the next message is the response to a new request */
+	for (i = 1; i <= JOURNAL_DEPTH + 1; i++) {
+		gpio_pin_interrupt_configure(dev, i, GPIO_INT_DISABLE);
+	}
+
+	greybus_rx_handler(1, gb_message_request_alloc(0, GB_GPIO_TYPE_LINE_COUNT, false));
+	resp = gb_transport_get_message();
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_GPIO_TYPE_LINE_COUNT),
+		      "Dropped events were replayed");
+	gb_message_dealloc(resp.msg);
+}
+#endif // CONFIG_GREYBUS_EVENT_JOURNAL
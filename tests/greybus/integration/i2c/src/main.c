@@ -8,6 +8,8 @@
 #include <zephyr/ztest.h>
 #include <greybus/greybus.h>
 #include <greybus-utils/manifest.h>
+#include "gb_test_common.h"
+#include "greybus_internal.h"
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/i2c.h>
@@ -18,13 +20,21 @@
 
 static const struct device *dev = DEVICE_DT_GET(DT_NODELABEL(i2c0));
 
-struct gb_msg_with_cport gb_transport_get_message(void);
+extern struct gb_driver gb_i2c_driver;
+
+/* Makes the bus slow, to run operations over their budget */
+static atomic_t i2c_emul_delay_ms;
+/* Given when a transfer reaches the bus */
+static K_SEM_DEFINE(i2c_emul_started, 0, 1);
 
 static int i2c_emul_transfer(const struct emul *target, struct i2c_msg *msgs, int num_msgs,
 			     int addr)
 {
 	size_t i;
 
+	k_sem_give(&i2c_emul_started);
+	k_msleep(atomic_get(&i2c_emul_delay_ms));
+
 	for (i = 0; i < msgs->len; i++) {
 		if (msgs->flags & I2C_MSG_READ) {
 			zassert_equal(addr, 0x02, "Wrong address");
@@ -62,16 +72,132 @@ static struct i2c_emul i2c_dev_2 = {
 	.target = &i2c_emul_dev,
 };
 
-ZTEST_SUITE(greybus_i2c_tests, NULL, NULL, NULL, NULL, NULL);
+#if DT_NODE_EXISTS(DT_NODELABEL(i2c_cb))
+/*
+ * Controller with an asynchronous API on top of the emulated bus, so that greybus runs transfers in
+ * the background. Transfers complete on their own workqueue, as they would from the bus interrupt,
+ * so a slow bus does not hold up the system workqueue.
+ */
+struct i2c_cb_transfer {
+	struct k_work work;
+	struct i2c_msg *msgs;
+	uint8_t num_msgs;
+	uint16_t addr;
+	i2c_callback_t cb;
+	void *userdata;
+};
+
+K_THREAD_STACK_DEFINE(i2c_cb_stack, 1024);
+static struct k_work_q i2c_cb_workq;
+static struct i2c_cb_transfer i2c_cb_xfer;
+static atomic_t i2c_cb_transfers;
+
+static void i2c_cb_work(struct k_work *work)
+{
+	struct i2c_cb_transfer *xfer = CONTAINER_OF(work, struct i2c_cb_transfer, work);
+	int ret = i2c_transfer(dev, xfer->msgs, xfer->num_msgs, xfer->addr);
+
+	xfer->cb(DEVICE_DT_GET(DT_NODELABEL(i2c_cb)), ret, xfer->userdata);
+}
+
+static int i2c_cb_configure(const struct device *cb_dev, uint32_t dev_config)
+{
+	return i2c_configure(dev, dev_config);
+}
+
+static int i2c_cb_transfer(const struct device *cb_dev, struct i2c_msg *msgs, uint8_t num_msgs,
+			   uint16_t addr)
+{
+	return i2c_transfer(dev, msgs, num_msgs, addr);
+}
+
+static int i2c_cb_transfer_cb(const struct device *cb_dev, struct i2c_msg *msgs,
+			      uint8_t num_msgs, uint16_t addr, i2c_callback_t cb, void *userdata)
+{
+	if (k_work_busy_get(&i2c_cb_xfer.work)) {
+		return -EBUSY;
+	}
+
+	i2c_cb_xfer.msgs = msgs;
+	i2c_cb_xfer.num_msgs = num_msgs;
+	i2c_cb_xfer.addr = addr;
+	i2c_cb_xfer.cb = cb;
+	i2c_cb_xfer.userdata = userdata;
+	atomic_inc(&i2c_cb_transfers);
+
+	k_work_submit_to_queue(&i2c_cb_workq, &i2c_cb_xfer.work);
+
+	return 0;
+}
+
+static int i2c_cb_init(const struct device *cb_dev)
+{
+	k_work_init(&i2c_cb_xfer.work, i2c_cb_work);
+	k_work_queue_start(&i2c_cb_workq, i2c_cb_stack, K_THREAD_STACK_SIZEOF(i2c_cb_stack),
+			   K_PRIO_PREEMPT(1), NULL);
+
+	return 0;
+}
+
+static DEVICE_API(i2c, i2c_cb_api) = {
+	.configure = i2c_cb_configure,
+	.transfer = i2c_cb_transfer,
+	.transfer_cb = i2c_cb_transfer_cb,
+};
+
+DEVICE_DT_DEFINE(DT_NODELABEL(i2c_cb), i2c_cb_init, NULL, NULL, NULL, POST_KERNEL,
+		 CONFIG_I2C_INIT_PRIORITY, &i2c_cb_api);
+#endif // DT_NODE_EXISTS(DT_NODELABEL(i2c_cb))
+
+/* AP connects the CPort under test before using it */
+static void *greybus_i2c_setup(void)
+{
+	int ret;
+
+	gb_test_connect(1);
+
+	ret = i2c_emul_register(dev, &i2c_dev_1);
+	zassert_equal(ret, 0, "Failed to register i2c_dev_1");
+	ret = i2c_emul_register(dev, &i2c_dev_2);
+	zassert_equal(ret, 0, "Failed to register i2c_dev_2");
+
+	return NULL;
+}
+
+ZTEST_SUITE(greybus_i2c_tests, NULL, greybus_i2c_setup, NULL, NULL, NULL);
 
 ZTEST(greybus_i2c_tests, test_cport_count)
 {
 	zassert_equal(GREYBUS_CPORT_COUNT, 2, "Invalid number of cports");
 }
 
+ZTEST(greybus_i2c_tests, test_functionality)
+{
+	struct gb_msg_with_cport resp;
+	const struct gb_i2c_functionality_response *resp_data;
+	struct gb_message *req = gb_message_request_alloc(0, GB_I2C_TYPE_FUNCTIONALITY, false);
+	uint16_t operation_id = req->header.operation_id;
+
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert(gb_message_is_success(resp.msg), "Request failed");
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_I2C_TYPE_FUNCTIONALITY),
+		      "Invalid response type");
+	zassert_equal(resp.msg->header.operation_id, operation_id, "Invalid operation id");
+	zassert_equal(gb_message_payload_len(resp.msg), sizeof(*resp_data),
+		      "Invalid response size");
+
+	resp_data = (const struct gb_i2c_functionality_response *)resp.msg->payload;
+	zassert_true(resp_data->functionality & GB_I2C_FUNC_I2C, "Plain I2C not supported");
+
+	gb_message_dealloc(resp.msg);
+}
+
 ZTEST(greybus_i2c_tests, test_transfer)
 {
-	int i, ret;
+	int i;
 	uint8_t *write_data;
 	struct gb_msg_with_cport resp;
 	struct gb_i2c_transfer_request *req_data;
@@ -79,11 +205,6 @@ ZTEST(greybus_i2c_tests, test_transfer)
 		sizeof(*req_data) + sizeof(struct gb_i2c_transfer_op) * OP_COUNT + TRANSFER_BUF,
 		GB_I2C_TYPE_TRANSFER, false);
 
-	ret = i2c_emul_register(dev, &i2c_dev_1);
-	zassert_equal(ret, 0, "Failed to register i2c_dev_1");
-	ret = i2c_emul_register(dev, &i2c_dev_2);
-	zassert_equal(ret, 0, "Failed to register i2c_dev_2");
-
 	req_data = (struct gb_i2c_transfer_request *)req->payload;
 	req_data->op_count = OP_COUNT;
 	write_data = (uint8_t *)&req_data->ops[OP_COUNT];
@@ -115,3 +236,180 @@ ZTEST(greybus_i2c_tests, test_transfer)
 
 	gb_message_dealloc(resp.msg);
 }
+
+/* Operations that do not match the request size are refused, nothing is read past the request */
+ZTEST(greybus_i2c_tests, test_short_request)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_i2c_transfer_request *req_data;
+	struct gb_message *req = gb_message_request_alloc(
+		sizeof(*req_data) + sizeof(struct gb_i2c_transfer_op) + 1, GB_I2C_TYPE_TRANSFER,
+		false);
+
+	/* The write data is TRANSFER_BUF bytes, only one is there */
+	req_data = (struct gb_i2c_transfer_request *)req->payload;
+	req_data->op_count = 1;
+	req_data->ops[0].addr = 0x01;
+	req_data->ops[0].size = TRANSFER_BUF;
+	req_data->ops[0].flags = 0;
+
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_equal(resp.msg->header.result, GB_OP_INVALID, "Short write data accepted");
+	gb_message_dealloc(resp.msg);
+
+	/* More operations than the request holds */
+	req = gb_message_request_alloc(sizeof(*req_data) + sizeof(struct gb_i2c_transfer_op),
+				       GB_I2C_TYPE_TRANSFER, false);
+	req_data = (struct gb_i2c_transfer_request *)req->payload;
+	req_data->op_count = OP_COUNT + 2;
+
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.msg->header.result, GB_OP_INVALID, "Missing operations accepted");
+	gb_message_dealloc(resp.msg);
+}
+
+/* A transaction with a single address, which runs in the background if the controller can */
+ZTEST(greybus_i2c_tests, test_transfer_single_address)
+{
+	int i;
+	struct gb_msg_with_cport resp;
+	struct gb_i2c_transfer_request *req_data;
+	struct gb_message *req = gb_message_request_alloc(
+		sizeof(*req_data) + sizeof(struct gb_i2c_transfer_op), GB_I2C_TYPE_TRANSFER, false);
+	uint16_t operation_id = req->header.operation_id;
+#if DT_NODE_EXISTS(DT_NODELABEL(i2c_cb))
+	atomic_val_t transfers = atomic_get(&i2c_cb_transfers);
+#endif // DT_NODE_EXISTS(DT_NODELABEL(i2c_cb))
+
+	req_data = (struct gb_i2c_transfer_request *)req->payload;
+	req_data->op_count = 1;
+	req_data->ops[0].addr = 0x02;
+	req_data->ops[0].size = TRANSFER_BUF;
+	req_data->ops[0].flags = GB_I2C_M_RD;
+
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert(gb_message_is_success(resp.msg), "Request failed");
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_I2C_TYPE_TRANSFER),
+		      "Invalid response type");
+	zassert_equal(resp.msg->header.operation_id, operation_id, "Invalid operation id");
+	zassert_equal(gb_message_payload_len(resp.msg), TRANSFER_BUF, "Invalid response size");
+
+	for (i = 0; i < TRANSFER_BUF; i++) {
+		zassert_equal(resp.msg->payload[i], i, "Unexpected data");
+	}
+
+	gb_message_dealloc(resp.msg);
+
+#if DT_NODE_EXISTS(DT_NODELABEL(i2c_cb))
+	zassert_equal(atomic_get(&i2c_cb_transfers), transfers + 1,
+		      "Transfer did not run in the background");
+#endif // DT_NODE_EXISTS(DT_NODELABEL(i2c_cb))
+}
+
+#if CONFIG_GREYBUS_RX_PRIORITY_CLASSES > 1
+static uint16_t i2c_read_send(void)
+{
+	struct gb_i2c_transfer_request *req_data;
+	struct gb_message *req = gb_message_request_alloc(
+		sizeof(*req_data) + sizeof(struct gb_i2c_transfer_op), GB_I2C_TYPE_TRANSFER, false);
+	uint16_t operation_id = req->header.operation_id;
+
+	req_data = (struct gb_i2c_transfer_request *)req->payload;
+	req_data->op_count = 1;
+	req_data->ops[0].addr = 0x02;
+	req_data->ops[0].size = 1;
+	req_data->ops[0].flags = GB_I2C_M_RD;
+
+	greybus_rx_handler(1, req);
+
+	return operation_id;
+}
+
+static void response_check(uint16_t cport, uint8_t type, uint16_t operation_id)
+{
+	struct gb_msg_with_cport resp = gb_transport_get_message();
+
+	zassert_equal(resp.cport, cport, "Invalid cport");
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(type), "Invalid response type");
+	zassert_equal(resp.msg->header.operation_id, operation_id, "Invalid operation id");
+	zassert_true(gb_message_is_success(resp.msg), "Request failed");
+	gb_message_dealloc(resp.msg);
+}
+
+/* The control CPort is served before the I2C CPort queued ahead of it */
+ZTEST(greybus_i2c_tests, test_priority_class)
+{
+	uint16_t busy_id, queued_id, control_id;
+	struct gb_message *req;
+
+	atomic_set(&i2c_emul_delay_ms, 50);
+	k_sem_reset(&i2c_emul_started);
+
+	/* Keep the worker busy on the bus */
+	busy_id = i2c_read_send();
+	zassert_equal(k_sem_take(&i2c_emul_started, K_SECONDS(1)), 0, "Transfer not started");
+
+	queued_id = i2c_read_send();
+
+	req = gb_message_request_alloc(0, GB_CONTROL_TYPE_VERSION, false);
+	control_id = req->header.operation_id;
+	greybus_rx_handler(0, req);
+
+	response_check(1, GB_I2C_TYPE_TRANSFER, busy_id);
+	response_check(0, GB_CONTROL_TYPE_VERSION, control_id);
+	response_check(1, GB_I2C_TYPE_TRANSFER, queued_id);
+
+	atomic_set(&i2c_emul_delay_ms, 0);
+}
+#endif // CONFIG_GREYBUS_RX_PRIORITY_CLASSES > 1
+
+#ifdef CONFIG_GREYBUS_OPERATION_WATCHDOG_ABORT
+ZTEST(greybus_i2c_tests, test_transfer_timeout)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_i2c_transfer_request *req_data;
+	struct gb_message *req = gb_message_request_alloc(
+		sizeof(*req_data) + sizeof(struct gb_i2c_transfer_op), GB_I2C_TYPE_TRANSFER, false);
+	uint16_t operation_id = req->header.operation_id;
+
+	req_data = (struct gb_i2c_transfer_request *)req->payload;
+	req_data->op_count = 1;
+	req_data->ops[0].addr = 0x02;
+	req_data->ops[0].size = 1;
+	req_data->ops[0].flags = GB_I2C_M_RD;
+
+	/* Deferred transfers are watched until they complete, like the others */
+	atomic_set(&i2c_emul_delay_ms, 4 * gb_i2c_driver.op_budget_ms);
+	greybus_rx_handler(1, req);
+
+	/* AP does not wait for the bus */
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_I2C_TYPE_TRANSFER),
+		      "Invalid response type");
+	zassert_equal(resp.msg->header.operation_id, operation_id, "Invalid operation id");
+	zassert_equal(resp.msg->header.result, GB_OP_TIMEOUT, "Expected a timeout response");
+	gb_message_dealloc(resp.msg);
+
+	/* Let the handler return and send its response */
+	k_msleep(8 * gb_i2c_driver.op_budget_ms);
+	atomic_set(&i2c_emul_delay_ms, 0);
+
+	/* The late response was dropped, the next message answers a new request */
+	req = gb_message_request_alloc(0, GB_I2C_TYPE_FUNCTIONALITY, false);
+	operation_id = req->header.operation_id;
+	greybus_rx_handler(1, req);
+
+	resp = gb_transport_get_message();
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_I2C_TYPE_FUNCTIONALITY),
+		      "Late transfer response was sent");
+	zassert_equal(resp.msg->header.operation_id, operation_id, "Invalid operation id");
+	gb_message_dealloc(resp.msg);
+}
+#endif // CONFIG_GREYBUS_OPERATION_WATCHDOG_ABORT
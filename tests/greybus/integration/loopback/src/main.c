@@ -8,12 +8,75 @@
 #include <zephyr/ztest.h>
 #include <greybus/greybus.h>
 #include <greybus-utils/manifest.h>
+#include "gb_test_common.h"
+#include "greybus_operation.h"
+#ifdef CONFIG_GREYBUS_HOST
+#include <greybus/greybus_host.h>
+#endif // CONFIG_GREYBUS_HOST
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+#include <zephyr/irq_offload.h>
+#include "greybus_heap.h"
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
+#ifdef CONFIG_GREYBUS_RX_LOCKLESS
+#include "greybus_rx_ring.h"
+#endif // CONFIG_GREYBUS_RX_LOCKLESS
 
 #define REQ_SIZE 256
 
-struct gb_msg_with_cport gb_transport_get_message(void);
+/* The dummy transport can only hold GREYBUS_CPORT_COUNT * 2 responses */
+#define SINK_BURST_LEN   MIN(GREYBUS_CPORT_COUNT * 2, CONFIG_GREYBUS_CPORT_RX_QUEUE_DEPTH)
+#define SINK_BURST_COUNT 250
 
-ZTEST_SUITE(greybus_loopback_tests, NULL, NULL, NULL, NULL, NULL);
+extern const struct gb_transport_backend gb_trans_dummy;
+
+/* Second transport, for the AP of test_multi_transport */
+K_MSGQ_DEFINE(second_msgq, sizeof(struct gb_msg_with_cport), 4, 1);
+
+static int second_init(void)
+{
+	return 0;
+}
+
+static int second_listen(uint16_t cport)
+{
+	return 0;
+}
+
+static int second_send(uint16_t cport, const struct gb_message *msg)
+{
+	int ret;
+	const struct gb_msg_with_cport msg_ref = {
+		.cport = cport,
+		.msg = gb_message_share(msg),
+	};
+
+	if (!msg_ref.msg) {
+		return -ENOMEM;
+	}
+
+	ret = k_msgq_put(&second_msgq, &msg_ref, K_NO_WAIT);
+	if (ret < 0) {
+		gb_message_unref(msg_ref.msg);
+	}
+
+	return ret;
+}
+
+static const struct gb_transport_backend second_transport = {
+	.init = second_init,
+	.listen = second_listen,
+	.send = second_send,
+};
+
+/* AP connects the CPort under test before using it */
+static void *greybus_loopback_setup(void)
+{
+	gb_test_connect(1);
+
+	return NULL;
+}
+
+ZTEST_SUITE(greybus_loopback_tests, NULL, greybus_loopback_setup, NULL, NULL, NULL);
 
 ZTEST(greybus_loopback_tests, test_cport_count)
 {
@@ -36,6 +99,151 @@ ZTEST(greybus_loopback_tests, test_ping)
 	gb_message_dealloc(resp.msg);
 }
 
+/* Messages on the stack have no reference count, the helpers leave them alone */
+ZTEST(greybus_loopback_tests, test_message_on_stack)
+{
+	struct gb_message *copy;
+	struct gb_message msg = {
+		.header =
+			{
+				.size = sys_cpu_to_le16(sizeof(struct gb_message)),
+				.type = GB_LOOPBACK_TYPE_PING,
+			},
+	};
+
+	zassert_false(gb_message_is_shared(&msg), "Message on the stack is shared");
+	zassert_equal(gb_message_ref(&msg), &msg, "Invalid message");
+	gb_message_unref(&msg);
+	gb_message_dealloc(&msg);
+
+	/* Kept as a copy on the heap */
+	copy = gb_message_share(&msg);
+	zassert_not_null(copy, "Failed to share message");
+	zassert_not_equal(copy, &msg, "Message on the stack was not copied");
+	zassert_false(gb_message_is_shared(copy), "Copy is shared");
+	gb_message_unref(copy);
+}
+
+/* AP may repeat Connected, the CPort stays usable */
+ZTEST(greybus_loopback_tests, test_connect_twice)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+
+	gb_test_connect(1);
+
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_true(gb_message_is_success(resp.msg), "Greybus loopback ping failed");
+
+	gb_message_dealloc(resp.msg);
+}
+
+/* Inline operations do not overtake the operations queued before them */
+ZTEST(greybus_loopback_tests, test_inline_order)
+{
+	size_t i;
+	uint16_t sink_id, ping_id;
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+
+	for (i = 0; i < SINK_BURST_COUNT; i++) {
+		req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_SINK, false);
+		sink_id = req->header.operation_id;
+		greybus_rx_handler(1, req);
+
+		req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+		ping_id = req->header.operation_id;
+		greybus_rx_handler(1, req);
+
+		resp = gb_transport_get_message();
+		zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_LOOPBACK_TYPE_SINK),
+			      "Ping overtook sink");
+		zassert_equal(resp.msg->header.operation_id, sink_id, "Invalid operation id");
+		gb_message_dealloc(resp.msg);
+
+		resp = gb_transport_get_message();
+		zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_LOOPBACK_TYPE_PING),
+			      "Invalid response type");
+		zassert_equal(resp.msg->header.operation_id, ping_id, "Invalid operation id");
+		gb_message_dealloc(resp.msg);
+	}
+}
+
+static K_SEM_DEFINE(op_sem, 0, 1);
+static int op_err;
+static uint16_t op_cport;
+static uint16_t op_resp_id;
+static void *op_user_data;
+
+static void op_callback(uint16_t cport, struct gb_message *resp, int err, void *user_data)
+{
+	op_cport = cport;
+	op_err = err;
+	op_user_data = user_data;
+	op_resp_id = resp ? resp->header.operation_id : 0;
+
+	if (resp) {
+		gb_message_dealloc(resp);
+	}
+
+	k_sem_give(&op_sem);
+}
+
+/* Send a module request to AP, returns its operation id once it is on the wire */
+static uint16_t op_request_send(k_timeout_t timeout)
+{
+	uint16_t operation_id;
+	struct gb_msg_with_cport sent;
+	struct gb_message *req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+
+	operation_id = req->header.operation_id;
+	zassert_equal(gb_operation_request_send(req, 1, op_callback, &op_sem, timeout), 0,
+		      "Failed to send request");
+	gb_message_dealloc(req);
+
+	sent = gb_transport_get_message();
+	zassert_equal(sent.cport, 1, "Invalid cport");
+	zassert_false(gb_message_is_response(sent.msg), "Request expected");
+	zassert_equal(sent.msg->header.operation_id, operation_id, "Invalid operation id");
+	gb_message_dealloc(sent.msg);
+
+	return operation_id;
+}
+
+/* The response of AP goes to the callback of its request */
+ZTEST(greybus_loopback_tests, test_operation_response)
+{
+	uint16_t operation_id = op_request_send(K_SECONDS(10));
+
+	greybus_rx_handler(1, gb_message_response_alloc(NULL, 0, GB_LOOPBACK_TYPE_PING,
+							operation_id, GB_OP_SUCCESS));
+
+	zassert_equal(k_sem_take(&op_sem, K_SECONDS(1)), 0, "Callback not called");
+	zassert_equal(op_err, 0, "Unexpected error");
+	zassert_equal(op_cport, 1, "Invalid cport");
+	zassert_equal(op_resp_id, operation_id, "Invalid response");
+	zassert_equal_ptr(op_user_data, &op_sem, "Invalid user data");
+}
+
+/* A request AP does not answer in time fails, its late response is dropped */
+ZTEST(greybus_loopback_tests, test_operation_timeout)
+{
+	uint16_t operation_id = op_request_send(K_MSEC(10));
+
+	zassert_equal(k_sem_take(&op_sem, K_SECONDS(1)), 0, "Timeout not delivered");
+	zassert_equal(op_err, -ETIMEDOUT, "Timeout expected");
+	zassert_equal(op_cport, 1, "Invalid cport");
+	zassert_equal(op_resp_id, 0, "No response expected");
+	zassert_equal_ptr(op_user_data, &op_sem, "Invalid user data");
+
+	greybus_rx_handler(1, gb_message_response_alloc(NULL, 0, GB_LOOPBACK_TYPE_PING,
+							operation_id, GB_OP_SUCCESS));
+	zassert_equal(k_sem_take(&op_sem, K_MSEC(50)), -EAGAIN, "Callback called twice");
+}
+
 ZTEST(greybus_loopback_tests, test_sink)
 {
 	size_t i;
@@ -66,7 +274,6 @@ ZTEST(greybus_loopback_tests, test_transfer)
 {
 	size_t i;
 	struct gb_msg_with_cport resp;
-	struct gb_message *req_copy;
 	struct gb_message *req =
 		gb_message_request_alloc(sizeof(struct gb_loopback_transfer_request) + REQ_SIZE,
 					 GB_LOOPBACK_TYPE_TRANSFER, false);
@@ -78,8 +285,8 @@ ZTEST(greybus_loopback_tests, test_transfer)
 		req_data->data[i] = i;
 	}
 
-	req_copy = gb_message_copy(req);
-	greybus_rx_handler(1, req_copy);
+	/* Keep the request to compare, the response cannot reuse it then */
+	greybus_rx_handler(1, gb_message_ref(req));
 	resp = gb_transport_get_message();
 	zassert_true(gb_message_is_success(resp.msg), "Greybus loopback sink failed");
 	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_LOOPBACK_TYPE_TRANSFER),
@@ -88,7 +295,817 @@ ZTEST(greybus_loopback_tests, test_transfer)
 		      "Greybus transfer request should have same size response");
 	zassert_equal(memcmp(req->payload, resp.msg->payload, gb_message_payload_len(resp.msg)), 0,
 		      "Response data should be same as request");
+	zassert_equal(gb_message_type(req), GB_LOOPBACK_TYPE_TRANSFER, "Shared request modified");
 
 	gb_message_dealloc(req);
 	gb_message_dealloc(resp.msg);
 }
+
+ZTEST(greybus_loopback_tests, test_sink_burst)
+{
+	size_t i, j;
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	struct gb_loopback_transfer_request *req_data;
+	uint16_t op_ids[SINK_BURST_LEN];
+
+	for (i = 0; i < SINK_BURST_COUNT; i++) {
+		for (j = 0; j < SINK_BURST_LEN; j++) {
+			req = gb_message_request_alloc(sizeof(struct gb_loopback_transfer_request),
+						       GB_LOOPBACK_TYPE_SINK, false);
+			req_data = (struct gb_loopback_transfer_request *)req->payload;
+			req_data->len = 0;
+			op_ids[j] = req->header.operation_id;
+
+			greybus_rx_handler(1, req);
+		}
+
+		/* Responses on a CPort must come back in request order */
+		for (j = 0; j < SINK_BURST_LEN; j++) {
+			resp = gb_transport_get_message();
+			zassert_true(gb_message_is_success(resp.msg),
+				     "Greybus loopback sink failed");
+			zassert_equal(resp.msg->header.operation_id, op_ids[j],
+				      "Response out of order");
+			gb_message_dealloc(resp.msg);
+		}
+	}
+}
+
+#ifdef CONFIG_GREYBUS_RX_LOCKLESS
+/* Stand-ins for messages, the ring only stores the pointers */
+static uint32_t ring_tokens[4 * GB_RX_RING_SIZE + 1];
+
+#define RING_MSG(_i) ((struct gb_message *)&ring_tokens[(_i) % ARRAY_SIZE(ring_tokens)])
+
+ZTEST(greybus_loopback_tests, test_rx_ring)
+{
+	size_t i, round;
+	struct gb_rx_ring ring;
+
+	gb_rx_ring_init(&ring);
+	zassert_equal(gb_rx_ring_used(&ring), 0, "New ring not empty");
+	zassert_is_null(gb_rx_ring_get(&ring), "Empty ring returned a message");
+
+	/* Filled and emptied until the indices ran over their wrap bit twice */
+	for (round = 0; round < 4; round++) {
+		for (i = 0; i < GB_RX_RING_SIZE; i++) {
+			zassert_true(gb_rx_ring_put(&ring, RING_MSG(i)), "Ring full too early");
+			zassert_equal(gb_rx_ring_used(&ring), i + 1, "Invalid ring usage");
+		}
+
+		zassert_false(gb_rx_ring_put(&ring, RING_MSG(GB_RX_RING_SIZE)),
+			      "Full ring took a message");
+		zassert_equal(gb_rx_ring_used(&ring), GB_RX_RING_SIZE, "Invalid ring usage");
+
+		for (i = 0; i < GB_RX_RING_SIZE; i++) {
+			zassert_equal_ptr(gb_rx_ring_get(&ring), RING_MSG(i), "Ring out of order");
+		}
+
+		zassert_equal(gb_rx_ring_used(&ring), 0, "Emptied ring not empty");
+		zassert_is_null(gb_rx_ring_get(&ring), "Empty ring returned a message");
+	}
+
+	/* One message ahead of the consumer, every slot is reused at every index */
+	zassert_true(gb_rx_ring_put(&ring, RING_MSG(0)), "Put failed");
+	for (i = 1; i < ARRAY_SIZE(ring_tokens); i++) {
+		zassert_true(gb_rx_ring_put(&ring, RING_MSG(i)), "Put failed");
+		zassert_equal_ptr(gb_rx_ring_get(&ring), RING_MSG(i - 1), "Ring out of order");
+		zassert_equal(gb_rx_ring_used(&ring), 1, "Invalid ring usage");
+	}
+
+	zassert_equal_ptr(gb_rx_ring_get(&ring), RING_MSG(i - 1), "Ring out of order");
+	zassert_is_null(gb_rx_ring_get(&ring), "Empty ring returned a message");
+}
+#endif // CONFIG_GREYBUS_RX_LOCKLESS
+
+ZTEST(greybus_loopback_tests, test_sink_retry)
+{
+	size_t i;
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	struct gb_loopback_transfer_request *req_data;
+	uint16_t op_ids[CONFIG_GREYBUS_CPORT_RX_QUEUE_DEPTH + 1];
+
+	BUILD_ASSERT(ARRAY_SIZE(op_ids) <= GREYBUS_CPORT_COUNT * 2,
+		     "Responses do not fit in the dummy transport");
+
+	/* k_sched_lock does not keep workers on other CPUs away */
+	Z_TEST_SKIP_IFDEF(CONFIG_SMP);
+
+	/* Keep the workers away until the CPort queue has overflowed */
+	k_sched_lock();
+	for (i = 0; i < ARRAY_SIZE(op_ids); i++) {
+		req = gb_message_request_alloc(sizeof(struct gb_loopback_transfer_request),
+					       GB_LOOPBACK_TYPE_SINK, false);
+		req_data = (struct gb_loopback_transfer_request *)req->payload;
+		req_data->len = 0;
+		op_ids[i] = req->header.operation_id;
+
+		greybus_rx_handler(1, req);
+	}
+	k_sched_unlock();
+
+	/* The overflowing request is rejected right away */
+	resp = gb_transport_get_message();
+	zassert_equal(resp.msg->header.result, GB_OP_RETRY, "Expected a retry response");
+	zassert_equal(resp.msg->header.operation_id, op_ids[ARRAY_SIZE(op_ids) - 1],
+		      "Wrong operation rejected");
+	gb_message_dealloc(resp.msg);
+
+	for (i = 0; i < ARRAY_SIZE(op_ids) - 1; i++) {
+		resp = gb_transport_get_message();
+		zassert_true(gb_message_is_success(resp.msg), "Greybus loopback sink failed");
+		zassert_equal(resp.msg->header.operation_id, op_ids[i], "Response out of order");
+		gb_message_dealloc(resp.msg);
+	}
+}
+
+ZTEST(greybus_loopback_tests, test_disconnected_cport)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	struct gb_control_disconnected_request *req_data;
+
+	gb_test_control_request(GB_CONTROL_TYPE_DISCONNECTING, 1);
+	gb_test_control_request(GB_CONTROL_TYPE_DISCONNECTED, 1);
+
+	/* The driver is not told twice */
+	req = gb_message_request_alloc(sizeof(*req_data), GB_CONTROL_TYPE_DISCONNECTED, false);
+	req_data = (struct gb_control_disconnected_request *)req->payload;
+	req_data->cport_id = sys_cpu_to_le16(1);
+	greybus_rx_handler(0, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 0, "Invalid cport");
+	zassert_equal(resp.msg->header.result, GB_OP_INVALID,
+		      "Disconnected accepted for a disconnected cport");
+	gb_message_dealloc(resp.msg);
+
+	/* Dropped without a response */
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler(1, req);
+
+	/* The next message must be the response to connected */
+	gb_test_connect(1);
+
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_LOOPBACK_TYPE_PING),
+		      "Invalid request response");
+
+	gb_message_dealloc(resp.msg);
+}
+
+ZTEST(greybus_loopback_tests, test_restart)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+
+	/* Response is never read, the restart has to free it */
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler(1, req);
+
+	zassert_equal(gb_restart(), 0, "Greybus restart failed");
+
+	/* All CPorts are disconnected after a restart */
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler(1, req);
+
+	gb_test_connect(1);
+
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_true(gb_message_is_success(resp.msg), "Greybus loopback ping failed");
+
+	gb_message_dealloc(resp.msg);
+}
+
+ZTEST(greybus_loopback_tests, test_multi_transport)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	struct gb_control_connected_request *req_data;
+	const struct gb_transport_backend *const transports[] = {&gb_trans_dummy,
+								  &second_transport};
+
+	gb_deinit();
+	zassert_equal(gb_init_transports(transports, ARRAY_SIZE(transports)), 0,
+		      "Greybus init on two transports failed");
+
+	/* AP of the second transport connects the CPort, the response goes back to it */
+	req = gb_message_request_alloc(sizeof(*req_data), GB_CONTROL_TYPE_CONNECTED, false);
+	req_data = (struct gb_control_connected_request *)req->payload;
+	req_data->cport_id = sys_cpu_to_le16(1);
+	greybus_rx_handler_from(&second_transport, 0, req);
+	zassert_equal(k_msgq_get(&second_msgq, &resp, K_SECONDS(1)), 0, "No connected response");
+	zassert_equal(resp.cport, 0, "Invalid cport");
+	zassert_true(gb_message_is_success(resp.msg), "Failed to connect cport");
+	gb_message_dealloc(resp.msg);
+
+	/* The CPort does not belong to the AP of the first transport, dropped */
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler(1, req);
+
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler_from(&second_transport, 1, req);
+	zassert_equal(k_msgq_get(&second_msgq, &resp, K_SECONDS(1)), 0, "No ping response");
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_true(gb_message_is_success(resp.msg), "Greybus loopback ping failed");
+	gb_message_dealloc(resp.msg);
+
+	/* The first transport still shares the control CPort. Its next message must be this. */
+	gb_test_control_request(GB_CONTROL_TYPE_VERSION, 0);
+
+	/* Back to the dummy transport alone for the other tests */
+	gb_deinit();
+	zassert_equal(gb_init(&gb_trans_dummy), 0, "Greybus init failed");
+	gb_test_connect(1);
+}
+
+static struct gb_msg_with_cport second_get_message(void)
+{
+	struct gb_msg_with_cport resp = {0};
+
+	k_msgq_get(&second_msgq, &resp, K_SECONDS(1));
+
+	return resp;
+}
+
+/* AP behind a transport connects CPort 1, the response goes back on that transport */
+static uint8_t connect_result(const struct gb_transport_backend *transport,
+			      struct gb_msg_with_cport (*get_message)(void))
+{
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	struct gb_control_connected_request *req_data;
+	uint8_t result;
+
+	req = gb_message_request_alloc(sizeof(*req_data), GB_CONTROL_TYPE_CONNECTED, false);
+	req_data = (struct gb_control_connected_request *)req->payload;
+	req_data->cport_id = sys_cpu_to_le16(1);
+	greybus_rx_handler_from(transport, 0, req);
+
+	resp = get_message();
+	zassert_not_null(resp.msg, "No connected response");
+	zassert_equal(resp.cport, 0, "Invalid cport");
+	result = resp.msg->header.result;
+	gb_message_dealloc(resp.msg);
+
+	return result;
+}
+
+/* A repeated Connected only succeeds for the AP that owns the CPort */
+ZTEST(greybus_loopback_tests, test_multi_transport_connect_twice)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	const struct gb_transport_backend *const transports[] = {&gb_trans_dummy,
+								  &second_transport};
+
+	gb_deinit();
+	zassert_equal(gb_init_transports(transports, ARRAY_SIZE(transports)), 0,
+		      "Greybus init on two transports failed");
+
+	zassert_equal(connect_result(&second_transport, second_get_message), GB_OP_SUCCESS,
+		      "Failed to connect cport");
+	zassert_equal(connect_result(&second_transport, second_get_message), GB_OP_SUCCESS,
+		      "Repeated connect by the owner failed");
+	zassert_equal(connect_result(&gb_trans_dummy, gb_transport_get_message),
+		      GB_OP_INVALID, "CPort connected by the AP of another transport");
+
+	/* The CPort still belongs to the AP of the second transport */
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler_from(&second_transport, 1, req);
+	resp = second_get_message();
+	zassert_not_null(resp.msg, "No ping response");
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_true(gb_message_is_success(resp.msg), "Greybus loopback ping failed");
+	gb_message_dealloc(resp.msg);
+
+	/* Back to the dummy transport alone for the other tests */
+	gb_deinit();
+	zassert_equal(gb_init(&gb_trans_dummy), 0, "Greybus init failed");
+	gb_test_connect(1);
+}
+
+#define CONTROL_RACE_COUNT 100
+
+K_THREAD_STACK_DEFINE(control_race_stack, 1024);
+static struct k_thread control_race_thread;
+
+/*
+ * Send a control request until it is answered with success, retrying while the control CPort
+ * queue is full.
+ *
+ * @return false if a response is lost or does not match the request.
+ */
+static bool control_race_request(const struct gb_transport_backend *transport,
+				 struct gb_msg_with_cport (*get_message)(void))
+{
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	uint16_t op_id;
+	bool retry, ok;
+
+	do {
+		req = gb_message_request_alloc(0, GB_CONTROL_TYPE_TIMESYNC_ENABLE, false);
+		op_id = req->header.operation_id;
+		greybus_rx_handler_from(transport, 0, req);
+
+		resp = get_message();
+		if (!resp.msg) {
+			return false;
+		}
+
+		retry = resp.msg->header.result == GB_OP_RETRY;
+		ok = resp.cport == 0 && resp.msg->header.operation_id == op_id &&
+		     (retry || gb_message_is_success(resp.msg));
+		gb_message_dealloc(resp.msg);
+	} while (ok && retry);
+
+	return ok;
+}
+
+static void control_race_entry(void *p1, void *p2, void *p3)
+{
+	size_t *failed = p1;
+	size_t i;
+
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	for (i = 0; i < CONTROL_RACE_COUNT; i++) {
+		if (!control_race_request(&second_transport, second_get_message)) {
+			(*failed)++;
+		}
+	}
+}
+
+/* The receive threads of both transports queue on the control CPort at the same time */
+ZTEST(greybus_loopback_tests, test_multi_transport_control)
+{
+	size_t i, failed = 0, second_failed = 0;
+	const struct gb_transport_backend *const transports[] = {&gb_trans_dummy,
+								  &second_transport};
+
+	gb_deinit();
+	zassert_equal(gb_init_transports(transports, ARRAY_SIZE(transports)), 0,
+		      "Greybus init on two transports failed");
+
+	k_thread_create(&control_race_thread, control_race_stack,
+			K_THREAD_STACK_SIZEOF(control_race_stack), control_race_entry,
+			&second_failed, NULL, NULL, k_thread_priority_get(k_current_get()), 0,
+			K_NO_WAIT);
+
+	for (i = 0; i < CONTROL_RACE_COUNT; i++) {
+		if (!control_race_request(&gb_trans_dummy, gb_transport_get_message)) {
+			failed++;
+		}
+	}
+
+	k_thread_join(&control_race_thread, K_FOREVER);
+	zassert_equal(failed, 0, "Control responses lost on the first transport");
+	zassert_equal(second_failed, 0, "Control responses lost on the second transport");
+
+	/* Back to the dummy transport alone for the other tests */
+	gb_deinit();
+	zassert_equal(gb_init(&gb_trans_dummy), 0, "Greybus init failed");
+	gb_test_connect(1);
+}
+
+#ifdef CONFIG_GREYBUS_BRIDGE
+/* A downstream node with 4 CPorts, behind the second transport */
+static const struct gb_bridge_link bridge_link = {
+	.transport = &second_transport,
+	.cport_base = GREYBUS_CPORT_COUNT,
+	.cport_count = 4,
+};
+
+ZTEST(greybus_loopback_tests, test_bridge)
+{
+	uint16_t operation_id;
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	struct gb_control_connected_request *req_data;
+	const struct gb_transport_backend *const transports[] = {&gb_trans_dummy,
+								  &second_transport};
+
+	gb_deinit();
+	zassert_equal(gb_bridge_set(&gb_trans_dummy, &bridge_link, 1), 0, "Bridge setup failed");
+	zassert_equal(gb_init_transports(transports, ARRAY_SIZE(transports)), 0,
+		      "Greybus init on two transports failed");
+
+	/* AP connects CPort 1 of the node, through the control CPort of the node */
+	req = gb_message_request_alloc(sizeof(*req_data), GB_CONTROL_TYPE_CONNECTED, false);
+	req_data = (struct gb_control_connected_request *)req->payload;
+	req_data->cport_id = sys_cpu_to_le16(GREYBUS_CPORT_COUNT + 1);
+	operation_id = req->header.operation_id;
+	greybus_rx_handler(GREYBUS_CPORT_COUNT, req);
+
+	zassert_equal(k_msgq_get(&second_msgq, &resp, K_SECONDS(1)), 0, "Request not forwarded");
+	zassert_equal(resp.cport, 0, "Invalid node cport");
+	zassert_equal(resp.msg->header.operation_id, operation_id, "Invalid operation id");
+	req_data = (struct gb_control_connected_request *)resp.msg->payload;
+	zassert_equal(sys_le16_to_cpu(req_data->cport_id), 1, "CPort id not remapped");
+	gb_message_dealloc(resp.msg);
+
+	/* The node answers, AP gets the response in the window of the node */
+	greybus_rx_handler_from(&second_transport, 0,
+				gb_message_response_alloc(NULL, 0, GB_CONTROL_TYPE_CONNECTED,
+							  operation_id, GB_OP_SUCCESS));
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, GREYBUS_CPORT_COUNT, "Invalid upstream cport");
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_CONTROL_TYPE_CONNECTED),
+		      "Invalid response type");
+	zassert_equal(resp.msg->header.operation_id, operation_id, "Invalid operation id");
+	gb_message_dealloc(resp.msg);
+
+	/* A CPort outside of the node window, the node must refuse it */
+	req = gb_message_request_alloc(sizeof(*req_data), GB_CONTROL_TYPE_CONNECTED, false);
+	req_data = (struct gb_control_connected_request *)req->payload;
+	req_data->cport_id = sys_cpu_to_le16(1);
+	greybus_rx_handler(GREYBUS_CPORT_COUNT, req);
+
+	zassert_equal(k_msgq_get(&second_msgq, &resp, K_SECONDS(1)), 0, "Request not forwarded");
+	req_data = (struct gb_control_connected_request *)resp.msg->payload;
+	zassert_equal(sys_le16_to_cpu(req_data->cport_id), UINT16_MAX,
+		      "CPort outside of the node window forwarded as is");
+	gb_message_dealloc(resp.msg);
+
+	/* CPorts of the bridge itself are still served locally */
+	gb_test_control_request(GB_CONTROL_TYPE_VERSION, 0);
+
+	gb_deinit();
+	zassert_equal(gb_bridge_set(NULL, NULL, 0), 0, "Bridge teardown failed");
+	zassert_equal(gb_init(&gb_trans_dummy), 0, "Greybus init failed");
+	gb_test_connect(1);
+}
+#endif // CONFIG_GREYBUS_BRIDGE
+
+#ifdef CONFIG_GREYBUS_HOST
+/* Remote module behind the second transport. The test plays the wire to the local module. */
+static struct gb_host host = {
+	.transport = &second_transport,
+};
+
+static K_SEM_DEFINE(host_sem, 0, 1);
+static int host_err;
+static uint8_t host_result;
+static uint16_t host_cport;
+static void *host_user_data;
+
+static void host_cb(struct gb_host *h, uint16_t cport, struct gb_message *resp, int err,
+		    void *user_data)
+{
+	zassert_equal(h, &host, "Completed for the wrong host");
+	host_err = err;
+	host_cport = cport;
+	host_user_data = user_data;
+	if (resp) {
+		host_result = resp->header.result;
+		gb_message_dealloc(resp);
+	}
+	k_sem_give(&host_sem);
+}
+
+/* Carry a request of the host to the local module, and its response back */
+static void host_wire(void)
+{
+	struct gb_msg_with_cport msg;
+
+	zassert_equal(k_msgq_get(&second_msgq, &msg, K_SECONDS(1)), 0, "Request not sent");
+	greybus_rx_handler(msg.cport, msg.msg);
+
+	msg = gb_transport_get_message();
+	greybus_rx_handler_from(&second_transport, msg.cport, msg.msg);
+}
+
+ZTEST(greybus_loopback_tests, test_host)
+{
+	struct gb_msg_with_cport msg;
+	const struct gb_transport_backend *const transports[] = {&gb_trans_dummy,
+								  &second_transport};
+
+	gb_deinit();
+	zassert_equal(gb_host_register(&host), 0, "Host registration failed");
+	zassert_equal(gb_init_transports(transports, ARRAY_SIZE(transports)), 0,
+		      "Greybus init on two transports failed");
+
+	zassert_equal(gb_host_connect(&host, 1, host_cb, NULL, K_SECONDS(1)), 0,
+		      "Connect not sent");
+	host_wire();
+	zassert_equal(k_sem_take(&host_sem, K_SECONDS(1)), 0, "Connect not completed");
+	zassert_equal(host_err, 0, "Connect failed");
+	zassert_equal(host_result, GB_OP_SUCCESS, "Connect rejected");
+
+	zassert_equal(gb_host_request(&host, 1, GB_LOOPBACK_TYPE_PING, NULL, 0, host_cb, &host_sem,
+				      K_SECONDS(1)),
+		      0, "Ping not sent");
+	host_wire();
+	zassert_equal(k_sem_take(&host_sem, K_SECONDS(1)), 0, "Ping not completed");
+	zassert_equal(host_err, 0, "Ping failed");
+	zassert_equal(host_result, GB_OP_SUCCESS, "Ping rejected");
+	zassert_equal(host_cport, 1, "Ping completed on the wrong CPort");
+	zassert_equal(host_user_data, &host_sem, "Ping completed with the wrong user data");
+
+	/* Nobody answers */
+	zassert_equal(gb_host_request(&host, 1, GB_LOOPBACK_TYPE_PING, NULL, 0, host_cb, NULL,
+				      K_MSEC(10)),
+		      0, "Ping not sent");
+	zassert_equal(k_msgq_get(&second_msgq, &msg, K_SECONDS(1)), 0, "Ping not sent");
+	gb_message_dealloc(msg.msg);
+	zassert_equal(k_sem_take(&host_sem, K_SECONDS(1)), 0, "Ping did not time out");
+	zassert_equal(host_err, -ETIMEDOUT, "Ping did not time out");
+
+	/* Stopping greybus completes the requests still waiting */
+	zassert_equal(gb_host_request(&host, 1, GB_LOOPBACK_TYPE_PING, NULL, 0, host_cb, NULL,
+				      K_SECONDS(10)),
+		      0, "Ping not sent");
+	zassert_equal(k_msgq_get(&second_msgq, &msg, K_SECONDS(1)), 0, "Ping not sent");
+	gb_message_dealloc(msg.msg);
+
+	gb_deinit();
+	zassert_equal(k_sem_take(&host_sem, K_NO_WAIT), 0, "Ping not cancelled");
+	zassert_equal(host_err, -ECANCELED, "Ping not cancelled");
+	zassert_equal(gb_host_unregister(&host), 0, "Host unregistration failed");
+	zassert_equal(gb_init(&gb_trans_dummy), 0, "Greybus init failed");
+	gb_test_connect(1);
+}
+#endif // CONFIG_GREYBUS_HOST
+
+#ifdef CONFIG_GREYBUS_INTERFACES
+/* The loopback bundle belongs to the AP of the second transport, the first one only has control */
+static const struct gb_interface interfaces[] = {
+	{.transport = &gb_trans_dummy, .bundles = 0},
+	{.transport = &second_transport, .bundles = BIT(1)},
+};
+
+ZTEST(greybus_loopback_tests, test_interfaces)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	struct gb_control_connected_request *req_data;
+	const struct gb_control_get_manifest_size_response *size_data;
+	const struct gb_transport_backend *const transports[] = {&gb_trans_dummy,
+								  &second_transport};
+
+	gb_deinit();
+	zassert_equal(gb_interfaces_set(interfaces, ARRAY_SIZE(interfaces)), 0,
+		      "Interface setup failed");
+	zassert_equal(gb_init_transports(transports, ARRAY_SIZE(transports)), 0,
+		      "Greybus init on two transports failed");
+
+	/* The first interface does not have the loopback bundle */
+	req = gb_message_request_alloc(0, GB_CONTROL_TYPE_GET_MANIFEST_SIZE, false);
+	greybus_rx_handler(0, req);
+	resp = gb_transport_get_message();
+	zassert_true(gb_message_is_success(resp.msg), "Manifest size failed");
+	size_data = (const struct gb_control_get_manifest_size_response *)resp.msg->payload;
+	zassert_true(sys_le16_to_cpu(size_data->size) < manifest_size(), "Manifest not filtered");
+	gb_message_dealloc(resp.msg);
+
+	req = gb_message_request_alloc(sizeof(*req_data), GB_CONTROL_TYPE_CONNECTED, false);
+	req_data = (struct gb_control_connected_request *)req->payload;
+	req_data->cport_id = sys_cpu_to_le16(1);
+	greybus_rx_handler(0, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.msg->header.result, GB_OP_INVALID, "CPort of another interface");
+	gb_message_dealloc(resp.msg);
+
+	/* The second interface has it */
+	req = gb_message_request_alloc(sizeof(*req_data), GB_CONTROL_TYPE_CONNECTED, false);
+	req_data = (struct gb_control_connected_request *)req->payload;
+	req_data->cport_id = sys_cpu_to_le16(1);
+	greybus_rx_handler_from(&second_transport, 0, req);
+	zassert_equal(k_msgq_get(&second_msgq, &resp, K_SECONDS(1)), 0, "No connected response");
+	zassert_true(gb_message_is_success(resp.msg), "Failed to connect cport");
+	gb_message_dealloc(resp.msg);
+
+	/* Dropped, the first interface has no CPort 1 */
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler(1, req);
+
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler_from(&second_transport, 1, req);
+	zassert_equal(k_msgq_get(&second_msgq, &resp, K_SECONDS(1)), 0, "No ping response");
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_true(gb_message_is_success(resp.msg), "Greybus loopback ping failed");
+	gb_message_dealloc(resp.msg);
+
+	/* The next message of the first transport must be this */
+	gb_test_control_request(GB_CONTROL_TYPE_VERSION, 0);
+
+	gb_deinit();
+	zassert_equal(gb_interfaces_set(NULL, 0), 0, "Interface teardown failed");
+	zassert_equal(gb_init(&gb_trans_dummy), 0, "Greybus init failed");
+	gb_test_connect(1);
+}
+#endif // CONFIG_GREYBUS_INTERFACES
+
+#ifdef CONFIG_GREYBUS_CPORT_CREDITS
+ZTEST(greybus_loopback_tests, test_cport_credits)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_control_cport_credits_response *resp_data;
+	struct gb_message *req =
+		gb_message_request_alloc(sizeof(struct gb_control_cport_credits_request),
+					 GB_CONTROL_TYPE_CPORT_CREDITS, false);
+	struct gb_control_cport_credits_request *req_data =
+		(struct gb_control_cport_credits_request *)req->payload;
+
+	req_data->cport_id = sys_cpu_to_le16(1);
+
+	greybus_rx_handler(0, req);
+	resp = gb_transport_get_message();
+	zassert_true(gb_message_is_success(resp.msg), "Greybus cport credits failed");
+	zassert_equal(gb_message_payload_len(resp.msg), sizeof(*resp_data),
+		      "Invalid cport credits response size");
+
+	resp_data = (struct gb_control_cport_credits_response *)resp.msg->payload;
+	zassert_equal(sys_le16_to_cpu(resp_data->credits), CONFIG_GREYBUS_CPORT_RX_QUEUE_DEPTH,
+		      "Idle CPort should have all credits");
+	zassert_equal(sys_le16_to_cpu(resp_data->max_credits),
+		      CONFIG_GREYBUS_CPORT_RX_QUEUE_DEPTH, "Invalid max credits");
+
+	gb_message_dealloc(resp.msg);
+}
+#endif // CONFIG_GREYBUS_CPORT_CREDITS
+
+#ifdef CONFIG_GREYBUS_CPORT_QUOTA
+ZTEST(greybus_loopback_tests, test_cport_quota)
+{
+	size_t i;
+	struct gb_msg_with_cport resp;
+	struct gb_message *req;
+	struct gb_message *held[CONFIG_GREYBUS_CPORT_QUOTA_MESSAGES];
+
+	/* Requests stay charged to the CPort as long as someone holds them */
+	for (i = 0; i < ARRAY_SIZE(held); i++) {
+		req = gb_message_request_alloc(sizeof(struct gb_loopback_transfer_request),
+					       GB_LOOPBACK_TYPE_SINK, false);
+		((struct gb_loopback_transfer_request *)req->payload)->len = 0;
+		held[i] = gb_message_ref(req);
+
+		greybus_rx_handler(1, req);
+		resp = gb_transport_get_message();
+		zassert_true(gb_message_is_success(resp.msg), "Greybus loopback sink failed");
+		gb_message_dealloc(resp.msg);
+	}
+
+	/* Over quota, rejected without waiting for the heap */
+	req = gb_message_request_alloc(sizeof(struct gb_loopback_transfer_request),
+				       GB_LOOPBACK_TYPE_SINK, false);
+	((struct gb_loopback_transfer_request *)req->payload)->len = 0;
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_equal(resp.msg->header.result, GB_OP_NO_MEMORY, "Expected a no memory response");
+	gb_message_dealloc(resp.msg);
+
+	/* The control CPort is not held back by the others */
+	gb_test_control_request(GB_CONTROL_TYPE_TIMESYNC_ENABLE, 1);
+
+	for (i = 0; i < ARRAY_SIZE(held); i++) {
+		gb_message_dealloc(held[i]);
+	}
+
+	req = gb_message_request_alloc(0, GB_LOOPBACK_TYPE_PING, false);
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+	zassert_true(gb_message_is_success(resp.msg), "Quota not given back");
+	gb_message_dealloc(resp.msg);
+}
+#endif // CONFIG_GREYBUS_CPORT_QUOTA
+
+#ifdef CONFIG_GREYBUS_MESSAGE_SLABS
+#define SLAB_BLOCK(_size) ROUND_UP(_size, sizeof(void *))
+
+/*
+ * Allocate len bytes until a block that is not of class_size comes, at most count + 1 times. Other
+ * users can hold blocks of the class.
+ *
+ * @return number of blocks allocated, the last one being of another class
+ */
+static size_t slab_exhaust(void **blocks, size_t count, size_t len, size_t class_size)
+{
+	size_t i;
+
+	for (i = 0; i <= count; ++i) {
+		blocks[i] = gb_alloc_nowait(len);
+		zassert_not_null(blocks[i], "Allocation of %zu bytes failed", len);
+		if (gb_alloc_size(blocks[i]) != class_size) {
+			return i + 1;
+		}
+	}
+
+	zassert_unreachable("More than %zu blocks of %zu bytes", count, class_size);
+	return 0;
+}
+
+static void slab_free_all(void **blocks, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; ++i) {
+		gb_free(blocks[i]);
+	}
+}
+
+/* The smallest class that fits is taken */
+ZTEST(greybus_loopback_tests, test_slab_class)
+{
+	static const struct {
+		size_t len;
+		size_t block;
+	} cases[] = {
+		{1, SLAB_BLOCK(CONFIG_GREYBUS_SLAB_SMALL_SIZE)},
+		{CONFIG_GREYBUS_SLAB_SMALL_SIZE, SLAB_BLOCK(CONFIG_GREYBUS_SLAB_SMALL_SIZE)},
+		{CONFIG_GREYBUS_SLAB_SMALL_SIZE + 1, SLAB_BLOCK(CONFIG_GREYBUS_SLAB_MEDIUM_SIZE)},
+		{CONFIG_GREYBUS_SLAB_MEDIUM_SIZE + 1, SLAB_BLOCK(CONFIG_GREYBUS_SLAB_LARGE_SIZE)},
+		{CONFIG_GREYBUS_SLAB_LARGE_SIZE + 1, SLAB_BLOCK(CONFIG_GREYBUS_SLAB_MAX_SIZE)},
+	};
+	size_t i;
+	void *ptr;
+
+	for (i = 0; i < ARRAY_SIZE(cases); ++i) {
+		ptr = gb_alloc_nowait(cases[i].len);
+		zassert_not_null(ptr, "Allocation of %zu bytes failed", cases[i].len);
+		zassert_true(gb_heap_owns(ptr), "Block not owned");
+		zassert_equal(gb_alloc_size(ptr), cases[i].block, "Invalid class for %zu bytes",
+			      cases[i].len);
+		gb_free(ptr);
+	}
+}
+
+/* An exhausted class hands over to the next one, blocks go back to their own class */
+ZTEST(greybus_loopback_tests, test_slab_next_class)
+{
+	void *blocks[CONFIG_GREYBUS_SLAB_SMALL_COUNT + 1];
+	size_t num;
+	void *ptr;
+
+	num = slab_exhaust(blocks, CONFIG_GREYBUS_SLAB_SMALL_COUNT, 1,
+			   SLAB_BLOCK(CONFIG_GREYBUS_SLAB_SMALL_SIZE));
+	zassert_equal(gb_alloc_size(blocks[num - 1]), SLAB_BLOCK(CONFIG_GREYBUS_SLAB_MEDIUM_SIZE),
+		      "Medium class expected");
+
+	slab_free_all(blocks, num);
+
+	ptr = gb_alloc_nowait(1);
+	zassert_equal(gb_alloc_size(ptr), SLAB_BLOCK(CONFIG_GREYBUS_SLAB_SMALL_SIZE),
+		      "Small block not given back");
+	gb_free(ptr);
+}
+
+/* Messages too large for the slabs, or with the slabs exhausted, come from the heap */
+ZTEST(greybus_loopback_tests, test_slab_heap_fallback)
+{
+	void *blocks[CONFIG_GREYBUS_SLAB_MAX_COUNT + 1];
+	size_t num;
+	void *ptr;
+
+	ptr = gb_alloc_nowait(CONFIG_GREYBUS_SLAB_MAX_SIZE + 1);
+	zassert_not_null(ptr, "Heap allocation failed");
+	zassert_true(gb_heap_owns(ptr), "Block not owned");
+	zassert_true(gb_alloc_size(ptr) > SLAB_BLOCK(CONFIG_GREYBUS_SLAB_MAX_SIZE),
+		     "Heap block expected");
+	gb_free(ptr);
+
+	num = slab_exhaust(blocks, CONFIG_GREYBUS_SLAB_MAX_COUNT, CONFIG_GREYBUS_SLAB_MAX_SIZE,
+			   SLAB_BLOCK(CONFIG_GREYBUS_SLAB_MAX_SIZE));
+	zassert_true(gb_heap_owns(blocks[num - 1]), "Block not owned");
+
+	slab_free_all(blocks, num);
+
+	ptr = gb_alloc_nowait(CONFIG_GREYBUS_SLAB_MAX_SIZE);
+	zassert_equal(gb_alloc_size(ptr), SLAB_BLOCK(CONFIG_GREYBUS_SLAB_MAX_SIZE),
+		      "Largest block not given back");
+	gb_free(ptr);
+}
+
+static void *isr_alloc;
+
+static void slab_isr_alloc(const void *param)
+{
+	isr_alloc = gb_alloc((size_t)param);
+}
+
+/* Interrupt handlers get NULL instead of waiting for memory */
+ZTEST(greybus_loopback_tests, test_slab_isr_no_wait)
+{
+	irq_offload(slab_isr_alloc, (const void *)(uintptr_t)1);
+	zassert_not_null(isr_alloc, "Slab allocation from ISR failed");
+	zassert_equal(gb_alloc_size(isr_alloc), SLAB_BLOCK(CONFIG_GREYBUS_SLAB_SMALL_SIZE),
+		      "Small block expected");
+	gb_free(isr_alloc);
+
+	/* Would wait forever on a thread */
+	irq_offload(slab_isr_alloc,
+		    (const void *)(uintptr_t)(CONFIG_GREYBUS_HEAP_MEM_POOL_SIZE * 2));
+	zassert_is_null(isr_alloc, "Allocation larger than the heap succeeded");
+}
+#endif // CONFIG_GREYBUS_MESSAGE_SLABS
@@ -8,6 +8,7 @@
 #include <zephyr/ztest.h>
 #include <greybus/greybus.h>
 #include <greybus-utils/manifest.h>
+#include "gb_test_common.h"
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/spi.h>
@@ -18,8 +19,6 @@
 
 static const struct device *dev = DEVICE_DT_GET(DT_NODELABEL(spi0));
 
-struct gb_msg_with_cport gb_transport_get_message(void);
-
 static int spi_emul_io(const struct emul *target, const struct spi_config *config,
 		       const struct spi_buf_set *tx_bufs, const struct spi_buf_set *rx_bufs)
 {
@@ -65,7 +64,20 @@ static struct spi_emul spi_emul = {
 	.chipsel = 0,
 };
 
-ZTEST_SUITE(greybus_spi_tests, NULL, NULL, NULL, NULL, NULL);
+/* AP connects the CPort under test before using it */
+static void *greybus_spi_setup(void)
+{
+	int ret;
+
+	ret = spi_emul_register(dev, &spi_emul);
+	zassert_equal(ret, 0, "Failed to register spi device");
+
+	gb_test_connect(1);
+
+	return NULL;
+}
+
+ZTEST_SUITE(greybus_spi_tests, NULL, greybus_spi_setup, NULL, NULL, NULL);
 
 ZTEST(greybus_spi_tests, test_cport_count)
 {
@@ -74,7 +86,7 @@ ZTEST(greybus_spi_tests, test_cport_count)
 
 ZTEST(greybus_spi_tests, test_transfer)
 {
-	int i, ret;
+	int i;
 	uint8_t *write_data;
 	struct gb_msg_with_cport resp;
 	struct gb_spi_transfer_request *req_data;
@@ -83,9 +95,6 @@ ZTEST(greybus_spi_tests, test_transfer)
 			TRANSFER_BUF * (OP_COUNT - 1),
 		GB_SPI_TYPE_TRANSFER, false);
 
-	ret = spi_emul_register(dev, &spi_emul);
-	zassert_equal(ret, 0, "Failed to register spi device");
-
 	memset(req->payload, 0, gb_message_payload_len(req));
 
 	req_data = (struct gb_spi_transfer_request *)req->payload;
@@ -133,3 +142,88 @@ ZTEST(greybus_spi_tests, test_transfer)
 
 	gb_message_dealloc(resp.msg);
 }
+
+/* Register read: the read data fits in the request, which becomes the response */
+ZTEST(greybus_spi_tests, test_write_read)
+{
+	int i;
+	uint8_t *write_data;
+	struct gb_msg_with_cport resp;
+	struct gb_spi_transfer_request *req_data;
+	struct gb_message *req = gb_message_request_alloc(
+		sizeof(*req_data) + sizeof(struct gb_spi_transfer) * 2 + TRANSFER_BUF,
+		GB_SPI_TYPE_TRANSFER, false);
+
+	memset(req->payload, 0, gb_message_payload_len(req));
+
+	req_data = (struct gb_spi_transfer_request *)req->payload;
+	req_data->count = sys_cpu_to_le16(2);
+
+	write_data = (uint8_t *)&req_data->transfers[2];
+
+	req_data->transfers[0].speed_hz = 10000;
+	req_data->transfers[0].len = sys_cpu_to_le32(TRANSFER_BUF);
+	req_data->transfers[0].xfer_flags = GB_SPI_XFER_WRITE;
+	for (i = 0; i < TRANSFER_BUF; i++) {
+		write_data[i] = i;
+	}
+
+	req_data->transfers[1].speed_hz = 10000;
+	req_data->transfers[1].len = sys_cpu_to_le32(TRANSFER_BUF);
+	req_data->transfers[1].xfer_flags = GB_SPI_XFER_READ;
+
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_equal(gb_message_type(resp.msg), GB_RESPONSE(GB_SPI_TYPE_TRANSFER),
+		      "Invalid response type");
+	zassert(gb_message_is_success(resp.msg), "Request failed");
+	zassert_equal(gb_message_payload_len(resp.msg), TRANSFER_BUF, "Invalid response size");
+
+	for (i = 0; i < TRANSFER_BUF; i++) {
+		zassert_equal(resp.msg->payload[i], i, "Unexpected data");
+	}
+
+	gb_message_dealloc(resp.msg);
+}
+
+/* Transfers that do not match the request size are refused, nothing is read past the request */
+ZTEST(greybus_spi_tests, test_short_request)
+{
+	struct gb_msg_with_cport resp;
+	struct gb_spi_transfer_request *req_data;
+	struct gb_message *req = gb_message_request_alloc(
+		sizeof(*req_data) + sizeof(struct gb_spi_transfer) * 2 + 1, GB_SPI_TYPE_TRANSFER,
+		false);
+
+	memset(req->payload, 0, gb_message_payload_len(req));
+
+	/* The write data is TRANSFER_BUF bytes, only one is there */
+	req_data = (struct gb_spi_transfer_request *)req->payload;
+	req_data->count = sys_cpu_to_le16(2);
+	req_data->transfers[0].speed_hz = 10000;
+	req_data->transfers[0].len = sys_cpu_to_le32(TRANSFER_BUF);
+	req_data->transfers[0].xfer_flags = GB_SPI_XFER_WRITE;
+	req_data->transfers[1].speed_hz = 10000;
+	req_data->transfers[1].len = sys_cpu_to_le32(TRANSFER_BUF);
+	req_data->transfers[1].xfer_flags = GB_SPI_XFER_READ;
+
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.cport, 1, "Invalid cport");
+	zassert_equal(resp.msg->header.result, GB_OP_INVALID, "Short write data accepted");
+	gb_message_dealloc(resp.msg);
+
+	/* More descriptors than the request holds */
+	req = gb_message_request_alloc(sizeof(*req_data) + sizeof(struct gb_spi_transfer),
+				       GB_SPI_TYPE_TRANSFER, false);
+	memset(req->payload, 0, gb_message_payload_len(req));
+	req_data = (struct gb_spi_transfer_request *)req->payload;
+	req_data->count = sys_cpu_to_le16(4);
+
+	greybus_rx_handler(1, req);
+	resp = gb_transport_get_message();
+	zassert_equal(resp.msg->header.result, GB_OP_INVALID, "Missing descriptors accepted");
+	gb_message_dealloc(resp.msg);
+}